@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "sqlite3/sqlite3.h"
+
+#include "aggregate.h"
+#include "misc.h"
+
+#define ROWS        1000000
+#define ITERATIONS  20
+
+static const char *kernel_names[] = { "scalar", "avx2" };
+
+#define NUM_KERNEL_NAMES (int) (sizeof(kernel_names) / sizeof(kernel_names[0]))
+
+// bench_kernel returns the average time in milliseconds of
+// a kernel over all rows, or -1 if the CPU can't run it.
+static double bench_kernel(const char *name, const uint32_t *keys, const int64_t *values, int64_t *sums, size_t nkeys, const int64_t *expected) {
+    int i;
+    double start;
+    Group_Sum kernel = group_sum_kernel(name);
+
+    if (kernel == NULL) {
+        return -1;
+    }
+
+    start = monotonic_time();
+
+    for (i = 0; i < ITERATIONS; i++) {
+        memset(sums, 0, nkeys * sizeof(int64_t));
+        kernel(keys, values, ROWS, sums, nkeys);
+    }
+
+    if (memcmp(sums, expected, nkeys * sizeof(int64_t)) != 0) {
+        fprintf(stderr, "Kernel %s gave wrong sums\n", name);
+        exit(1);
+    }
+
+    return (monotonic_time() - start) * 1e3 / ITERATIONS;
+}
+
+// bench_sql returns the average time in milliseconds of the
+// GROUP BY the database runs for balances, over the same rows.
+static double bench_sql(sqlite3 *db) {
+    int i;
+    double start;
+    sqlite3_stmt *stmt;
+    volatile double sink = 0;
+
+    sqlite3_prepare_v2(db,
+        "SELECT wallet_id, SUM(amount) FROM transactions GROUP BY wallet_id;",
+        -1, &stmt, NULL
+    );
+
+    start = monotonic_time();
+
+    for (i = 0; i < ITERATIONS; i++) {
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            sink += sqlite3_column_double(stmt, 1);
+        }
+        sqlite3_reset(stmt);
+    }
+
+    (void) sink;
+    sqlite3_finalize(stmt);
+
+    return (monotonic_time() - start) * 1e3 / ITERATIONS;
+}
+
+// load_sql fills an in-memory transactions table with the rows.
+static sqlite3 *load_sql(const uint32_t *keys, const int64_t *values) {
+    int i;
+    sqlite3 *db;
+    sqlite3_stmt *stmt;
+
+    sqlite3_open(":memory:", &db);
+    sqlite3_exec(db,
+        "CREATE TABLE transactions (id INTEGER PRIMARY KEY, wallet_id INTEGER, amount REAL);"
+        "BEGIN;",
+        NULL, NULL, NULL
+    );
+    sqlite3_prepare_v2(db,
+        "INSERT INTO transactions (wallet_id, amount) VALUES (?, ?);",
+        -1, &stmt, NULL
+    );
+
+    for (i = 0; i < ROWS; i++) {
+        sqlite3_bind_int(stmt, 1, keys[i]);
+        sqlite3_bind_double(stmt, 2, values[i] / 100.0);
+        sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+    }
+
+    sqlite3_finalize(stmt);
+    sqlite3_exec(db,
+        "COMMIT;"
+        "CREATE INDEX idx_transactions_wallet ON transactions (wallet_id, amount);",
+        NULL, NULL, NULL
+    );
+
+    return db;
+}
+
+int main(void) {
+    int i, j;
+    size_t nkeys;
+    size_t key_counts[] = { 2, 4, 8, 16, 256 };
+    uint32_t *keys;
+    int64_t *values, *sums, *expected;
+    sqlite3 *db;
+
+    keys = (uint32_t *) malloc(ROWS * sizeof(uint32_t));
+    values = (int64_t *) malloc(ROWS * sizeof(int64_t));
+    sums = (int64_t *) malloc(256 * sizeof(int64_t));
+    expected = (int64_t *) malloc(256 * sizeof(int64_t));
+
+    if (!keys || !values || !sums || !expected) {
+        fprintf(stderr, "Memory allocation error\n");
+        return 1;
+    }
+
+    srand(42);
+
+    for (i = 0; i < ROWS; i++) {
+        values[i] = (rand() % 200000) - 100000;
+    }
+
+    printf("%d rows, group_sum picks %s up to %d keys\n\n",
+        ROWS, group_sum_name(1), GROUP_SUM_SIMD_KEYS
+    );
+    printf("%-8s", "keys");
+    for (j = 0; j < NUM_KERNEL_NAMES; j++) {
+        printf("%12s", kernel_names[j]);
+    }
+    printf("%12s\n", "sql");
+
+    for (i = 0; i < (int) (sizeof(key_counts) / sizeof(key_counts[0])); i++) {
+        nkeys = key_counts[i];
+
+        for (j = 0; j < ROWS; j++) {
+            keys[j] = rand() % nkeys;
+        }
+
+        memset(expected, 0, nkeys * sizeof(int64_t));
+        group_sum_kernel("scalar")(keys, values, ROWS, expected, nkeys);
+
+        printf("%-8zu", nkeys);
+        for (j = 0; j < NUM_KERNEL_NAMES; j++) {
+            double ms = bench_kernel(kernel_names[j], keys, values, sums, nkeys, expected);
+
+            if (ms < 0) {
+                printf("%12s", "-");
+            } else {
+                printf("%10.2lfms", ms);
+            }
+        }
+
+        db = load_sql(keys, values);
+        printf("%10.2lfms\n", bench_sql(db));
+        sqlite3_close(db);
+    }
+
+    free(keys);
+    free(values);
+    free(sums);
+    free(expected);
+
+    return 0;
+}
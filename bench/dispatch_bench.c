@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dispatch.h"
+#include "misc.h"
+
+#define ITERATIONS 10000000
+
+// Same tables as the shell
+static char *lst_cmd[] = {
+    "wallet",
+    "category",
+    "transaction",
+    "export",
+    "overview",
+    "consolidate",
+    "backup",
+    "restore",
+    "explain",
+    "cache",
+    "report",
+    "recurring",
+    "transfer",
+    "archive",
+    "replay",
+    "undo",
+    "redo",
+    "changes",
+    "mem",
+    "budget",
+    "fx",
+    "help",
+    "exit"
+};
+
+static char *lst_sub_cmd[] = {
+    "add",
+    "create",
+    "display",
+    "print",
+    "show",
+    "delete",
+    "remove"
+};
+
+#define NUM_CMD     (int) (sizeof(lst_cmd) / sizeof(lst_cmd[0]))
+#define NUM_SUB_CMD (int) (sizeof(lst_sub_cmd) / sizeof(lst_sub_cmd[0]))
+
+// linear_lookup is the strcmp loop the shell used before.
+static int linear_lookup(char **names, int count, const char *name) {
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (strcmp(name, names[i]) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// bench runs lookups of every name in turn and returns
+// the average time of a lookup in nanoseconds.
+static double bench(Dispatch *dispatch, char **names, int count, char **inputs, int num_inputs) {
+    int i;
+    volatile int sink = 0;
+    double start;
+
+    start = monotonic_time();
+
+    for (i = 0; i < ITERATIONS; i++) {
+        if (dispatch != NULL) {
+            sink += dispatch_lookup(dispatch, inputs[i % num_inputs]);
+        } else {
+            sink += linear_lookup(names, count, inputs[i % num_inputs]);
+        }
+    }
+
+    (void) sink;
+
+    return (monotonic_time() - start) * 1e9 / ITERATIONS;
+}
+
+int main(void) {
+    Dispatch cmd_dispatch;
+    Dispatch sub_cmd_dispatch;
+    // Command lines of a typical script
+    char *cmds[] = { "transaction", "transaction", "wallet", "overview", "category" };
+    char *sub_cmds[] = { "add", "show", "remove", "add", "delete" };
+    char *prefixes[] = { "tr", "w", "ov", "cat", "exi" };
+
+    if (dispatch_init(&cmd_dispatch, lst_cmd, NUM_CMD) != 0 ||
+        dispatch_init(&sub_cmd_dispatch, lst_sub_cmd, NUM_SUB_CMD) != 0) {
+        fprintf(stderr, "Couldn't build the dispatch tables\n");
+        return 1;
+    }
+
+    printf("%-24s%12s%12s\n", "lookup", "linear", "hash");
+    printf("%-24s%9.1lfns%9.1lfns\n", "command",
+        bench(NULL, lst_cmd, NUM_CMD, cmds, 5),
+        bench(&cmd_dispatch, lst_cmd, NUM_CMD, cmds, 5)
+    );
+    printf("%-24s%9.1lfns%9.1lfns\n", "sub-command",
+        bench(NULL, lst_sub_cmd, NUM_SUB_CMD, sub_cmds, 5),
+        bench(&sub_cmd_dispatch, lst_sub_cmd, NUM_SUB_CMD, sub_cmds, 5)
+    );
+    printf("%-24s%12s%9.1lfns\n", "command prefix", "-",
+        bench(&cmd_dispatch, lst_cmd, NUM_CMD, prefixes, 5)
+    );
+
+    return 0;
+}
@@ -0,0 +1,24 @@
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Group-by-sum kernels over a key column and a value column,
+// as stored by the transactions cache. Keys are expected to be
+// small and dense (wallet or category ids); keys outside of
+// [0, nkeys) are ignored.
+//
+// The vector kernel compares every row against every key, so
+// it is only picked up to GROUP_SUM_SIMD_KEYS keys. Larger key
+// spaces go through the scalar kernel.
+
+#define GROUP_SUM_SIMD_KEYS 4
+
+typedef void (*Group_Sum)(const uint32_t *, const int64_t *, size_t, int64_t *, size_t);
+
+void group_sum(const uint32_t *, const int64_t *, size_t, int64_t *, size_t);
+const char *group_sum_name(size_t);
+Group_Sum group_sum_kernel(const char *);
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_BLOCK_SIZE 4096
+
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t size;
+    size_t used;
+} ArenaBlock;
+
+// Arena is a bump allocator: allocations are carved out of large
+// blocks and released all at once by arena_reset or arena_free.
+typedef struct Arena {
+    ArenaBlock *head;
+    size_t block_size;
+    size_t allocated;
+    size_t used;
+} Arena;
+
+void arena_init(Arena *, size_t);
+void *arena_alloc(Arena *, size_t);
+void arena_reset(Arena *);
+void arena_free(Arena *);
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Memory-mapped column store of the transactions used to answer
+// balances and overviews without going through SQLite. Columns are
+// allocated for capacity rows and filled up to count rows:
+//
+//  Cache_Header
+//  int64_t  id[capacity]
+//  int64_t  amount[capacity]       in cents
+//  uint32_t wallet_id[capacity]
+//  uint32_t category_id[capacity]
+//  int32_t  date[capacity]         as YYYYMMDD
+//
+// The cache is up to date when its generation matches the
+// transactions generation stored in the database.
+
+#define CACHE_MAGIC     "MYBCCH1"
+#define CACHE_VERSION   1
+#define CACHE_CAPACITY  4096
+#define CACHE_SUFFIX    "-cache"
+
+typedef struct Cache_Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    int64_t generation;
+    uint64_t count;
+    uint64_t capacity;
+} Cache_Header;
+
+typedef struct Cache {
+    int fd;
+    size_t size;
+    Cache_Header *header;
+    int64_t *ids;
+    int64_t *amounts;
+    uint32_t *wallets;
+    uint32_t *categories;
+    int32_t *dates;
+} Cache;
+
+Cache *cache_open(const char *, uint64_t);
+void cache_close(Cache *);
+int cache_append(Cache *, int64_t, double, uint32_t, uint32_t, const char *);
+
+int64_t cache_cents(double);
+int32_t cache_date(const char *);
+
+void cache_sum_by_wallet(const Cache *, int64_t *, size_t);
+void cache_sum_by_category(const Cache *, int64_t *, size_t);
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef CHANGES_H
+#define CHANGES_H
+
+#include "sqlite3/sqlite3.h"
+
+// Rows of the change journal are packed as one value after the
+// other, each a tag byte followed by its payload:
+//
+//  CHANGE_NULL
+//  CHANGE_INT    zigzag varint
+//  CHANGE_FLOAT  8 bytes, native order
+//  CHANGE_TEXT   varint length, bytes
+//  CHANGE_BLOB   varint length, bytes
+//
+// Varints hold 7 bits per byte, low bits first, the high bit set
+// on every byte but the last.
+
+#define CHANGE_NULL  0
+#define CHANGE_INT   1
+#define CHANGE_FLOAT 2
+#define CHANGE_TEXT  3
+#define CHANGE_BLOB  4
+
+void change_pack(sqlite3_context *, int, sqlite3_value **);
+int change_bind(sqlite3_stmt *, const unsigned char *, int);
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef COLUMNAR_H
+#define COLUMNAR_H
+
+#include <stdint.h>
+
+#include "db.h"
+
+// Columnar snapshot of the transactions, laid out so it can be
+// memory-mapped and scanned without parsing. All integers are
+// little-endian and every section starts on an 8-byte boundary.
+//
+//  Columnar_Header
+//  row group 0 .. n-1:
+//      Columnar_RowGroup
+//      int64_t  id[rows]
+//      int64_t  amount[rows]           in cents
+//      uint32_t wallet[rows]           index in the wallet dictionary
+//      uint32_t category[rows]         index in the category dictionary
+//      uint32_t currency[rows]         index in the currency dictionary
+//      uint32_t name_offset[rows + 1]  into the name heap
+//      char     name_heap[]
+//      uint32_t description_offset[rows + 1]
+//      char     description_heap[]
+//  footer, at header.footer_offset:
+//      Columnar_Footer
+//      uint64_t row_group_offset[row_group_count]
+//      wallet dictionary:   int64_t id[count], uint32_t name_offset[count + 1], char heap[]
+//      category dictionary: int64_t id[count], uint32_t name_offset[count + 1], char heap[]
+//      currency dictionary: uint32_t code_offset[count + 1], char heap[]
+//
+// Currency codes are those of the transactions, the base currency
+// being the empty code.
+
+#define COLUMNAR_MAGIC          "MYBCOL1"
+#define COLUMNAR_VERSION        2
+#define COLUMNAR_ROW_GROUP_SIZE 65536
+
+typedef struct Columnar_Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t row_group_size;
+    uint64_t row_count;
+    uint64_t footer_offset;
+} Columnar_Header;
+
+// Row group header with the statistics of the group,
+// so scans can skip groups by id or amount.
+typedef struct Columnar_RowGroup {
+    uint32_t rows;
+    uint32_t reserved;
+    int64_t min_id;
+    int64_t max_id;
+    int64_t min_amount;
+    int64_t max_amount;
+    uint64_t name_heap_size;
+    uint64_t description_heap_size;
+} Columnar_RowGroup;
+
+typedef struct Columnar_Footer {
+    uint32_t row_group_count;
+    uint32_t wallet_count;
+    uint32_t category_count;
+    uint32_t currency_count;
+} Columnar_Footer;
+
+int export_columnar(DB_Handler *, const char *, unsigned int, uint64_t *);
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef CONSOLIDATE_H
+#define CONSOLIDATE_H
+
+#include "db.h"
+
+// Consolidation holds aggregates merged across several ledgers.
+// Wallets are matched by name and currency, categories by name,
+// whose amounts are in the base currency.
+typedef struct Consolidation {
+    Queue *wallets;
+    Queue *categories;
+    unsigned int ledgers;
+    unsigned int failures;
+} Consolidation;
+
+int consolidate(int, char **, Consolidation *);
+void clear_consolidation(Consolidation *);
+
+#endif
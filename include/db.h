@@ -3,8 +3,24 @@
 
 #include <time.h>
 #include "sqlite3/sqlite3.h"
+#include "cache.h"
 
 #define DB_NAME "myBudget.db"
+#define DB_NAME_SIZE 256
+
+#define ARCHIVE_SUFFIX "-archive-"
+
+#define BACKUP_PAGES 256
+#define BACKUP_SLEEP 10
+
+#define DELETE_CHUNK 1000
+
+#define UNDO_DEPTH 256
+
+#define RESULT_CACHE_SIZE 16
+
+#define CHANGE_LOG_PAGE 1024
+#define CHANGE_LOG_POLL 200
 
 typedef enum RECORD_TYPES {
     WALLET_TYPE,
@@ -12,15 +28,147 @@ typedef enum RECORD_TYPES {
     TRANSACTION_TYPE
 } RECORD_TYPES;
 
+// Prepared statements cached by each handler.
+typedef enum DB_STMT {
+    STMT_ADD_WALLET,
+    STMT_ADD_CATEGORY,
+    STMT_ADD_TRANSACTION,
+    STMT_GET_WALLETS,
+    STMT_GET_CATEGORIES,
+    STMT_GET_TRANSACTIONS,
+    STMT_GET_CATEGORIES_OVERVIEW,
+    STMT_REMOVE_WALLET_TRANSACTIONS,
+    STMT_REMOVE_WALLET,
+    STMT_UNSET_CATEGORY,
+    STMT_REMOVE_CATEGORY,
+    STMT_REMOVE_TRANSACTION,
+    STMT_COUNT_WALLETS,
+    STMT_COUNT_CATEGORIES,
+    STMT_COUNT_TRANSACTIONS,
+    STMT_GET_GENERATION,
+    STMT_GET_WALLET_NAMES,
+    STMT_GET_CACHE_ROWS,
+    STMT_ADD_RECURRING,
+    STMT_GET_RECURRING,
+    STMT_REMOVE_RECURRING,
+    STMT_ADD_RECURRING_TRANSACTION,
+    STMT_UPDATE_RECURRING,
+    STMT_ADD_TRANSFER,
+    STMT_ADD_TRANSFER_LEG,
+    STMT_GET_ARCHIVE_YEARS,
+    STMT_ADD_OPENING_BALANCES,
+    STMT_ARCHIVE_BUDGETS,
+    STMT_REMOVE_ARCHIVED,
+    STMT_SET_OPENING_BALANCES,
+    STMT_ADD_ARCHIVE,
+    STMT_GET_ARCHIVES,
+    STMT_HAS_WALLETS,
+    STMT_HAS_CATEGORIES,
+    STMT_HAS_TRANSACTIONS,
+    STMT_COUNT_MATCHING,
+    STMT_GET_CHUNK_END,
+    STMT_REMOVE_CHUNK,
+    STMT_NEXT_BATCH,
+    STMT_TRIM_CHANGES,
+    STMT_CLEAR_CHANGES,
+    STMT_PURGE_REDO,
+    STMT_GET_UNDO_BATCHES,
+    STMT_GET_REDO_BATCHES,
+    STMT_GET_UNDO_CHANGES,
+    STMT_GET_REDO_CHANGES,
+    STMT_SET_UNDONE,
+    STMT_GET_CHANGE_LOG,
+    STMT_PRUNE_CHANGE_LOG,
+    STMT_DATA_VERSION,
+    STMT_ADD_BUDGET,
+    STMT_GET_BUDGETS,
+    STMT_REMOVE_BUDGET,
+    STMT_CHECK_BUDGETS,
+    STMT_SET_RATE,
+    STMT_GET_RATES,
+    STMT_REMOVE_RATE,
+    STMT_HAS_CURRENCIES,
+    STMT_GET_WALLETS_FX,
+    STMT_GET_CATEGORIES_OVERVIEW_FX,
+    STMT_GET_CASH_FLOWS,
+    NUM_DB_STMT
+} DB_STMT;
+
+// Result of a query, kept as long as the database doesn't change:
+// neither data_version, bumped by commits of other connections, nor
+// the number of changes made through the handler.
+typedef struct Result_Entry {
+    int used;
+    DB_STMT stmt;
+    char key[48];
+    int version;
+    int changes;
+    struct Queue *records;
+} Result_Entry;
+
+// Results of the last queries, replaced in turn.
+typedef struct Result_Cache {
+    Result_Entry entries[RESULT_CACHE_SIZE];
+    int next;
+    unsigned long long hits;
+    unsigned long long misses;
+} Result_Cache;
+
+// Exchange rate of a currency, the value of one unit in the base
+// currency from date until the next rate.
+typedef struct FX_Rate {
+    char currency[4];
+    char date[11];
+    double rate;
+} FX_Rate;
+
+// Rates loaded for the query being run, sorted by currency and date,
+// so amounts are converted by a lookup instead of a join per row.
+// missing counts the amounts the last call of get_wallets,
+// get_categories_overview, report_top or report_percentiles left out
+// for lack of a rate, by day in the first two, 0 when the result
+// came from a cache.
+typedef struct FX_Table {
+    FX_Rate *rates;
+    size_t count;
+    size_t capacity;
+    unsigned int missing;
+} FX_Table;
+
+// Called by add_transaction for each budget whose warning threshold
+// (over is 0) or limit (over is 1) the transaction crossed.
+struct Budget;
+typedef void (*Budget_Callback)(const struct Budget *, int, void *);
+
+// DB_Handler holds everything needed to talk to one database:
+// the connection, its statement cache and optionally the mapped
+// transactions cache, and the last query results. A handler must only be
+// used by one thread at a time, but any number of handlers can be
+// used concurrently.
 typedef struct DB_Handler {
     sqlite3 *db;
-    char db_name[32];
+    char db_name[DB_NAME_SIZE];
+    sqlite3_stmt *stmts[NUM_DB_STMT];
+    Cache *cache;
+    Result_Cache results;
+    // Batch of the change journal changes go to, none if 0
+    sqlite3_int64 change_batch;
+    // Alerts of the budgets, none if NULL
+    Budget_Callback budget_hook;
+    void *budget_udata;
+    // Rates used by the fx() SQL function
+    FX_Table fx;
+    // Rows of the records written, see count_rows
+    sqlite3_int64 rows;
 } DB_Handler;
 
+// Amounts are in the currency of the wallet, an ISO 4217 code, or
+// in the base currency if it is empty.
 typedef struct Wallet {
     unsigned int id;
     char name[32];
     double balance;
+    char currency[4];
 } Wallet;
 
 typedef struct Category {
@@ -34,14 +182,83 @@ typedef struct Transaction {
     char name[64];
     char description[1024];
     double amount;
+    char date[11];
+    // Currency of the wallet if empty when added
+    char currency[4];
     Wallet wallet;
     Category category;
 } Transaction;
 
+// Schedules of recurring transactions
+typedef enum RECURRING_RULE {
+    RULE_DAILY,
+    RULE_WEEKLY,
+    RULE_MONTHLY,
+    RULE_YEARLY,
+    NUM_RULES
+} RECURRING_RULE;
+
+// Template of a transaction repeated every `every` days, weeks,
+// months or years from start_date. Occurrences counts how many
+// have been materialized, next_date is the date of the next one.
+typedef struct Recurring {
+    unsigned int id;
+    char name[64];
+    char description[1024];
+    double amount;
+    RECURRING_RULE rule;
+    unsigned int every;
+    char start_date[11];
+    char next_date[11];
+    unsigned int occurrences;
+    Wallet wallet;
+    Category category;
+} Recurring;
+
+// Money moved from one wallet to another, written as a debit
+// and a credit transaction sharing the transfer id.
+typedef struct Transfer {
+    unsigned int id;
+    Wallet from;
+    Wallet to;
+    double amount;
+    char date[11];
+    char description[64];
+} Transfer;
+
+// Limit on the spending of a wallet, a category or both, whichever
+// ids aren't 0, over each period. warn is the fraction of the limit
+// to warn at. spent is the running total of the period from start.
+typedef struct Budget {
+    unsigned int id;
+    Wallet wallet;
+    Category category;
+    RECURRING_RULE period;
+    double limit;
+    double warn;
+    char start[11];
+    double spent;
+} Budget;
+
+// Event of the change log. The transaction is filled, as it is now,
+// for inserts and updates of transactions still in the ledger.
+typedef struct Change_Event {
+    sqlite3_int64 seq;
+    char time[32];
+    char op[8];
+    char table[16];
+    sqlite3_int64 row_id;
+    int has_transaction;
+    Transaction transaction;
+} Change_Event;
+
 typedef union Record {
     Wallet wallet;
     Category category;
     Transaction transaction;
+    Recurring recurring;
+    Budget budget;
+    FX_Rate rate;
 } Record;
 
 typedef struct Queue {
@@ -49,25 +266,108 @@ typedef struct Queue {
     struct Queue *next;
 } Queue;
 
-DB_Handler *connect(const char *);
+// Called for each row by iterate_transactions, non-zero stops.
+typedef int (*Transaction_Callback)(const Transaction *, void *);
+
+// Memory used by SQLite and by the lists of records, in bytes.
+typedef struct DB_Memory {
+    // Heap of SQLite, for the whole process
+    sqlite3_int64 used;
+    sqlite3_int64 highwater;
+    sqlite3_int64 allocations;
+    sqlite3_int64 heap_limit;
+    // Connection of the handler
+    sqlite3_int64 cache_used;
+    sqlite3_int64 cache_limit;
+    sqlite3_int64 schema_used;
+    sqlite3_int64 stmt_used;
+    size_t mapped;
+    // Queue lists, for the whole process
+    size_t queue_used;
+    size_t queue_highwater;
+} DB_Memory;
+
+// Called for each event by iterate_change_log, non-zero stops.
+typedef int (*Change_Callback)(const Change_Event *, void *);
+
+// Called after each backup step with remaining and total pages,
+// and after each chunk of a bulk delete with remaining and total rows.
+typedef void (*DB_Progress)(int, int, void *);
+
+DB_Handler *connect(const char *, int);
+void disconnect(DB_Handler *);
+
+int init_db(DB_Handler *);
+
+int add_wallet(DB_Handler *, Wallet *);
+int add_category(DB_Handler *, Category *);
+int add_transaction(DB_Handler *, Transaction *);
+int add_transfer(DB_Handler *, Transfer *);
+int add_transfers(DB_Handler *, Transfer *, size_t);
+
+Queue *get_wallets(DB_Handler *, Wallet *);
+Queue *get_categories(DB_Handler *, Category *);
+Queue *get_transactions(DB_Handler *, Transaction *);
+int iterate_transactions(DB_Handler *, Transaction *, Transaction_Callback, void *);
+int iterate_transactions_between(DB_Handler *, const char *, const char *, Transaction_Callback, void *);
+int iterate_cash_flows(DB_Handler *, Transaction_Callback, void *);
+
+Queue *get_categories_overview(DB_Handler *, Category *);
+
+int remove_wallet(DB_Handler *, Wallet *);
+int remove_category(DB_Handler *, Category *);
+int remove_transaction(DB_Handler *, Transaction *);
+unsigned int count_matching(DB_Handler *, Transaction *, const char *, sqlite3_int64 *);
+int remove_matching(DB_Handler *, Transaction *, const char *, sqlite3_int64, int, unsigned int *, DB_Progress, void *);
+
+unsigned int count_records(DB_Handler *, RECORD_TYPES);
+int has_records(DB_Handler *, RECORD_TYPES);
+int count_changes(DB_Handler *);
+sqlite3_int64 count_rows(DB_Handler *);
+
+int add_recurring(DB_Handler *, Recurring *);
+Queue *get_recurring(DB_Handler *, Recurring *);
+int remove_recurring(DB_Handler *, Recurring *);
+int materialize_recurring(DB_Handler *, const char *, unsigned int *);
+int parse_rule(const char *);
+
+int add_budget(DB_Handler *, Budget *);
+Queue *get_budgets(DB_Handler *, const char *);
+int remove_budget(DB_Handler *, Budget *);
+void set_budget_hook(DB_Handler *, Budget_Callback, void *);
+
+int set_rate(DB_Handler *, FX_Rate *);
+Queue *get_rates(DB_Handler *, const char *);
+int remove_rate(DB_Handler *, FX_Rate *);
+int load_rates(DB_Handler *);
+int has_currencies(DB_Handler *);
+int convert_amount(DB_Handler *, double, const char *, const char *, const char *, double *);
+
+int archive_transactions(DB_Handler *, const char *, unsigned int *, unsigned int *);
 
-int init_db();
+void next_change_batch(DB_Handler *);
+int undo_changes(DB_Handler *, int, unsigned int *, unsigned int *);
+int redo_changes(DB_Handler *, int, unsigned int *, unsigned int *);
 
-int add_wallet(Wallet *);
-int add_category(Category *);
-int add_transaction(Transaction *);
+int iterate_change_log(DB_Handler *, sqlite3_int64, Change_Callback, void *, sqlite3_int64 *);
+int prune_change_log(DB_Handler *, sqlite3_int64, unsigned int *);
+int data_version(DB_Handler *, int *);
+const char *rule_name(RECURRING_RULE);
 
-Queue *get_wallets(Wallet *);
-Queue *get_categories(Category *);
-Queue *get_transactions(Transaction *);
+int enable_cache(DB_Handler *);
+void disable_cache(DB_Handler *);
+int rebuild_cache(DB_Handler *);
+int is_cache_fresh(DB_Handler *);
+void clear_results(DB_Handler *);
 
-Queue *get_categories_overview(Category *);
+void db_memory(DB_Handler *, DB_Memory *);
+int set_memory_limits(DB_Handler *, sqlite3_int64, sqlite3_int64);
 
-int remove_wallet(Wallet *);
-int remove_category(Category *);
-int remove_transaction(Transaction *);
+const char *get_query_sql(DB_STMT);
+char *get_query_plan(DB_Handler *, DB_STMT);
 
-unsigned int count_records(RECORD_TYPES);
+int backup_db(DB_Handler *, const char *, int, int, DB_Progress, void *);
+int restore_db(DB_Handler *, const char *, int, int, DB_Progress, void *);
 
 void clear_queue(Queue *);
 
@@ -0,0 +1,25 @@
+#ifndef DISPATCH_H
+#define DISPATCH_H
+
+// Number of hash slots, must be a power of two
+// larger than the number of names.
+#define DISPATCH_SLOTS      128
+
+#define DISPATCH_NOT_FOUND  -1
+#define DISPATCH_AMBIGUOUS  -2
+
+// Dispatch maps names to their index in a table of names
+// through a collision-free hash, so an exact lookup costs one
+// hash and one string comparison.
+typedef struct Dispatch {
+    char **names;
+    int count;
+    unsigned int seed;
+    unsigned char slots[DISPATCH_SLOTS];
+    unsigned char lengths[DISPATCH_SLOTS];
+} Dispatch;
+
+int dispatch_init(Dispatch *, char **, int);
+int dispatch_lookup(const Dispatch *, const char *);
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdio.h>
+
+// Append-only history of the commands of shell sessions, one line
+// per command:
+//
+//  timestamp \t latency \t rows \t command
+//
+// timestamp is the wall clock time the command started at, in
+// seconds, latency is in milliseconds and rows is the number of
+// rows of records the command inserted, updated or deleted. Rows
+// written by triggers to keep counts, journals and totals aren't
+// counted.
+
+//
+// A new journal is followed by the path of a snapshot of the database
+// taken before its first command, which replays start from:
+//
+//  # snapshot path
+
+#define JOURNAL_SUFFIX          "-history"
+#define JOURNAL_HEADER          "# myBudget history 1"
+#define JOURNAL_SNAPSHOT        "# snapshot "
+#define JOURNAL_SNAPSHOT_SUFFIX "-start"
+
+typedef struct Journal {
+    FILE *file;
+    // Set if the journal was created by journal_open
+    int created;
+} Journal;
+
+typedef struct Journal_Entry {
+    double timestamp;
+    double latency;
+    int rows;
+    char *command;
+} Journal_Entry;
+
+Journal *journal_open(const char *);
+void journal_append(Journal *, double, double, int, const char *);
+void journal_snapshot(Journal *, const char *);
+void journal_close(Journal *);
+int journal_parse(char *, Journal_Entry *);
+const char *journal_parse_snapshot(const char *);
+
+#endif
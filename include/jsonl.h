@@ -0,0 +1,28 @@
+#ifndef JSONL_H
+#define JSONL_H
+
+#include <stdio.h>
+
+// Buffered writer of JSON Lines, one object per line. Fields are
+// appended straight into the buffer, which goes to the file when
+// it is full or flushed.
+
+#define JSONL_BUFFER_SIZE 65536
+
+typedef struct Json_Writer {
+    FILE *file;
+    size_t size;
+    // Whether the object being written has a field yet
+    int fields;
+    char buffer[JSONL_BUFFER_SIZE];
+} Json_Writer;
+
+void jsonl_init(Json_Writer *, FILE *);
+void jsonl_begin(Json_Writer *);
+void jsonl_end(Json_Writer *);
+void jsonl_string(Json_Writer *, const char *, const char *);
+void jsonl_int(Json_Writer *, const char *, long long);
+void jsonl_double(Json_Writer *, const char *, double);
+void jsonl_flush(Json_Writer *);
+
+#endif
@@ -18,4 +18,9 @@ enum {
 
 void pretty_printf(FILE *, int, const char *, ...);
 
+double monotonic_time(void);
+double wall_time(void);
+
+long long parse_size(const char *);
+
 #endif
\ No newline at end of file
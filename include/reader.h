@@ -0,0 +1,24 @@
+#ifndef READER_H
+#define READER_H
+
+#include <stddef.h>
+
+#define READER_BLOCK_SIZE 65536
+
+// Reader splits a file descriptor into lines. Lines are handed out
+// as slices of its buffer, valid until the next call to reader_line.
+typedef struct Reader {
+    int fd;
+    int interactive;
+    int eof;
+    char *buffer;
+    size_t size;
+    size_t start;
+    size_t end;
+} Reader;
+
+void reader_init(Reader *, int);
+char *reader_line(Reader *, size_t *);
+void reader_free(Reader *);
+
+#endif
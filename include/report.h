@@ -0,0 +1,67 @@
+#ifndef REPORT_H
+#define REPORT_H
+
+#include <stdint.h>
+
+#include "db.h"
+
+#define REPORT_TOP_N        10
+
+// Groups counted by a top scan, the last one gathering every name
+// seen once the others are taken
+#define REPORT_MAX_GROUPS   16384
+
+// The sketch answers quantiles within SKETCH_ACCURACY of the
+// exact value, relative to it, for magnitudes between
+// SKETCH_MIN_VALUE and about 1e14.
+#define SKETCH_ACCURACY     0.01
+#define SKETCH_MIN_VALUE    0.001
+#define SKETCH_BUCKETS      2048
+
+typedef enum REPORT_GROUP {
+    GROUP_CATEGORY,
+    GROUP_WALLET,
+    GROUP_NAME
+} REPORT_GROUP;
+
+typedef struct Report_Entry {
+    char name[64];
+    double amount;
+    unsigned int count;
+} Report_Entry;
+
+// Min-heap keeping the capacity largest entries pushed.
+typedef struct Top_Heap {
+    Report_Entry *entries;
+    int size;
+    int capacity;
+} Top_Heap;
+
+// Log-bucketed quantile sketch. Values are counted in buckets
+// whose bounds grow by gamma, so memory doesn't depend on the
+// number of values.
+typedef struct Sketch {
+    double gamma;
+    double log_gamma;
+    int offset;
+    uint64_t positive[SKETCH_BUCKETS];
+    uint64_t negative[SKETCH_BUCKETS];
+    uint64_t zeros;
+    uint64_t count;
+    double min;
+    double max;
+} Sketch;
+
+void top_init(Top_Heap *, int);
+void top_push(Top_Heap *, const Report_Entry *);
+int top_sort(Top_Heap *);
+void top_free(Top_Heap *);
+
+void sketch_init(Sketch *, double);
+void sketch_add(Sketch *, double);
+double sketch_quantile(const Sketch *, double);
+
+int report_top(DB_Handler *, REPORT_GROUP, Top_Heap *);
+int report_percentiles(DB_Handler *, Sketch *);
+
+#endif
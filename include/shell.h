@@ -3,19 +3,29 @@
 
 #include "sqlite3/sqlite3.h"
 #include "db.h"
+#include "journal.h"
 
 #define SH_BUFFER_SIZE  512
 #define SH_ARGV_SIZE    16
 
-#define NUM_SH_CMD      7
+#define NUM_SH_CMD      23
 #define NUM_SH_SUB_CMD  7
 
 static char     *sh_read_line(void);
 static char     **sh_read_args(char *, int *);
-static void     clear_args(int, char **);
+static void     clear_args(void);
+
+static char     *sh_option(int, char **, const char *);
+static char     *sh_positional(int, char **, int);
+static int      sh_flag(int, char **, const char *);
+static int      sh_is_flag(const char *);
+static int      sh_confirm(const char *);
+static int      sh_output(int *, char **);
 
 static int      sh_is_int(char *);
 static int      sh_is_float(char *);
+static int      sh_is_date(char *);
+static int      sh_is_currency(char *);
 
 static int      create_wallet(Wallet *);
 static int      create_category(Category *);
@@ -24,16 +34,22 @@ static int      create_transaction(Transaction *);
 static int      show_wallets(Wallet *);
 static int      show_categories(Category *);
 static int      show_transactions(Transaction *);
+static int      print_transaction(const Transaction *, void *);
+static int      write_transaction(const Transaction *, void *);
+static int      show_transactions_between(char *, char *);
 
 static int      delete_wallet(Wallet *);
 static int      delete_category(Category *);
 static int      delete_transaction(Transaction *);
 
+static int      export_columnar_file(char *);
 static int      export_transactions(int, char **);
 
 static int      create_record(RECORD_TYPES, Record *);
 static int      show_record(RECORD_TYPES, Record *);
 static int      delete_record(RECORD_TYPES, Record *);
+static void     delete_progress(int, int, void *);
+static int      delete_matching(int, char **);
 
 static void     parse_wallet(int, char **, Wallet *);
 static void     parse_category(int, char **, Category *);
@@ -44,18 +60,83 @@ static int      category_cmd(int, char **);
 static int      transaction_cmd(int, char **);
 
 static int      categories_overview(int, char **);
+static int      consolidate_ledgers(int, char **);
+
+static int      backup_database(int, char **);
+static int      restore_database(int, char **);
+
+static int      explain_stmts(int, char **, DB_STMT *);
+static int      explain_command(int, char **);
+
+static int      cache_command(int, char **);
+
+static int      show_top(int, char **);
+static int      show_percentiles(int, char **);
+static int      report_command(int, char **);
+
+static int      parse_recurring(int, char **, Recurring *);
+static int      show_recurring(Recurring *);
+static int      materialize_recurring_transactions(int, char **);
+static int      recurring_command(int, char **);
+
+static void     budget_name(const Budget *, char *, size_t);
+static void     warn_budget(const Budget *, int, void *);
+static int      parse_budget(int, char **, Budget *);
+static int      show_budgets(int, char **);
+static int      budget_command(int, char **);
+
+static int      show_rates(const char *);
+static int      fx_command(int, char **);
+
+static Wallet   *find_wallet(Queue *, const char *);
+static int      parse_transfer(Queue *, char *, char *, char *, char *, Transfer *);
+static int      transfer_batch(char *);
+static int      transfer_command(int, char **);
+
+static int      archive_command(int, char **);
+
+static int      apply_changes(int, int, char **);
+static int      undo_command(int, char **);
+static int      redo_command(int, char **);
+
+static void     sh_interrupt(int);
+static int      print_event(const Change_Event *, void *);
+static int      changes_command(int, char **);
+static int      mem_command(int, char **);
+
+static Journal_Entry *read_journal(const char *, size_t *, char *, size_t);
+static void     replay_entries(Journal_Entry *, size_t, int, unsigned int *, double *, double *);
+static int      replay_command(int, char **);
 
 static int      wallet_help(void);
 static int      category_help(void);
 static int      transaction_help(void);
 static int      export_help(void);
 static int      overview_help(void);
+static int      consolidate_help(void);
+static int      backup_help(void);
+static int      restore_help(void);
+static int      explain_help(void);
+static int      cache_help(void);
+static int      report_help(void);
+static int      recurring_help(void);
+static int      transfer_help(void);
+static int      archive_help(void);
+static int      replay_help(void);
+static int      undo_help(void);
+static int      redo_help(void);
+static int      changes_help(void);
+static int      mem_help(void);
+static int      budget_help(void);
+static int      fx_help(void);
 
 static int      sh_help(int, char **);
 static int      sh_exit(int, char **);
 static int      sh_exec(int, char **);
-static int      sh_sub_exec(int, char **);
+static int      sh_sub_exec(RECORD_TYPES, char *, Record *);
+static void     sh_init(DB_Handler *);
 
-void    sh_spawn(void);
+int     sh_run(DB_Handler *, int, char **);
+void    sh_spawn(DB_Handler *, const char *);
 
 #endif
\ No newline at end of file
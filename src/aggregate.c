@@ -0,0 +1,173 @@
+#include <string.h>
+
+#include "aggregate.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define AGGREGATE_X86
+#include <immintrin.h>
+#endif
+
+// Rows summed per pass over a group of keys, small enough for
+// the keys and values of a block to stay in L1.
+#define GROUP_SUM_BLOCK 1024
+
+// Largest key space the scalar kernel splits into partial tables.
+#define GROUP_SUM_SPLIT_KEYS 256
+
+// group_sum_scalar adds values into sums one row at a time.
+// Small key spaces are spread over four partial tables so that
+// runs of the same key don't wait on each other's stores.
+static void group_sum_scalar(const uint32_t *keys, const int64_t *values, size_t n, int64_t *sums, size_t nkeys) {
+    size_t i, k;
+    int64_t partial[4][GROUP_SUM_SPLIT_KEYS];
+
+    if (nkeys > GROUP_SUM_SPLIT_KEYS) {
+        for (i = 0; i < n; i++) {
+            if (keys[i] < nkeys) {
+                sums[keys[i]] += values[i];
+            }
+        }
+        return;
+    }
+
+    memset(partial, 0, sizeof(partial));
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        if (keys[i] < nkeys) partial[0][keys[i]] += values[i];
+        if (keys[i + 1] < nkeys) partial[1][keys[i + 1]] += values[i + 1];
+        if (keys[i + 2] < nkeys) partial[2][keys[i + 2]] += values[i + 2];
+        if (keys[i + 3] < nkeys) partial[3][keys[i + 3]] += values[i + 3];
+    }
+
+    for (; i < n; i++) {
+        if (keys[i] < nkeys) {
+            partial[0][keys[i]] += values[i];
+        }
+    }
+
+    for (k = 0; k < nkeys; k++) {
+        sums[k] += partial[0][k] + partial[1][k] + partial[2][k] + partial[3][k];
+    }
+}
+
+#ifdef AGGREGATE_X86
+
+// group_sum_avx2 adds values into sums by comparing each
+// block of rows against four keys at a time, four rows per
+// vector. Keys are widened to 64 bits to mask the values.
+__attribute__((target("avx2")))
+static void group_sum_avx2(const uint32_t *keys, const int64_t *values, size_t n, int64_t *sums, size_t nkeys) {
+    size_t i, k, start, end, tail;
+    int64_t lanes[4][4];
+    __m256i key0, key1, key2, key3, acc0, acc1, acc2, acc3, k4, v;
+
+    tail = n & ~(size_t) 3;
+
+    for (start = 0; start < tail; start += GROUP_SUM_BLOCK) {
+        end = start + GROUP_SUM_BLOCK < tail ? start + GROUP_SUM_BLOCK : tail;
+
+        for (k = 0; k < nkeys; k += 4) {
+            key0 = _mm256_set1_epi64x((long long) k);
+            key1 = _mm256_set1_epi64x((long long) k + 1);
+            key2 = _mm256_set1_epi64x((long long) k + 2);
+            key3 = _mm256_set1_epi64x((long long) k + 3);
+            acc0 = acc1 = acc2 = acc3 = _mm256_setzero_si256();
+
+            for (i = start; i < end; i += 4) {
+                k4 = _mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i *) (keys + i)));
+                v = _mm256_loadu_si256((const __m256i *) (values + i));
+
+                acc0 = _mm256_add_epi64(acc0, _mm256_and_si256(_mm256_cmpeq_epi64(k4, key0), v));
+                acc1 = _mm256_add_epi64(acc1, _mm256_and_si256(_mm256_cmpeq_epi64(k4, key1), v));
+                acc2 = _mm256_add_epi64(acc2, _mm256_and_si256(_mm256_cmpeq_epi64(k4, key2), v));
+                acc3 = _mm256_add_epi64(acc3, _mm256_and_si256(_mm256_cmpeq_epi64(k4, key3), v));
+            }
+
+            _mm256_storeu_si256((__m256i *) lanes[0], acc0);
+            _mm256_storeu_si256((__m256i *) lanes[1], acc1);
+            _mm256_storeu_si256((__m256i *) lanes[2], acc2);
+            _mm256_storeu_si256((__m256i *) lanes[3], acc3);
+
+            for (i = 0; i < 4 && k + i < nkeys; i++) {
+                sums[k + i] += lanes[i][0] + lanes[i][1] + lanes[i][2] + lanes[i][3];
+            }
+        }
+    }
+
+    group_sum_scalar(keys + tail, values + tail, n - tail, sums, nkeys);
+}
+
+#endif
+
+static const struct {
+    const char *name;
+    Group_Sum kernel;
+} kernels[] = {
+#ifdef AGGREGATE_X86
+    { "avx2", &group_sum_avx2 },
+#endif
+    { "scalar", &group_sum_scalar }
+};
+
+#define NUM_KERNELS (int) (sizeof(kernels) / sizeof(kernels[0]))
+
+// Index of the best kernel the CPU supports, -1 until resolved.
+static int best_kernel = -1;
+
+// kernel_supported reports whether the CPU can run a kernel.
+static int kernel_supported(int i) {
+#ifdef AGGREGATE_X86
+    if (kernels[i].kernel == &group_sum_avx2) {
+        return __builtin_cpu_supports("avx2");
+    }
+#endif
+    return 1;
+}
+
+// resolve_kernel returns the index of the kernel to use for
+// nkeys keys.
+static int resolve_kernel(size_t nkeys) {
+    int i;
+
+    if (best_kernel < 0) {
+#ifdef AGGREGATE_X86
+        __builtin_cpu_init();
+#endif
+        for (i = 0; i < NUM_KERNELS - 1 && !kernel_supported(i); i++);
+        best_kernel = i;
+    }
+
+    if (nkeys > GROUP_SUM_SIMD_KEYS) {
+        return NUM_KERNELS - 1;
+    }
+
+    return best_kernel;
+}
+
+// group_sum sets sums[k] to the sum of values whose key is k,
+// for k in [0, nkeys).
+void group_sum(const uint32_t *keys, const int64_t *values, size_t n, int64_t *sums, size_t nkeys) {
+    memset(sums, 0, nkeys * sizeof(int64_t));
+    kernels[resolve_kernel(nkeys)].kernel(keys, values, n, sums, nkeys);
+}
+
+// group_sum_name returns the name of the kernel group_sum
+// uses for nkeys keys.
+const char *group_sum_name(size_t nkeys) {
+    return kernels[resolve_kernel(nkeys)].name;
+}
+
+// group_sum_kernel returns the kernel called name, or NULL if
+// it doesn't exist or the CPU doesn't support it. Kernels add
+// into sums without clearing it first.
+Group_Sum group_sum_kernel(const char *name) {
+    int i;
+
+    for (i = 0; i < NUM_KERNELS; i++) {
+        if (strcmp(kernels[i].name, name) == 0 && kernel_supported(i)) {
+            return kernels[i].kernel;
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,84 @@
+#include <stdlib.h>
+
+#include "arena.h"
+#include "rxi/log.h"
+
+// Alignment of every allocation
+#define ARENA_ALIGN sizeof(void *)
+
+// Size of the block header, rounded up to the alignment
+#define ARENA_HEADER ((sizeof(ArenaBlock) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+// arena_init prepares an empty arena. Blocks are allocated
+// on demand, block_size bytes at least.
+void arena_init(Arena *arena, size_t block_size) {
+    arena->head = NULL;
+    arena->block_size = block_size > 0 ? block_size : ARENA_BLOCK_SIZE;
+    arena->allocated = 0;
+    arena->used = 0;
+}
+
+// arena_alloc returns size bytes of aligned memory which stay
+// valid until the arena is reset.
+void *arena_alloc(Arena *arena, size_t size) {
+    ArenaBlock *block;
+    size_t block_size;
+    void *ptr;
+
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+    block = arena->head;
+
+    if (block == NULL || block->size - block->used < size) {
+        block_size = arena->block_size;
+        if (block_size < size) {
+            block_size = size;
+        }
+
+        block = (ArenaBlock *) malloc(ARENA_HEADER + block_size);
+
+        if (!block) {
+            log_fatal("Memory allocation error");
+            exit(1);
+        }
+
+        block->next = arena->head;
+        block->size = block_size;
+        block->used = 0;
+        arena->head = block;
+        arena->allocated += block_size;
+    }
+
+    ptr = (char *) block + ARENA_HEADER + block->used;
+    block->used += size;
+    arena->used += size;
+
+    return ptr;
+}
+
+// arena_reset releases every allocation. The newest block is kept
+// so steady use of the arena does not allocate at all.
+void arena_reset(Arena *arena) {
+    ArenaBlock *block, *next;
+
+    if (arena->head == NULL) {
+        return;
+    }
+
+    for (block = arena->head->next; block != NULL; block = next) {
+        next = block->next;
+        arena->allocated -= block->size;
+        free(block);
+    }
+
+    arena->head->next = NULL;
+    arena->head->used = 0;
+    arena->used = 0;
+}
+
+// arena_free releases every block of the arena.
+void arena_free(Arena *arena) {
+    arena_reset(arena);
+    free(arena->head);
+    arena_init(arena, arena->block_size);
+}
@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "cache.h"
+#include "aggregate.h"
+#include "rxi/log.h"
+
+// cache_size returns the size of a cache file holding capacity rows.
+static size_t cache_size(uint64_t capacity) {
+    return sizeof(Cache_Header) + capacity * (
+        sizeof(int64_t) +
+        sizeof(int64_t) +
+        sizeof(uint32_t) +
+        sizeof(uint32_t) +
+        sizeof(int32_t)
+    );
+}
+
+// cache_layout points the columns into the mapping.
+static void cache_layout(Cache *cache) {
+    uint64_t capacity = cache->header->capacity;
+
+    cache->ids = (int64_t *) (cache->header + 1);
+    cache->amounts = cache->ids + capacity;
+    cache->wallets = (uint32_t *) (cache->amounts + capacity);
+    cache->categories = cache->wallets + capacity;
+    cache->dates = (int32_t *) (cache->categories + capacity);
+}
+
+#if defined(_WIN32) || defined(_WIN64)
+
+Cache *cache_open(const char *path, uint64_t capacity) {
+    log_warn("Transactions cache is not supported on this platform");
+    return NULL;
+}
+
+void cache_close(Cache *cache) {
+}
+
+static int cache_grow(Cache *cache) {
+    return -1;
+}
+
+#else
+
+// cache_open maps a cache file. With a capacity, a new empty cache
+// replaces the file; otherwise an existing cache is opened.
+Cache *cache_open(const char *path, uint64_t capacity) {
+    int fd;
+    void *map;
+    size_t size;
+    struct stat st;
+    Cache *cache;
+
+    if (capacity > 0) {
+        fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        size = cache_size(capacity);
+        if (fd >= 0 && ftruncate(fd, size) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    } else {
+        fd = open(path, O_RDWR);
+        size = 0;
+        if (fd >= 0 && fstat(fd, &st) == 0) {
+            size = st.st_size;
+        }
+        if (fd >= 0 && size < sizeof(Cache_Header)) {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    if (fd < 0) {
+        return NULL;
+    }
+
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (map == MAP_FAILED) {
+        log_warn("Couldn't map cache \"%s\"", path);
+        close(fd);
+        return NULL;
+    }
+
+    cache = (Cache *) malloc(sizeof(Cache));
+
+    if (!cache) {
+        log_fatal("Memory allocation error");
+        exit(1);
+    }
+
+    cache->fd = fd;
+    cache->size = size;
+    cache->header = (Cache_Header *) map;
+
+    if (capacity > 0) {
+        memset(cache->header, 0, sizeof(Cache_Header));
+        memcpy(cache->header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+        cache->header->version = CACHE_VERSION;
+        cache->header->generation = -1;
+        cache->header->capacity = capacity;
+    } else if (
+        memcmp(cache->header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+        cache->header->version != CACHE_VERSION ||
+        cache_size(cache->header->capacity) != size ||
+        cache->header->count > cache->header->capacity
+    ) {
+        cache_close(cache);
+        return NULL;
+    }
+
+    cache_layout(cache);
+
+    return cache;
+}
+
+// cache_close unmaps the cache.
+void cache_close(Cache *cache) {
+    if (cache == NULL) {
+        return;
+    }
+
+    munmap(cache->header, cache->size);
+    close(cache->fd);
+    free(cache);
+}
+
+// cache_grow doubles the capacity of the cache. Columns are moved
+// to their new offsets, last column first since they only move up.
+static int cache_grow(Cache *cache) {
+    void *map;
+    size_t size;
+    uint64_t count = cache->header->count;
+    uint64_t capacity = cache->header->capacity * 2;
+
+    size = cache_size(capacity);
+
+    if (ftruncate(cache->fd, size) != 0) {
+        return -1;
+    }
+
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, cache->fd, 0);
+
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+
+    munmap(cache->header, cache->size);
+
+    cache->header = (Cache_Header *) map;
+    cache->size = size;
+
+    // Old layout
+    cache_layout(cache);
+    int32_t *dates = cache->dates;
+    uint32_t *categories = cache->categories;
+    uint32_t *wallets = cache->wallets;
+    int64_t *amounts = cache->amounts;
+
+    // New layout
+    cache->header->capacity = capacity;
+    cache_layout(cache);
+
+    memmove(cache->dates, dates, count * sizeof(int32_t));
+    memmove(cache->categories, categories, count * sizeof(uint32_t));
+    memmove(cache->wallets, wallets, count * sizeof(uint32_t));
+    memmove(cache->amounts, amounts, count * sizeof(int64_t));
+
+    return 0;
+}
+
+#endif
+
+// cache_append adds a transaction at the end of the cache.
+int cache_append(Cache *cache, int64_t id, double amount, uint32_t wallet_id, uint32_t category_id, const char *date) {
+    uint64_t row = cache->header->count;
+
+    if (row == cache->header->capacity && cache_grow(cache) != 0) {
+        return -1;
+    }
+
+    cache->ids[row] = id;
+    cache->amounts[row] = cache_cents(amount);
+    cache->wallets[row] = wallet_id;
+    cache->categories[row] = category_id;
+    cache->dates[row] = cache_date(date);
+
+    cache->header->count = row + 1;
+
+    return 0;
+}
+
+// cache_cents converts an amount into cents.
+int64_t cache_cents(double amount) {
+    double cents = amount * 100.0;
+
+    return (int64_t) (cents < 0 ? cents - 0.5 : cents + 0.5);
+}
+
+// cache_date converts a YYYY-MM-DD date into YYYYMMDD.
+int32_t cache_date(const char *date) {
+    int year, month, day;
+
+    if (date == NULL || sscanf(date, "%4d-%2d-%2d", &year, &month, &day) != 3) {
+        return 0;
+    }
+
+    return year * 10000 + month * 100 + day;
+}
+
+// cache_sum_by_wallet adds up amounts by wallet id into sums,
+// which has room for nkeys ids.
+void cache_sum_by_wallet(const Cache *cache, int64_t *sums, size_t nkeys) {
+    group_sum(cache->wallets, cache->amounts, cache->header->count, sums, nkeys);
+}
+
+// cache_sum_by_category adds up amounts by category id into sums,
+// which has room for nkeys ids.
+void cache_sum_by_category(const Cache *cache, int64_t *sums, size_t nkeys) {
+    group_sum(cache->categories, cache->amounts, cache->header->count, sums, nkeys);
+}
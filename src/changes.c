@@ -0,0 +1,153 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "changes.h"
+#include "rxi/log.h"
+
+// put_varint writes a varint and returns its size.
+static int put_varint(unsigned char *out, sqlite3_uint64 value) {
+    int size = 0;
+
+    while (value >= 0x80) {
+        out[size++] = (unsigned char) (value | 0x80);
+        value >>= 7;
+    }
+    out[size++] = (unsigned char) value;
+
+    return size;
+}
+
+// get_varint reads a varint of at most end - in bytes and returns
+// its size, or 0 if it is truncated.
+static int get_varint(const unsigned char *in, const unsigned char *end, sqlite3_uint64 *value) {
+    int size = 0;
+    int shift = 0;
+
+    *value = 0;
+
+    while (in + size < end && shift < 64) {
+        *value |= (sqlite3_uint64) (in[size] & 0x7f) << shift;
+        if ((in[size++] & 0x80) == 0) {
+            return size;
+        }
+        shift += 7;
+    }
+
+    return 0;
+}
+
+// change_pack is the SQL function packing its arguments into one
+// blob, called by the triggers of the journaled tables.
+void change_pack(sqlite3_context *context, int argc, sqlite3_value **argv) {
+    int i, size = 0, length;
+    sqlite3_int64 integer;
+    double real;
+    unsigned char *out;
+
+    // Tag and the largest payload of every value
+    for (i = 0; i < argc; i++) {
+        size += 1 + 10 + sqlite3_value_bytes(argv[i]);
+    }
+
+    out = (unsigned char *) malloc(size > 0 ? size : 1);
+
+    if (!out) {
+        log_fatal("Memory allocation error");
+        exit(1);
+    }
+
+    size = 0;
+
+    for (i = 0; i < argc; i++) {
+        switch (sqlite3_value_type(argv[i])) {
+            case SQLITE_INTEGER:
+                integer = sqlite3_value_int64(argv[i]);
+                out[size++] = CHANGE_INT;
+                size += put_varint(out + size, ((sqlite3_uint64) integer << 1) ^ (sqlite3_uint64) (integer >> 63));
+                break;
+            case SQLITE_FLOAT:
+                real = sqlite3_value_double(argv[i]);
+                out[size++] = CHANGE_FLOAT;
+                memcpy(out + size, &real, sizeof(real));
+                size += sizeof(real);
+                break;
+            case SQLITE_TEXT:
+                length = sqlite3_value_bytes(argv[i]);
+                out[size++] = CHANGE_TEXT;
+                size += put_varint(out + size, length);
+                memcpy(out + size, sqlite3_value_text(argv[i]), length);
+                size += length;
+                break;
+            case SQLITE_BLOB:
+                length = sqlite3_value_bytes(argv[i]);
+                out[size++] = CHANGE_BLOB;
+                size += put_varint(out + size, length);
+                if (length > 0) {
+                    memcpy(out + size, sqlite3_value_blob(argv[i]), length);
+                }
+                size += length;
+                break;
+            default:
+                out[size++] = CHANGE_NULL;
+                break;
+        }
+    }
+
+    sqlite3_result_blob(context, out, size, &free);
+}
+
+// change_bind binds the values of a packed row to the parameters
+// of a statement, in order, until every parameter is bound. It
+// returns the number of values bound, or -1 if the row is malformed.
+// Text and blobs are bound without a copy and must outlive the
+// statement's next step.
+int change_bind(sqlite3_stmt *stmt, const unsigned char *row, int size) {
+    int count = 0, n;
+    int params = sqlite3_bind_parameter_count(stmt);
+    unsigned char tag;
+    double real;
+    sqlite3_uint64 value;
+    const unsigned char *end = row + size;
+
+    while (row < end && count < params) {
+        tag = *row++;
+
+        switch (tag) {
+            case CHANGE_NULL:
+                sqlite3_bind_null(stmt, ++count);
+                break;
+            case CHANGE_INT:
+                if ((n = get_varint(row, end, &value)) == 0) {
+                    return -1;
+                }
+                row += n;
+                sqlite3_bind_int64(stmt, ++count, (sqlite3_int64) (value >> 1) ^ -(sqlite3_int64) (value & 1));
+                break;
+            case CHANGE_FLOAT:
+                if (end - row < (int) sizeof(real)) {
+                    return -1;
+                }
+                memcpy(&real, row, sizeof(real));
+                row += sizeof(real);
+                sqlite3_bind_double(stmt, ++count, real);
+                break;
+            case CHANGE_TEXT:
+            case CHANGE_BLOB:
+                if ((n = get_varint(row, end, &value)) == 0 || value > (sqlite3_uint64) (end - row - n)) {
+                    return -1;
+                }
+                row += n;
+                if (tag == CHANGE_TEXT) {
+                    sqlite3_bind_text(stmt, ++count, (const char *) row, (int) value, SQLITE_STATIC);
+                } else {
+                    sqlite3_bind_blob(stmt, ++count, row, (int) value, SQLITE_STATIC);
+                }
+                row += value;
+                break;
+            default:
+                return -1;
+        }
+    }
+
+    return count;
+}
@@ -0,0 +1,343 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "db.h"
+#include "columnar.h"
+#include "rxi/log.h"
+#include "sqlite3/sqlite3.h"
+
+// Growable byte buffer
+typedef struct Buffer {
+    char *data;
+    size_t size;
+    size_t capacity;
+} Buffer;
+
+// Dictionary encoding of wallet or category ids.
+// Ids are small and dense, so codes are indexed by id.
+// Currency codes have no id and leave codes and ids empty.
+typedef struct Dictionary {
+    uint32_t *codes;
+    size_t codes_size;
+    Buffer ids;
+    Buffer offsets;
+    Buffer names;
+    uint32_t count;
+} Dictionary;
+
+// State of an export, one row group is buffered at a time.
+typedef struct Writer {
+    FILE *file;
+    uint64_t position;
+    int error;
+    uint32_t group_size;
+    uint32_t rows;
+    uint64_t row_count;
+    int64_t *ids;
+    int64_t *amounts;
+    uint32_t *wallets;
+    uint32_t *categories;
+    uint32_t *currencies;
+    uint32_t *name_offsets;
+    uint32_t *description_offsets;
+    Buffer names;
+    Buffer descriptions;
+    Buffer group_offsets;
+    Dictionary wallet_dict;
+    Dictionary category_dict;
+    Dictionary currency_dict;
+} Writer;
+
+// xrealloc resizes memory or exits.
+static void *xrealloc(void *ptr, size_t size) {
+    ptr = realloc(ptr, size);
+
+    if (!ptr && size > 0) {
+        log_fatal("Memory allocation error");
+        exit(1);
+    }
+
+    return ptr;
+}
+
+// buffer_append appends bytes to a buffer.
+static void buffer_append(Buffer *buffer, const void *data, size_t size) {
+    if (buffer->size + size > buffer->capacity) {
+        buffer->capacity = buffer->capacity ? buffer->capacity * 2 : 4096;
+        if (buffer->capacity < buffer->size + size) {
+            buffer->capacity = buffer->size + size;
+        }
+        buffer->data = (char *) xrealloc(buffer->data, buffer->capacity);
+    }
+
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+}
+
+// dictionary_code returns the code of an id, adding it on first use.
+static uint32_t dictionary_code(Dictionary *dict, unsigned int id, const char *name) {
+    int64_t id64 = id;
+    uint32_t offset;
+    size_t size;
+
+    if (id >= dict->codes_size) {
+        size = dict->codes_size ? dict->codes_size : 64;
+        while (size <= id) {
+            size *= 2;
+        }
+        dict->codes = (uint32_t *) xrealloc(dict->codes, size * sizeof(uint32_t));
+        memset(dict->codes + dict->codes_size, 0, (size - dict->codes_size) * sizeof(uint32_t));
+        dict->codes_size = size;
+    }
+
+    // Codes are stored plus one, zero is an unseen id
+    if (dict->codes[id] == 0) {
+        if (dict->count == 0) {
+            offset = 0;
+            buffer_append(&dict->offsets, &offset, sizeof(offset));
+        }
+        buffer_append(&dict->ids, &id64, sizeof(id64));
+        buffer_append(&dict->names, name, strlen(name));
+        offset = dict->names.size;
+        buffer_append(&dict->offsets, &offset, sizeof(offset));
+        dict->codes[id] = ++dict->count;
+    }
+
+    return dict->codes[id] - 1;
+}
+
+// currency_code returns the code of a currency, adding it on first
+// use. Ledgers hold a handful of currencies, so they are looked up
+// in order.
+static uint32_t currency_code(Dictionary *dict, const char *currency) {
+    uint32_t i, offset;
+    uint32_t *offsets = (uint32_t *) dict->offsets.data;
+    size_t size = strlen(currency);
+
+    for (i = 0; i < dict->count; i++) {
+        if (offsets[i + 1] - offsets[i] == size &&
+            memcmp(dict->names.data + offsets[i], currency, size) == 0) {
+            return i;
+        }
+    }
+
+    if (dict->count == 0) {
+        offset = 0;
+        buffer_append(&dict->offsets, &offset, sizeof(offset));
+    }
+    buffer_append(&dict->names, currency, size);
+    offset = dict->names.size;
+    buffer_append(&dict->offsets, &offset, sizeof(offset));
+
+    return dict->count++;
+}
+
+// write_bytes writes a section and pads it to 8 bytes.
+static void write_bytes(Writer *writer, const void *data, size_t size) {
+    static const char padding[8] = { 0 };
+    size_t pad = (8 - size % 8) % 8;
+
+    if (writer->error) {
+        return;
+    }
+
+    if ((size > 0 && fwrite(data, 1, size, writer->file) != size) ||
+        (pad > 0 && fwrite(padding, 1, pad, writer->file) != pad)) {
+        writer->error = 1;
+        return;
+    }
+
+    writer->position += size + pad;
+}
+
+// flush_group writes the buffered rows as one row group.
+static void flush_group(Writer *writer) {
+    uint32_t i;
+    uint64_t offset;
+    Columnar_RowGroup group;
+
+    if (writer->rows == 0) {
+        return;
+    }
+
+    memset(&group, 0, sizeof(group));
+    group.rows = writer->rows;
+    group.min_id = group.max_id = writer->ids[0];
+    group.min_amount = group.max_amount = writer->amounts[0];
+
+    for (i = 1; i < writer->rows; i++) {
+        if (writer->ids[i] < group.min_id) group.min_id = writer->ids[i];
+        if (writer->ids[i] > group.max_id) group.max_id = writer->ids[i];
+        if (writer->amounts[i] < group.min_amount) group.min_amount = writer->amounts[i];
+        if (writer->amounts[i] > group.max_amount) group.max_amount = writer->amounts[i];
+    }
+
+    group.name_heap_size = writer->names.size;
+    group.description_heap_size = writer->descriptions.size;
+
+    offset = writer->position;
+    buffer_append(&writer->group_offsets, &offset, sizeof(offset));
+
+    write_bytes(writer, &group, sizeof(group));
+    write_bytes(writer, writer->ids, writer->rows * sizeof(int64_t));
+    write_bytes(writer, writer->amounts, writer->rows * sizeof(int64_t));
+    write_bytes(writer, writer->wallets, writer->rows * sizeof(uint32_t));
+    write_bytes(writer, writer->categories, writer->rows * sizeof(uint32_t));
+    write_bytes(writer, writer->currencies, writer->rows * sizeof(uint32_t));
+    write_bytes(writer, writer->name_offsets, (writer->rows + 1) * sizeof(uint32_t));
+    write_bytes(writer, writer->names.data, writer->names.size);
+    write_bytes(writer, writer->description_offsets, (writer->rows + 1) * sizeof(uint32_t));
+    write_bytes(writer, writer->descriptions.data, writer->descriptions.size);
+
+    writer->row_count += writer->rows;
+    writer->rows = 0;
+    writer->names.size = 0;
+    writer->descriptions.size = 0;
+}
+
+// add_row buffers a transaction in the current row group.
+static int add_row(const Transaction *transaction, void *udata) {
+    Writer *writer = (Writer *) udata;
+    uint32_t row = writer->rows;
+    double cents = transaction->amount * 100.0;
+
+    writer->ids[row] = transaction->id;
+    writer->amounts[row] = (int64_t) (cents < 0 ? cents - 0.5 : cents + 0.5);
+    writer->wallets[row] = dictionary_code(&writer->wallet_dict,
+        transaction->wallet.id, transaction->wallet.name);
+    writer->categories[row] = dictionary_code(&writer->category_dict,
+        transaction->category.id, transaction->category.name);
+    writer->currencies[row] = currency_code(&writer->currency_dict, transaction->currency);
+
+    buffer_append(&writer->names, transaction->name, strlen(transaction->name));
+    writer->name_offsets[row + 1] = writer->names.size;
+    buffer_append(&writer->descriptions, transaction->description, strlen(transaction->description));
+    writer->description_offsets[row + 1] = writer->descriptions.size;
+
+    writer->rows++;
+
+    if (writer->rows == writer->group_size) {
+        flush_group(writer);
+    }
+
+    return writer->error;
+}
+
+// write_dictionary writes a dictionary in the footer.
+static void write_dictionary(Writer *writer, Dictionary *dict) {
+    uint32_t offset = 0;
+
+    write_bytes(writer, dict->ids.data, dict->ids.size);
+    if (dict->count == 0) {
+        write_bytes(writer, &offset, sizeof(offset));
+    } else {
+        write_bytes(writer, dict->offsets.data, dict->offsets.size);
+    }
+    write_bytes(writer, dict->names.data, dict->names.size);
+}
+
+// free_dictionary releases the memory of a dictionary.
+static void free_dictionary(Dictionary *dict) {
+    free(dict->codes);
+    free(dict->ids.data);
+    free(dict->offsets.data);
+    free(dict->names.data);
+}
+
+// export_columnar writes a columnar snapshot of the transactions
+// into a file, group_size rows per row group. The number of rows
+// written is stored in row_count.
+int export_columnar(DB_Handler *handler, const char *path, unsigned int group_size, uint64_t *row_count) {
+    int rc;
+    Writer writer;
+    Columnar_Header header;
+    Columnar_Footer footer;
+
+    if (group_size == 0) {
+        group_size = COLUMNAR_ROW_GROUP_SIZE;
+    }
+
+    memset(&writer, 0, sizeof(writer));
+
+    writer.file = fopen(path, "wb");
+
+    if (writer.file == NULL) {
+        log_warn("Couldn't open file \"%s\"", path);
+        return SQLITE_CANTOPEN;
+    }
+
+    writer.group_size = group_size;
+    writer.ids = (int64_t *) xrealloc(NULL, group_size * sizeof(int64_t));
+    writer.amounts = (int64_t *) xrealloc(NULL, group_size * sizeof(int64_t));
+    writer.wallets = (uint32_t *) xrealloc(NULL, group_size * sizeof(uint32_t));
+    writer.categories = (uint32_t *) xrealloc(NULL, group_size * sizeof(uint32_t));
+    writer.currencies = (uint32_t *) xrealloc(NULL, group_size * sizeof(uint32_t));
+    writer.name_offsets = (uint32_t *) xrealloc(NULL, (group_size + 1) * sizeof(uint32_t));
+    writer.description_offsets = (uint32_t *) xrealloc(NULL, (group_size + 1) * sizeof(uint32_t));
+    writer.name_offsets[0] = 0;
+    writer.description_offsets[0] = 0;
+
+    // The header is written again once the footer offset is known
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, COLUMNAR_MAGIC, sizeof(COLUMNAR_MAGIC));
+    header.version = COLUMNAR_VERSION;
+    header.row_group_size = group_size;
+    write_bytes(&writer, &header, sizeof(header));
+
+    rc = iterate_transactions(handler, NULL, &add_row, &writer);
+
+    flush_group(&writer);
+
+    memset(&footer, 0, sizeof(footer));
+    footer.row_group_count = writer.group_offsets.size / sizeof(uint64_t);
+    footer.wallet_count = writer.wallet_dict.count;
+    footer.category_count = writer.category_dict.count;
+    footer.currency_count = writer.currency_dict.count;
+
+    header.row_count = writer.row_count;
+    header.footer_offset = writer.position;
+
+    write_bytes(&writer, &footer, sizeof(footer));
+    write_bytes(&writer, writer.group_offsets.data, writer.group_offsets.size);
+    write_dictionary(&writer, &writer.wallet_dict);
+    write_dictionary(&writer, &writer.category_dict);
+    write_dictionary(&writer, &writer.currency_dict);
+
+    if (!writer.error) {
+        if (fseek(writer.file, 0, SEEK_SET) != 0 ||
+            fwrite(&header, sizeof(header), 1, writer.file) != 1) {
+            writer.error = 1;
+        }
+    }
+
+    if (fclose(writer.file) != 0) {
+        writer.error = 1;
+    }
+
+    if (writer.error) {
+        log_warn("Couldn't write file \"%s\"", path);
+        rc = SQLITE_IOERR;
+    }
+
+    if (row_count != NULL) {
+        *row_count = writer.row_count;
+    }
+
+    free(writer.ids);
+    free(writer.amounts);
+    free(writer.wallets);
+    free(writer.categories);
+    free(writer.currencies);
+    free(writer.name_offsets);
+    free(writer.description_offsets);
+    free(writer.names.data);
+    free(writer.descriptions.data);
+    free(writer.group_offsets.data);
+    free_dictionary(&writer.wallet_dict);
+    free_dictionary(&writer.category_dict);
+    free_dictionary(&writer.currency_dict);
+
+    return rc;
+}
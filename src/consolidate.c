@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#include "db.h"
+#include "consolidate.h"
+#include "rxi/log.h"
+#include "sqlite3/sqlite3.h"
+
+// Partial aggregates computed by one worker on one ledger.
+typedef struct Ledger {
+    pthread_t thread;
+    const char *path;
+    Queue *wallets;
+    Queue *categories;
+    int status;
+} Ledger;
+
+// Serializes the logger while workers are running
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// lock_log is the rxi logger lock callback.
+static void lock_log(void *udata, int lock) {
+    (void) udata;
+
+    if (lock) {
+        pthread_mutex_lock(&log_mutex);
+    } else {
+        pthread_mutex_unlock(&log_mutex);
+    }
+}
+
+// aggregate_ledger opens a ledger read-only and computes
+// its wallet balances and category totals. A ledger on another
+// schema version can't be upgraded read-only and is reported.
+static void *aggregate_ledger(void *arg) {
+    Ledger *ledger = (Ledger *) arg;
+    DB_Handler *handler;
+
+    ledger->status = SQLITE_ERROR;
+
+    handler = connect(ledger->path, 1);
+    if (handler->db == NULL) {
+        log_error("Couldn't open database \"%s\"", ledger->path);
+        disconnect(handler);
+        return NULL;
+    }
+
+    // init_db logs why the schema doesn't match
+    if (init_db(handler) != SQLITE_OK) {
+        log_error("Skipping database \"%s\" on another schema version", ledger->path);
+        disconnect(handler);
+        return NULL;
+    }
+
+    ledger->wallets = get_wallets(handler, NULL);
+    ledger->categories = get_categories_overview(handler, NULL);
+
+    if (sqlite3_errcode(handler->db) == SQLITE_OK ||
+        sqlite3_errcode(handler->db) == SQLITE_DONE) {
+        ledger->status = SQLITE_OK;
+    } else {
+        log_error("Couldn't read database \"%s\": %s",
+            ledger->path,
+            sqlite3_errmsg(handler->db)
+        );
+    }
+
+    disconnect(handler);
+
+    return NULL;
+}
+
+// same_record tells if two records of a type are the same across
+// ledgers: categories by name, wallets by name and currency.
+static int same_record(RECORD_TYPES type, const Record *a, const Record *b) {
+    if (type == WALLET_TYPE) {
+        return strcmp(a->wallet.name, b->wallet.name) == 0 &&
+            strcmp(a->wallet.currency, b->wallet.currency) == 0;
+    }
+
+    return strcmp(a->category.name, b->category.name) == 0;
+}
+
+// merge_records adds the amounts of a partial list into the
+// consolidated list, matching records with same_record. Nodes of the
+// partial list are either appended to the consolidated list or freed.
+static Queue *merge_records(RECORD_TYPES type, Queue *origin, Queue *partial) {
+    Queue *record, *next, *tmprecord, *last;
+
+    for (record = partial; record != NULL; record = next) {
+        next = record->next;
+        record->next = NULL;
+
+        last = NULL;
+        for (tmprecord = origin; tmprecord != NULL; tmprecord = tmprecord->next) {
+            if (same_record(type, &tmprecord->record, &record->record)) {
+                break;
+            }
+            last = tmprecord;
+        }
+
+        if (tmprecord == NULL) {
+            if (last != NULL) {
+                last->next = record;
+            } else {
+                origin = record;
+            }
+            continue;
+        }
+
+        if (type == WALLET_TYPE) {
+            tmprecord->record.wallet.balance += record->record.wallet.balance;
+        } else {
+            tmprecord->record.category.amount += record->record.category.amount;
+        }
+        clear_queue(record);
+    }
+
+    return origin;
+}
+
+// consolidate aggregates every ledger on its own thread and
+// merges the partial results once all workers are done, so the
+// whole run takes about as long as the slowest ledger.
+// It returns SQLITE_OK if at least one ledger was aggregated.
+int consolidate(int argc, char **paths, Consolidation *result) {
+    int i;
+    int rc;
+    Ledger *ledgers;
+
+    result->wallets = NULL;
+    result->categories = NULL;
+    result->ledgers = 0;
+    result->failures = 0;
+
+    if (argc < 1) {
+        return SQLITE_MISUSE;
+    }
+
+    ledgers = (Ledger *) calloc(argc, sizeof(Ledger));
+
+    if (!ledgers) {
+        log_fatal("Memory allocation error");
+        exit(1);
+    }
+
+    log_set_lock(lock_log);
+
+    for (i = 0; i < argc; i++) {
+        ledgers[i].path = paths[i];
+        rc = pthread_create(&ledgers[i].thread, NULL, aggregate_ledger, &ledgers[i]);
+        if (rc != 0) {
+            // Not enough resources for another thread, run it inline
+            aggregate_ledger(&ledgers[i]);
+            ledgers[i].path = NULL;
+        }
+    }
+
+    for (i = 0; i < argc; i++) {
+        if (ledgers[i].path != NULL) {
+            pthread_join(ledgers[i].thread, NULL);
+        }
+    }
+
+    log_set_lock(NULL);
+
+    for (i = 0; i < argc; i++) {
+        if (ledgers[i].status != SQLITE_OK) {
+            clear_queue(ledgers[i].wallets);
+            clear_queue(ledgers[i].categories);
+            result->failures++;
+            continue;
+        }
+        result->wallets = merge_records(WALLET_TYPE, result->wallets, ledgers[i].wallets);
+        result->categories = merge_records(CATEGORY_TYPE, result->categories, ledgers[i].categories);
+        result->ledgers++;
+    }
+
+    free(ledgers);
+
+    return result->ledgers > 0 ? SQLITE_OK : SQLITE_ERROR;
+}
+
+// clear_consolidation frees up the merged lists.
+void clear_consolidation(Consolidation *result) {
+    clear_queue(result->wallets);
+    clear_queue(result->categories);
+    result->wallets = NULL;
+    result->categories = NULL;
+}
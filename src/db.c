@@ -2,585 +2,4228 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <pthread.h>
+
 #include "db.h"
+#include "changes.h"
 #include "rxi/log.h"
 #include "sqlite3/sqlite3.h"
 
-// SQLite connetion
-sqlite3 *db;
+// Filter of a bulk delete, on the name, an end date, the wallet and
+// the last id counted before confirming. Unset parts are bound to NULL.
+// Opening balances and transfer legs are never matched: removing one
+// leg alone would create or destroy money.
+#define MATCH_FILTER "opening = 0 AND transfer_id IS NULL AND " \
+    "(?1 IS NULL OR name = ?1) AND " \
+    "(?2 IS NULL OR date < ?2) AND " \
+    "(?3 IS NULL OR wallet_id = ?3) AND " \
+    "(?6 IS NULL OR id <= ?6)"
+
+// Amounts per key (wallet_id or category_id) to convert. Rows in the
+// base currency are summed at once off the covering index, the others
+// are grouped by currency and date, and taken out of that sum. The +
+// keeps the planner on the partial currency index for those.
+#define FX_AMOUNTS(key) "(" \
+    "SELECT " key ", NULL AS currency, NULL AS date, SUM(amount) AS amount " \
+    "FROM transactions GROUP BY " key " " \
+    "UNION ALL " \
+    "SELECT " key ", NULL, NULL, -SUM(amount) " \
+    "FROM transactions WHERE currency IS NOT NULL GROUP BY +" key " " \
+    "UNION ALL " \
+    "SELECT " key ", currency, date, SUM(amount) " \
+    "FROM transactions WHERE currency IS NOT NULL GROUP BY +" key ", currency, date" \
+    ") AS amounts"
+
+// Start of the period of a budget containing a date. Weeks start
+// on Monday.
+#define BUDGET_PERIOD(budget, date) "CASE " budget ".period " \
+    "WHEN 'daily' THEN date(" date ") " \
+    "WHEN 'weekly' THEN date(" date ", '-6 days', 'weekday 1') " \
+    "WHEN 'yearly' THEN date(" date ", 'start of year') " \
+    "ELSE date(" date ", 'start of month') END"
+
+// Whether a transaction is spending counted by a budget. Opening
+// balances and transfers between wallets aren't spending.
+#define BUDGET_MATCH(budget, row) row ".amount < 0 AND " \
+    row ".opening = 0 AND " row ".transfer_id IS NULL AND " \
+    "(" budget ".wallet_id IS NULL OR " budget ".wallet_id = " row ".wallet_id) AND " \
+    "(" budget ".category_id IS NULL OR " budget ".category_id = " row ".category_id)"
+
+// Rate of a currency on a date, picked like find_rate does: the last
+// one effective by then, or the first one for earlier dates
+#define FX_RATE(currency, date) "COALESCE(" \
+    "(SELECT rate FROM fx_rates WHERE currency = " currency " AND " \
+    "date <= COALESCE(" date ", '9999-12-31') ORDER BY date DESC LIMIT 1), " \
+    "(SELECT rate FROM fx_rates WHERE currency = " currency " ORDER BY date ASC LIMIT 1))"
+
+// Amount of a transaction in the base currency, budgets are kept in.
+// Amounts without a rate count as 0 until one is set.
+#define BUDGET_AMOUNT(row) "(CASE WHEN " row ".currency IS NULL THEN " row ".amount " \
+    "ELSE " row ".amount * COALESCE(" FX_RATE(row ".currency", row ".date") ", 0) END)"
+
+// Whether a budget counts a transaction, checked by the triggers
+// before touching the totals
+#define BUDGET_COUNTS(row) "EXISTS (SELECT 1 FROM budgets WHERE " BUDGET_MATCH("budgets", row) ")"
+
+// Adds the amount of a transaction to (sign -) or takes it from
+// (sign +) the running totals of the budgets counting it.
+#define BUDGET_TOTALS(row, sign, amount) \
+    "INSERT OR IGNORE INTO budget_totals(budget_id, period) " \
+    "SELECT id, " BUDGET_PERIOD("budgets", row ".date") " FROM budgets " \
+    "WHERE " BUDGET_MATCH("budgets", row) "; " \
+    "UPDATE budget_totals SET spent = spent " sign " " amount " " \
+    "WHERE (budget_id, period) IN (" \
+    "SELECT id, " BUDGET_PERIOD("budgets", row ".date") " FROM budgets " \
+    "WHERE " BUDGET_MATCH("budgets", row) "); "
+
+// Fills the totals of the budgets matching a condition from the
+// history of their transactions. They are only summed this way when
+// a budget is inserted and when a rate changes, the triggers keep
+// them up to date otherwise.
+#define BUDGET_FILL(where) "INSERT INTO budget_totals(budget_id, period, spent) " \
+    "SELECT budgets.id, " BUDGET_PERIOD("budgets", "t.date") ", -SUM(" BUDGET_AMOUNT("t") ") " \
+    "FROM budgets JOIN transactions AS t ON " BUDGET_MATCH("budgets", "t") " " \
+    "WHERE " where " " \
+    "GROUP BY budgets.id, 2;"
+
+// Adds the spending of archived transactions, which the history no
+// longer holds, to the totals of the budgets matching a condition
+#define BUDGET_ARCHIVED(where) "INSERT INTO budget_totals(budget_id, period, spent) " \
+    "SELECT budgets.id, a.period, a.spent " \
+    "FROM budgets JOIN budget_archived AS a ON a.budget_id = budgets.id " \
+    "WHERE " where " " \
+    "ON CONFLICT(budget_id, period) DO UPDATE SET spent = spent + excluded.spent;"
+
+// Refills every budget total when a rate changes, which is only
+// needed if a budget may count transactions in the currencies
+#define BUDGET_RATE_TRIGGER(op, currencies, fill) \
+    "CREATE TRIGGER IF NOT EXISTS budget_totals_rate_" op " " \
+    "AFTER " op " ON fx_rates WHEN EXISTS (SELECT 1 FROM budgets) AND " \
+    "EXISTS (SELECT 1 FROM transactions WHERE currency IN (" currencies ")) BEGIN " \
+    "DELETE FROM budget_totals; " \
+    fill " " \
+    "END;"
+
+// Columns read by read_budget for the period containing date, its
+// totals joined as p
+#define BUDGET_COLUMNS(date) "budgets.id, budgets.wallet_id, wallets.name, " \
+    "budgets.category_id, categories.name, budgets.period, " \
+    "budgets.amount, budgets.warn, " BUDGET_PERIOD("budgets", date) ", " \
+    "COALESCE(p.spent, 0)"
+
+// Records allocated for Queue lists, across every handler
+static size_t queue_nodes = 0;
+static size_t queue_peak = 0;
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// SQL of the statements cached by DB_Handler.
+static const char *stmt_sql[NUM_DB_STMT] = {
+    [STMT_ADD_WALLET] = "INSERT INTO wallets(name, currency) VALUES(?, ?);",
+
+    [STMT_ADD_CATEGORY] = "INSERT INTO categories(name) VALUES(?);",
+
+    [STMT_ADD_TRANSACTION] = "INSERT INTO transactions(" \
+        "name," \
+        "description," \
+        "amount," \
+        "wallet_id," \
+        "category_id," \
+        "date," \
+        "currency) " \
+        "VALUES(?1, ?2, ?3, ?4, ?5, COALESCE(?6, date('now')), " \
+        "COALESCE(?7, (SELECT currency FROM wallets WHERE id = ?4)));",
+
+    [STMT_GET_WALLETS] = "SELECT wallets.id," \
+        "wallets.name," \
+        "SUM(transactions.amount) AS balance," \
+        "wallets.currency " \
+        "FROM wallets " \
+        "LEFT JOIN transactions ON wallets.id = transactions.wallet_id " \
+        "GROUP BY wallets.name " \
+        "ORDER BY wallets.id ASC;",
+
+    // Balances in the currency of each wallet
+    [STMT_GET_WALLETS_FX] = "SELECT wallets.id," \
+        "wallets.name," \
+        "SUM(fx(amounts.amount, amounts.currency, wallets.currency, amounts.date)) AS balance," \
+        "wallets.currency " \
+        "FROM wallets " \
+        "LEFT JOIN " FX_AMOUNTS("wallet_id") " ON wallets.id = amounts.wallet_id " \
+        "GROUP BY wallets.name " \
+        "ORDER BY wallets.id ASC;",
+
+    [STMT_GET_CATEGORIES] = "SELECT categories.id," \
+        "categories.name " \
+        "FROM categories;",
+
+    [STMT_GET_TRANSACTIONS] = "SELECT transactions.id," \
+        "transactions.name," \
+        "transactions.description," \
+        "transactions.amount," \
+        "transactions.wallet_id," \
+        "wallets.name AS wallet," \
+        "transactions.category_id," \
+        "categories.name AS category," \
+        "transactions.date," \
+        "transactions.currency " \
+        "FROM transactions " \
+        "LEFT JOIN wallets ON transactions.wallet_id = wallets.id " \
+        "LEFT JOIN categories ON transactions.category_id = categories.id " \
+        "GROUP BY transactions.id;",
+
+    [STMT_GET_CATEGORIES_OVERVIEW] = "SELECT categories.id," \
+        "categories.name," \
+        "SUM(transactions.amount) AS amount " \
+        "FROM categories " \
+        "LEFT JOIN transactions ON categories.id = transactions.category_id " \
+        "GROUP BY categories.name " \
+        "ORDER BY amount ASC;",
+
+    // Amounts in the base currency
+    [STMT_GET_CATEGORIES_OVERVIEW_FX] = "SELECT categories.id," \
+        "categories.name," \
+        "SUM(fx(amounts.amount, amounts.currency, NULL, amounts.date)) AS amount " \
+        "FROM categories " \
+        "LEFT JOIN " FX_AMOUNTS("category_id") " ON categories.id = amounts.category_id " \
+        "GROUP BY categories.name " \
+        "ORDER BY amount ASC;",
+
+    [STMT_REMOVE_WALLET_TRANSACTIONS] = "DELETE FROM transactions WHERE " \
+        "transactions.wallet_id = ?;",
+
+    [STMT_REMOVE_WALLET] = "DELETE FROM wallets WHERE " \
+        "wallets.id = ?;",
+
+    [STMT_UNSET_CATEGORY] = "UPDATE transactions SET category_id = 0 WHERE " \
+        "category_id = ?;",
+
+    [STMT_REMOVE_CATEGORY] = "DELETE FROM categories WHERE " \
+        "id = ?;",
+
+    [STMT_REMOVE_TRANSACTION] = "DELETE FROM transactions WHERE " \
+        "transactions.id = ?;",
+
+    // Counts kept up to date by triggers
+    [STMT_COUNT_WALLETS] = "SELECT value FROM meta WHERE " \
+        "key = 'wallets_count';",
+
+    [STMT_COUNT_CATEGORIES] = "SELECT value FROM meta WHERE " \
+        "key = 'categories_count';",
+
+    [STMT_COUNT_TRANSACTIONS] = "SELECT value FROM meta WHERE " \
+        "key = 'transactions_count';",
+
+    [STMT_GET_GENERATION] = "SELECT value FROM meta WHERE " \
+        "key = 'transactions_generation';",
+
+    [STMT_GET_WALLET_NAMES] = "SELECT id, name, currency FROM wallets ORDER BY id ASC;",
+
+    [STMT_GET_CACHE_ROWS] = "SELECT id," \
+        "amount," \
+        "wallet_id," \
+        "category_id," \
+        "date " \
+        "FROM transactions " \
+        "ORDER BY id ASC;",
+
+    [STMT_ADD_RECURRING] = "INSERT INTO recurring(" \
+        "name," \
+        "description," \
+        "amount," \
+        "wallet_id," \
+        "category_id," \
+        "rule," \
+        "every," \
+        "start_date) " \
+        "VALUES(?, ?, ?, ?, ?, ?, ?, COALESCE(?, date('now')));",
+
+    [STMT_GET_RECURRING] = "SELECT recurring.id," \
+        "recurring.name," \
+        "recurring.description," \
+        "recurring.amount," \
+        "recurring.wallet_id," \
+        "wallets.name AS wallet," \
+        "recurring.category_id," \
+        "categories.name AS category," \
+        "recurring.rule," \
+        "recurring.every," \
+        "recurring.start_date," \
+        "recurring.occurrences " \
+        "FROM recurring " \
+        "LEFT JOIN wallets ON recurring.wallet_id = wallets.id " \
+        "LEFT JOIN categories ON recurring.category_id = categories.id " \
+        "ORDER BY recurring.id ASC;",
+
+    [STMT_REMOVE_RECURRING] = "DELETE FROM recurring WHERE " \
+        "recurring.id = ?;",
+
+    [STMT_ADD_RECURRING_TRANSACTION] = "INSERT OR IGNORE INTO transactions(" \
+        "name," \
+        "description," \
+        "amount," \
+        "wallet_id," \
+        "category_id," \
+        "date," \
+        "recurring_id," \
+        "currency) " \
+        "VALUES(?1, ?2, ?3, ?4, ?5, ?6, ?7, (SELECT currency FROM wallets WHERE id = ?4));",
+
+    [STMT_UPDATE_RECURRING] = "UPDATE recurring SET occurrences = ? WHERE " \
+        "recurring.id = ?;",
+
+    [STMT_ADD_TRANSFER] = "INSERT INTO transfers(" \
+        "from_wallet_id," \
+        "to_wallet_id," \
+        "amount," \
+        "date," \
+        "description) " \
+        "VALUES(?, ?, ?, ?, ?);",
+
+    [STMT_ADD_TRANSFER_LEG] = "INSERT INTO transactions(" \
+        "name," \
+        "description," \
+        "amount," \
+        "wallet_id," \
+        "category_id," \
+        "date," \
+        "transfer_id," \
+        "currency) " \
+        "VALUES('transfer', ?1, ?2, ?3, 0, ?4, ?5, (SELECT wallets.currency FROM transfers " \
+        "JOIN wallets ON transfers.from_wallet_id = wallets.id WHERE transfers.id = ?5));",
+
+    [STMT_GET_ARCHIVE_YEARS] = "SELECT DISTINCT CAST(substr(date, 1, 4) AS INTEGER) " \
+        "FROM transactions WHERE " \
+        "opening = 0 AND date < ? " \
+        "ORDER BY 1 ASC;",
+
+    // Folds the previous opening balances and the rows archived
+    // between ?1 and ?2 into new opening balances, marked 2 until
+    // the old ones are removed.
+    [STMT_ADD_OPENING_BALANCES] = "INSERT INTO transactions(" \
+        "name," \
+        "description," \
+        "amount," \
+        "wallet_id," \
+        "category_id," \
+        "date," \
+        "opening," \
+        "currency) " \
+        "SELECT 'opening balance', 'before ' || ?2, SUM(amount), wallet_id, category_id, ?2, 2, currency " \
+        "FROM transactions WHERE " \
+        "opening = 1 OR (opening = 0 AND date >= ?1 AND date < ?2) " \
+        "GROUP BY wallet_id, category_id, currency " \
+        "HAVING SUM(amount) != 0;",
+
+    // Spending of the transactions between ?1 and ?2 about to be
+    // archived, kept for the budgets counting it
+    [STMT_ARCHIVE_BUDGETS] = "INSERT INTO budget_archived(budget_id, period, spent) " \
+        "SELECT budgets.id, " BUDGET_PERIOD("budgets", "t.date") ", -SUM(" BUDGET_AMOUNT("t") ") " \
+        "FROM budgets JOIN transactions AS t ON " BUDGET_MATCH("budgets", "t") " " \
+        "WHERE t.date >= ?1 AND t.date < ?2 " \
+        "GROUP BY budgets.id, 2 " \
+        "ON CONFLICT(budget_id, period) DO UPDATE SET spent = spent + excluded.spent;",
+
+    [STMT_REMOVE_ARCHIVED] = "DELETE FROM transactions WHERE " \
+        "opening = 1 OR (opening = 0 AND date >= ?1 AND date < ?2);",
+
+    [STMT_SET_OPENING_BALANCES] = "UPDATE transactions SET opening = 1 WHERE " \
+        "opening = 2;",
+
+    [STMT_ADD_ARCHIVE] = "INSERT OR REPLACE INTO archives(" \
+        "year," \
+        "path," \
+        "rows," \
+        "before) " \
+        "VALUES(?1, ?2, ?3 + COALESCE((SELECT rows FROM archives WHERE year = ?1), 0), ?4);",
+
+    [STMT_GET_ARCHIVES] = "SELECT year, path FROM archives WHERE " \
+        "year >= ? AND year <= ? " \
+        "ORDER BY year ASC;",
+
+    [STMT_HAS_WALLETS] = "SELECT 1 FROM wallets LIMIT 1;",
+
+    [STMT_HAS_CATEGORIES] = "SELECT 1 FROM categories LIMIT 1;",
+
+    [STMT_HAS_TRANSACTIONS] = "SELECT 1 FROM transactions LIMIT 1;",
+
+    [STMT_COUNT_MATCHING] = "SELECT COUNT(*), MAX(id) FROM transactions WHERE " \
+        MATCH_FILTER ";",
+
+    // Chunks are ranges of ids, so each one starts where the
+    // previous one ended instead of scanning again.
+    [STMT_GET_CHUNK_END] = "SELECT MAX(id) FROM (" \
+        "SELECT id FROM transactions WHERE id > ?4 AND " MATCH_FILTER " " \
+        "ORDER BY id LIMIT ?5" \
+        ");",
+
+    [STMT_REMOVE_CHUNK] = "DELETE FROM transactions WHERE " \
+        "id > ?4 AND id <= ?5 AND " MATCH_FILTER ";",
+
+    [STMT_NEXT_BATCH] = "SELECT COALESCE(MAX(batch), 0) + 1 FROM changes;",
+
+    [STMT_TRIM_CHANGES] = "DELETE FROM changes WHERE batch <= ?;",
+
+    [STMT_CLEAR_CHANGES] = "DELETE FROM changes;",
+
+    // Undone batches older than a live one can't be redone anymore
+    [STMT_PURGE_REDO] = "DELETE FROM changes WHERE undone = 1 AND " \
+        "batch < (SELECT MAX(batch) FROM changes WHERE undone = 0);",
+
+    [STMT_GET_UNDO_BATCHES] = "SELECT DISTINCT batch FROM changes WHERE " \
+        "undone = 0 ORDER BY batch DESC LIMIT ?;",
+
+    [STMT_GET_REDO_BATCHES] = "SELECT DISTINCT batch FROM changes WHERE " \
+        "undone = 1 ORDER BY batch ASC LIMIT ?;",
+
+    [STMT_GET_UNDO_CHANGES] = "SELECT tbl, old, new FROM changes WHERE " \
+        "batch = ? ORDER BY seq DESC;",
+
+    [STMT_GET_REDO_CHANGES] = "SELECT tbl, old, new FROM changes WHERE " \
+        "batch = ? ORDER BY seq ASC;",
+
+    [STMT_SET_UNDONE] = "UPDATE changes SET undone = ? WHERE batch = ?;",
+
+    [STMT_GET_CHANGE_LOG] = "SELECT change_log.seq," \
+        "change_log.time," \
+        "change_log.op," \
+        "change_log.tbl," \
+        "change_log.row_id," \
+        "transactions.id," \
+        "transactions.name," \
+        "transactions.description," \
+        "transactions.amount," \
+        "transactions.wallet_id," \
+        "wallets.name," \
+        "transactions.category_id," \
+        "categories.name," \
+        "transactions.date," \
+        "transactions.currency " \
+        "FROM change_log " \
+        "LEFT JOIN transactions ON change_log.tbl = 'transactions' AND " \
+        "change_log.op <> 'delete' AND transactions.id = change_log.row_id " \
+        "LEFT JOIN wallets ON transactions.wallet_id = wallets.id " \
+        "LEFT JOIN categories ON transactions.category_id = categories.id " \
+        "WHERE change_log.seq > ? " \
+        "ORDER BY change_log.seq ASC LIMIT ?;",
+
+    [STMT_PRUNE_CHANGE_LOG] = "DELETE FROM change_log WHERE seq <= ?;",
+
+    // Changes when another connection commits
+    [STMT_DATA_VERSION] = "PRAGMA data_version;",
+
+    [STMT_ADD_BUDGET] = "INSERT INTO budgets(" \
+        "wallet_id," \
+        "category_id," \
+        "period," \
+        "amount," \
+        "warn) " \
+        "VALUES(?, ?, ?, ?, ?);",
+
+    // Budgets with their spending over the period containing ?1, today
+    // by default, read from the running totals
+    [STMT_GET_BUDGETS] = "SELECT " BUDGET_COLUMNS("COALESCE(?1, 'now')") " " \
+        "FROM budgets " \
+        "LEFT JOIN wallets ON budgets.wallet_id = wallets.id " \
+        "LEFT JOIN categories ON budgets.category_id = categories.id " \
+        "LEFT JOIN budget_totals AS p ON p.budget_id = budgets.id AND " \
+        "p.period = " BUDGET_PERIOD("budgets", "COALESCE(?1, 'now')") " " \
+        "ORDER BY budgets.id ASC;",
+
+    [STMT_REMOVE_BUDGET] = "DELETE FROM budgets WHERE id = ?;",
+
+    // Budgets whose threshold or limit the transaction crossed, from
+    // the totals kept up to date by the triggers
+    [STMT_CHECK_BUDGETS] = "SELECT " BUDGET_COLUMNS("t.date") ", p.spent >= budgets.amount " \
+        "FROM transactions AS t " \
+        "JOIN budgets ON " BUDGET_MATCH("budgets", "t") " " \
+        "JOIN budget_totals AS p ON p.budget_id = budgets.id AND " \
+        "p.period = " BUDGET_PERIOD("budgets", "t.date") " " \
+        "LEFT JOIN wallets ON budgets.wallet_id = wallets.id " \
+        "LEFT JOIN categories ON budgets.category_id = categories.id " \
+        "WHERE t.id = ? AND (" \
+        "(p.spent >= budgets.amount AND p.spent + " BUDGET_AMOUNT("t") " < budgets.amount) OR " \
+        "(p.spent >= budgets.amount * budgets.warn AND " \
+        "p.spent + " BUDGET_AMOUNT("t") " < budgets.amount * budgets.warn)" \
+        ");",
+
+    // An update rather than a replace, so the id of the rate stays
+    // and the change is journaled as one
+    [STMT_SET_RATE] = "INSERT INTO fx_rates(currency, date, rate) " \
+        "VALUES(?, COALESCE(?, date('now')), ?) " \
+        "ON CONFLICT(currency, date) DO UPDATE SET rate = excluded.rate;",
+
+    // Loaded whole into FX_Table, ordered for its lookups
+    [STMT_GET_RATES] = "SELECT currency, date, rate FROM fx_rates " \
+        "ORDER BY currency ASC, date ASC;",
+
+    [STMT_REMOVE_RATE] = "DELETE FROM fx_rates WHERE " \
+        "currency = ?1 AND (?2 IS NULL OR date = ?2);",
+
+    // Answered from idx_transactions_currency, and from the few
+    // wallets, whose balances convert base currency rows too
+    [STMT_HAS_CURRENCIES] = "SELECT EXISTS (SELECT 1 FROM transactions WHERE currency IS NOT NULL) OR " \
+        "EXISTS (SELECT 1 FROM wallets WHERE currency IS NOT NULL);",
+
+    // Transactions but transfers and opening balances, as read by
+    // read_transaction
+    [STMT_GET_CASH_FLOWS] = "SELECT transactions.id," \
+        "transactions.name," \
+        "transactions.description," \
+        "transactions.amount," \
+        "transactions.wallet_id," \
+        "wallets.name AS wallet," \
+        "transactions.category_id," \
+        "categories.name AS category," \
+        "transactions.date," \
+        "transactions.currency " \
+        "FROM transactions " \
+        "LEFT JOIN wallets ON transactions.wallet_id = wallets.id " \
+        "LEFT JOIN categories ON transactions.category_id = categories.id " \
+        "WHERE transactions.opening = 0 AND transactions.transfer_id IS NULL " \
+        "ORDER BY transactions.id ASC;"
+};
+
+// Columns of archives written before currencies
+#define LEGACY_ARCHIVE_COLUMNS "id,name,description,amount,wallet_id,category_id,date,recurring_id,transfer_id"
+
+// Columns copied to archives
+#define ARCHIVE_COLUMNS LEGACY_ARCHIVE_COLUMNS ",currency"
+
+// Archives attached at once by a date range
+#define ARCHIVE_MAX_ATTACHED 32
+
+// Schema of an archive, one database per year
+static const char *archive_schema = "CREATE TABLE IF NOT EXISTS archive.transactions(" \
+    "id INTEGER PRIMARY KEY NOT NULL," \
+    "name VARCHAR(64) NOT NULL," \
+    "description TEXT," \
+    "amount REAL NOT NULL," \
+    "wallet_id INTEGER NOT NULL," \
+    "category_id INTEGER," \
+    "date TEXT," \
+    "recurring_id INTEGER," \
+    "transfer_id INTEGER," \
+    "currency TEXT" \
+    ");" \
+
+    "CREATE INDEX IF NOT EXISTS archive.idx_transactions_date ON transactions(" \
+    "date" \
+    ");";
+
+// Tables whose changes are journaled, with their columns, the id
+// first. The position of a table is stored in the journal, so new
+// tables go at the end.
+static const char *change_tables[][2] = {
+    {"wallets", "id,name,currency"},
+    {"categories", "id,name"},
+    {"transactions", "id,name,description,amount,wallet_id,category_id,date,recurring_id,transfer_id,opening,currency"},
+    {"recurring", "id,name,description,amount,wallet_id,category_id,rule,every,start_date,occurrences"},
+    {"transfers", "id,from_wallet_id,to_wallet_id,amount,date,description"},
+    {"budgets", "id,wallet_id,category_id,period,amount,warn"},
+    {"fx_rates", "id,currency,date,rate"}
+};
+
+#define NUM_CHANGE_TABLES ((int) (sizeof(change_tables) / sizeof(change_tables[0])))
+
+// Names of the recurring rules as stored in the database
+static const char *rule_names[NUM_RULES] = {
+    [RULE_DAILY] = "daily",
+    [RULE_WEEKLY] = "weekly",
+    [RULE_MONTHLY] = "monthly",
+    [RULE_YEARLY] = "yearly"
+};
+
+// Triggers appending every change of a table to the change log
+#define CHANGE_LOG_TRIGGERS(table) \
+    "CREATE TRIGGER IF NOT EXISTS change_log_" table "_insert " \
+    "AFTER INSERT ON " table " BEGIN " \
+    "INSERT INTO change_log(op, tbl, row_id) VALUES('insert', '" table "', NEW.id); " \
+    "END;" \
+    "CREATE TRIGGER IF NOT EXISTS change_log_" table "_update " \
+    "AFTER UPDATE ON " table " BEGIN " \
+    "INSERT INTO change_log(op, tbl, row_id) VALUES('update', '" table "', NEW.id); " \
+    "END;" \
+    "CREATE TRIGGER IF NOT EXISTS change_log_" table "_delete " \
+    "AFTER DELETE ON " table " BEGIN " \
+    "INSERT INTO change_log(op, tbl, row_id) VALUES('delete', '" table "', OLD.id); " \
+    "END;"
+
+// Schema migrations, in order. Migration i upgrades the schema from
+// version i to version i + 1, as stored in PRAGMA user_version.
+static const char *migrations[] = {
+    // 1: wallets, categories and transactions
+    "CREATE TABLE IF NOT EXISTS wallets(" \
+    "id INTEGER PRIMARY KEY AUTOINCREMENT NOT NULL," \
+    "name VARCHAR(32) UNIQUE NOT NULL" \
+    ");" \
+
+    "CREATE TABLE IF NOT EXISTS categories(" \
+    "id INTEGER PRIMARY KEY AUTOINCREMENT NOT NULL," \
+    "name VARCHAR(32) UNIQUE NOT NULL" \
+    ");" \
+
+    "CREATE TABLE IF NOT EXISTS transactions(" \
+    "id INTEGER PRIMARY KEY AUTOINCREMENT NOT NULL," \
+    "name VARCHAR(64) NOT NULL," \
+    "description TEXT," \
+    "amount REAL NOT NULL," \
+    "wallet_id INTEGER NOT NULL," \
+    "category_id INTEGER," \
+    "FOREIGN KEY(wallet_id) REFERENCES wallets(id)," \
+    "FOREIGN KEY(category_id) REFERENCES categories(id)" \
+    ");",
+
+    // 2: indexes driven by the queries. wallets and categories are
+    // already indexed by their primary key and UNIQUE name, and
+    // idx_transaction could not serve any join.
+    "DROP INDEX IF EXISTS idx_wallet;" \
+    "DROP INDEX IF EXISTS idx_category;" \
+    "DROP INDEX IF EXISTS idx_transaction;" \
+
+    // Covers the wallet balances join and the wallet cascade
+    "CREATE INDEX IF NOT EXISTS idx_transactions_wallet ON transactions(" \
+    "wallet_id," \
+    "amount" \
+    ");" \
+
+    // Covers the categories overview join and category removal
+    "CREATE INDEX IF NOT EXISTS idx_transactions_category ON transactions(" \
+    "category_id," \
+    "amount" \
+    ");",
+
+    // 3: transaction dates, and a generation counter bumped by every
+    // change to transactions so caches can tell they are stale.
+    "ALTER TABLE transactions ADD COLUMN date TEXT;" \
+    "UPDATE transactions SET date = date('now');" \
+
+    "CREATE TABLE IF NOT EXISTS meta(" \
+    "key TEXT PRIMARY KEY NOT NULL," \
+    "value INTEGER NOT NULL" \
+    ") WITHOUT ROWID;" \
+
+    "INSERT OR IGNORE INTO meta(key, value) VALUES('transactions_generation', 0);" \
+
+    "CREATE TRIGGER IF NOT EXISTS transactions_generation_insert " \
+    "AFTER INSERT ON transactions BEGIN " \
+    "UPDATE meta SET value = value + 1 WHERE key = 'transactions_generation'; " \
+    "END;" \
+
+    "CREATE TRIGGER IF NOT EXISTS transactions_generation_update " \
+    "AFTER UPDATE ON transactions BEGIN " \
+    "UPDATE meta SET value = value + 1 WHERE key = 'transactions_generation'; " \
+    "END;" \
+
+    "CREATE TRIGGER IF NOT EXISTS transactions_generation_delete " \
+    "AFTER DELETE ON transactions BEGIN " \
+    "UPDATE meta SET value = value + 1 WHERE key = 'transactions_generation'; " \
+    "END;",
+
+    // 4: recurring transaction templates. Materialized transactions
+    // point back to their template, at most once per date.
+    "CREATE TABLE IF NOT EXISTS recurring(" \
+    "id INTEGER PRIMARY KEY AUTOINCREMENT NOT NULL," \
+    "name VARCHAR(64) UNIQUE NOT NULL," \
+    "description TEXT," \
+    "amount REAL NOT NULL," \
+    "wallet_id INTEGER NOT NULL," \
+    "category_id INTEGER," \
+    "rule TEXT NOT NULL CHECK(rule IN ('daily', 'weekly', 'monthly', 'yearly'))," \
+    "every INTEGER NOT NULL DEFAULT 1 CHECK(every > 0)," \
+    "start_date TEXT NOT NULL," \
+    "occurrences INTEGER NOT NULL DEFAULT 0," \
+    "FOREIGN KEY(wallet_id) REFERENCES wallets(id)," \
+    "FOREIGN KEY(category_id) REFERENCES categories(id)" \
+    ");" \
+
+    "ALTER TABLE transactions ADD COLUMN recurring_id INTEGER;" \
+
+    "CREATE UNIQUE INDEX IF NOT EXISTS idx_transactions_recurring ON transactions(" \
+    "recurring_id," \
+    "date" \
+    ") WHERE recurring_id IS NOT NULL;",
+
+    // 5: transfers between wallets, each written as two transactions
+    "CREATE TABLE IF NOT EXISTS transfers(" \
+    "id INTEGER PRIMARY KEY AUTOINCREMENT NOT NULL," \
+    "from_wallet_id INTEGER NOT NULL," \
+    "to_wallet_id INTEGER NOT NULL," \
+    "amount REAL NOT NULL CHECK(amount > 0)," \
+    "date TEXT NOT NULL," \
+    "description TEXT," \
+    "FOREIGN KEY(from_wallet_id) REFERENCES wallets(id)," \
+    "FOREIGN KEY(to_wallet_id) REFERENCES wallets(id)" \
+    ");" \
+
+    "ALTER TABLE transactions ADD COLUMN transfer_id INTEGER;" \
+
+    "CREATE INDEX IF NOT EXISTS idx_transactions_transfer ON transactions(" \
+    "transfer_id" \
+    ") WHERE transfer_id IS NOT NULL;",
+
+    // 6: archives of closed periods. Archived transactions move to
+    // one database per year and leave opening balances behind.
+    "CREATE TABLE IF NOT EXISTS archives(" \
+    "year INTEGER PRIMARY KEY NOT NULL," \
+    "path TEXT NOT NULL," \
+    "rows INTEGER NOT NULL DEFAULT 0," \
+    "before TEXT NOT NULL" \
+    ");" \
+
+    "ALTER TABLE transactions ADD COLUMN opening INTEGER NOT NULL DEFAULT 0;" \
+
+    // Covers archiving and date ranges
+    "CREATE INDEX IF NOT EXISTS idx_transactions_date ON transactions(" \
+    "date" \
+    ");",
+
+    // 7: row counts of every table, so counting doesn't scan. The
+    // transactions triggers bump the count and the generation in
+    // a single update.
+    "INSERT OR REPLACE INTO meta(key, value) SELECT 'wallets_count', COUNT(*) FROM wallets;" \
+    "INSERT OR REPLACE INTO meta(key, value) SELECT 'categories_count', COUNT(*) FROM categories;" \
+    "INSERT OR REPLACE INTO meta(key, value) SELECT 'transactions_count', COUNT(*) FROM transactions;" \
+
+    "CREATE TRIGGER IF NOT EXISTS wallets_count_insert " \
+    "AFTER INSERT ON wallets BEGIN " \
+    "UPDATE meta SET value = value + 1 WHERE key = 'wallets_count'; " \
+    "END;" \
+
+    "CREATE TRIGGER IF NOT EXISTS wallets_count_delete " \
+    "AFTER DELETE ON wallets BEGIN " \
+    "UPDATE meta SET value = value - 1 WHERE key = 'wallets_count'; " \
+    "END;" \
+
+    "CREATE TRIGGER IF NOT EXISTS categories_count_insert " \
+    "AFTER INSERT ON categories BEGIN " \
+    "UPDATE meta SET value = value + 1 WHERE key = 'categories_count'; " \
+    "END;" \
+
+    "CREATE TRIGGER IF NOT EXISTS categories_count_delete " \
+    "AFTER DELETE ON categories BEGIN " \
+    "UPDATE meta SET value = value - 1 WHERE key = 'categories_count'; " \
+    "END;" \
+
+    "DROP TRIGGER IF EXISTS transactions_generation_insert;" \
+    "DROP TRIGGER IF EXISTS transactions_generation_delete;" \
+
+    "CREATE TRIGGER IF NOT EXISTS transactions_count_insert " \
+    "AFTER INSERT ON transactions BEGIN " \
+    "UPDATE meta SET value = value + 1 WHERE key IN ('transactions_generation', 'transactions_count'); " \
+    "END;" \
+
+    "CREATE TRIGGER IF NOT EXISTS transactions_count_delete " \
+    "AFTER DELETE ON transactions BEGIN " \
+    "UPDATE meta SET value = value + (CASE key WHEN 'transactions_count' THEN -1 ELSE 1 END) " \
+    "WHERE key IN ('transactions_generation', 'transactions_count'); " \
+    "END;",
+
+    // 8: journal of the changes to records, undone and redone a
+    // batch at a time. Rows are packed by change_pack, old is NULL
+    // for an insert and new is NULL for a delete.
+    "CREATE TABLE IF NOT EXISTS changes(" \
+    "seq INTEGER PRIMARY KEY NOT NULL," \
+    "batch INTEGER NOT NULL," \
+    "tbl INTEGER NOT NULL," \
+    "old BLOB," \
+    "new BLOB," \
+    "undone INTEGER NOT NULL DEFAULT 0" \
+    ");" \
+
+    "CREATE INDEX IF NOT EXISTS idx_changes_batch ON changes(" \
+    "batch" \
+    ");",
+
+    // 9: change log of every insert, update and delete, whoever made
+    // it, for consumers to sync from. seq never goes back, even once
+    // the log is pruned.
+    "CREATE TABLE IF NOT EXISTS change_log(" \
+    "seq INTEGER PRIMARY KEY AUTOINCREMENT NOT NULL," \
+    "time TEXT NOT NULL DEFAULT (strftime('%Y-%m-%dT%H:%M:%fZ', 'now'))," \
+    "op TEXT NOT NULL CHECK(op IN ('insert', 'update', 'delete'))," \
+    "tbl TEXT NOT NULL," \
+    "row_id INTEGER NOT NULL" \
+    ");" \
+
+    CHANGE_LOG_TRIGGERS("wallets")
+    CHANGE_LOG_TRIGGERS("categories")
+    CHANGE_LOG_TRIGGERS("transactions")
+    CHANGE_LOG_TRIGGERS("recurring")
+    CHANGE_LOG_TRIGGERS("transfers"),
+
+    // 10: spending limits of wallets and categories per period, with
+    // running totals kept by triggers so a new transaction is checked
+    // without summing the history again.
+    "CREATE TABLE IF NOT EXISTS budgets(" \
+    "id INTEGER PRIMARY KEY AUTOINCREMENT NOT NULL," \
+    "wallet_id INTEGER," \
+    "category_id INTEGER," \
+    "period TEXT NOT NULL CHECK(period IN ('daily', 'weekly', 'monthly', 'yearly'))," \
+    "amount REAL NOT NULL CHECK(amount > 0)," \
+    "warn REAL NOT NULL DEFAULT 0.8 CHECK(warn > 0 AND warn <= 1)," \
+    "CHECK(wallet_id IS NOT NULL OR category_id IS NOT NULL)," \
+    "FOREIGN KEY(wallet_id) REFERENCES wallets(id)," \
+    "FOREIGN KEY(category_id) REFERENCES categories(id)" \
+    ");" \
+
+    "CREATE TABLE IF NOT EXISTS budget_totals(" \
+    "budget_id INTEGER NOT NULL," \
+    "period TEXT NOT NULL," \
+    "spent REAL NOT NULL DEFAULT 0," \
+    "PRIMARY KEY(budget_id, period)" \
+    ") WITHOUT ROWID;" \
+
+    "CREATE TRIGGER IF NOT EXISTS budget_totals_insert " \
+    "AFTER INSERT ON transactions WHEN " BUDGET_COUNTS("NEW") " BEGIN " \
+    BUDGET_TOTALS("NEW", "-", "NEW.amount") \
+    "END;" \
+
+    "CREATE TRIGGER IF NOT EXISTS budget_totals_update " \
+    "AFTER UPDATE OF amount, wallet_id, category_id, date, opening, transfer_id ON transactions " \
+    "WHEN " BUDGET_COUNTS("OLD") " OR " BUDGET_COUNTS("NEW") " BEGIN " \
+    BUDGET_TOTALS("OLD", "+", "OLD.amount") \
+    BUDGET_TOTALS("NEW", "-", "NEW.amount") \
+    "END;" \
+
+    "CREATE TRIGGER IF NOT EXISTS budget_totals_delete " \
+    "AFTER DELETE ON transactions WHEN " BUDGET_COUNTS("OLD") " BEGIN " \
+    BUDGET_TOTALS("OLD", "+", "OLD.amount") \
+    "END;" \
+
+    "CREATE TRIGGER IF NOT EXISTS budgets_delete " \
+    "AFTER DELETE ON budgets BEGIN " \
+    "DELETE FROM budget_totals WHERE budget_id = OLD.id; " \
+    "END;" \
+
+    "CREATE TRIGGER IF NOT EXISTS budgets_wallet_delete " \
+    "AFTER DELETE ON wallets BEGIN " \
+    "DELETE FROM budgets WHERE wallet_id = OLD.id; " \
+    "END;" \
+
+    "CREATE TRIGGER IF NOT EXISTS budgets_category_delete " \
+    "AFTER DELETE ON categories BEGIN " \
+    "DELETE FROM budgets WHERE category_id = OLD.id; " \
+    "END;" \
+
+    CHANGE_LOG_TRIGGERS("budgets"),
+
+    // 11: currencies of wallets and transactions, NULL for the base
+    // currency, and the rates converting them into it from a date on.
+    // The partial index tells at once if a ledger has any currency.
+    "ALTER TABLE wallets ADD COLUMN currency TEXT;" \
+    "ALTER TABLE transactions ADD COLUMN currency TEXT;" \
+
+    "CREATE TABLE IF NOT EXISTS fx_rates(" \
+    "currency TEXT NOT NULL," \
+    "date TEXT NOT NULL," \
+    "rate REAL NOT NULL CHECK(rate > 0)," \
+    "PRIMARY KEY(currency, date)" \
+    ") WITHOUT ROWID;" \
+
+    "CREATE INDEX IF NOT EXISTS idx_transactions_currency ON transactions(" \
+    "currency" \
+    ") WHERE currency IS NOT NULL;",
+
+    // 12: budget totals in the base currency. The triggers are made
+    // again with converted amounts, and every total is refilled now
+    // and whenever a rate changes.
+    "DROP TRIGGER IF EXISTS budget_totals_insert;" \
+    "DROP TRIGGER IF EXISTS budget_totals_update;" \
+    "DROP TRIGGER IF EXISTS budget_totals_delete;" \
+
+    "CREATE TRIGGER IF NOT EXISTS budget_totals_insert " \
+    "AFTER INSERT ON transactions WHEN " BUDGET_COUNTS("NEW") " BEGIN " \
+    BUDGET_TOTALS("NEW", "-", BUDGET_AMOUNT("NEW")) \
+    "END;" \
+
+    "CREATE TRIGGER IF NOT EXISTS budget_totals_update " \
+    "AFTER UPDATE OF amount, wallet_id, category_id, date, opening, transfer_id, currency ON transactions " \
+    "WHEN " BUDGET_COUNTS("OLD") " OR " BUDGET_COUNTS("NEW") " BEGIN " \
+    BUDGET_TOTALS("OLD", "+", BUDGET_AMOUNT("OLD")) \
+    BUDGET_TOTALS("NEW", "-", BUDGET_AMOUNT("NEW")) \
+    "END;" \
+
+    "CREATE TRIGGER IF NOT EXISTS budget_totals_delete " \
+    "AFTER DELETE ON transactions WHEN " BUDGET_COUNTS("OLD") " BEGIN " \
+    BUDGET_TOTALS("OLD", "+", BUDGET_AMOUNT("OLD")) \
+    "END;" \
+
+    BUDGET_RATE_TRIGGER("insert", "NEW.currency", BUDGET_FILL("1"))
+    BUDGET_RATE_TRIGGER("update", "OLD.currency, NEW.currency", BUDGET_FILL("1"))
+    BUDGET_RATE_TRIGGER("delete", "OLD.currency", BUDGET_FILL("1"))
+
+    "DELETE FROM budget_totals;"
+    BUDGET_FILL("1"),
+
+    // 13: totals filled as soon as a budget is inserted, so a budget
+    // put back by undo or redo gets its totals like a new one
+    "CREATE TRIGGER IF NOT EXISTS budgets_insert " \
+    "AFTER INSERT ON budgets BEGIN " \
+    "DELETE FROM budget_totals WHERE budget_id = NEW.id; " \
+    BUDGET_FILL("budgets.id = NEW.id") " " \
+    "END;",
+
+    // 14: rates get an id, like every table the change journal and
+    // the change log follow. The table is made again rather than
+    // renamed, as renaming checks the triggers reading fx_rates.
+    "CREATE TEMP TABLE fx_rates_copy AS SELECT currency, date, rate FROM fx_rates;" \
+    "DROP TABLE fx_rates;" \
+
+    "CREATE TABLE fx_rates(" \
+    "id INTEGER PRIMARY KEY AUTOINCREMENT NOT NULL," \
+    "currency TEXT NOT NULL," \
+    "date TEXT NOT NULL," \
+    "rate REAL NOT NULL CHECK(rate > 0)," \
+    "UNIQUE(currency, date)" \
+    ");" \
+
+    "INSERT INTO fx_rates(currency, date, rate) " \
+    "SELECT currency, date, rate FROM temp.fx_rates_copy ORDER BY currency, date;" \
+    "DROP TABLE temp.fx_rates_copy;" \
+
+    BUDGET_RATE_TRIGGER("insert", "NEW.currency", BUDGET_FILL("1"))
+    BUDGET_RATE_TRIGGER("update", "OLD.currency, NEW.currency", BUDGET_FILL("1"))
+    BUDGET_RATE_TRIGGER("delete", "OLD.currency", BUDGET_FILL("1"))
+
+    CHANGE_LOG_TRIGGERS("fx_rates"),
+
+    // 15: spending of archived transactions, kept since the totals
+    // are refilled from a history that no longer holds them. While
+    // archiving sets the archiving key of meta, removed transactions
+    // leave the totals alone.
+    "CREATE TABLE IF NOT EXISTS budget_archived(" \
+    "budget_id INTEGER NOT NULL," \
+    "period TEXT NOT NULL," \
+    "spent REAL NOT NULL DEFAULT 0," \
+    "PRIMARY KEY(budget_id, period)" \
+    ") WITHOUT ROWID;" \
+
+    "DROP TRIGGER IF EXISTS budget_totals_delete;" \
+    "DROP TRIGGER IF EXISTS budget_totals_rate_insert;" \
+    "DROP TRIGGER IF EXISTS budget_totals_rate_update;" \
+    "DROP TRIGGER IF EXISTS budget_totals_rate_delete;" \
+    "DROP TRIGGER IF EXISTS budgets_insert;" \
+
+    "CREATE TRIGGER IF NOT EXISTS budget_totals_delete " \
+    "AFTER DELETE ON transactions WHEN " \
+    "NOT EXISTS (SELECT 1 FROM meta WHERE key = 'archiving') AND " BUDGET_COUNTS("OLD") " BEGIN " \
+    BUDGET_TOTALS("OLD", "+", BUDGET_AMOUNT("OLD")) \
+    "END;" \
+
+    BUDGET_RATE_TRIGGER("insert", "NEW.currency", BUDGET_FILL("1") BUDGET_ARCHIVED("1"))
+    BUDGET_RATE_TRIGGER("update", "OLD.currency, NEW.currency", BUDGET_FILL("1") BUDGET_ARCHIVED("1"))
+    BUDGET_RATE_TRIGGER("delete", "OLD.currency", BUDGET_FILL("1") BUDGET_ARCHIVED("1"))
+
+    "CREATE TRIGGER IF NOT EXISTS budgets_insert " \
+    "AFTER INSERT ON budgets BEGIN " \
+    "DELETE FROM budget_totals WHERE budget_id = NEW.id; " \
+    BUDGET_FILL("budgets.id = NEW.id") " " \
+    BUDGET_ARCHIVED("budgets.id = NEW.id") " " \
+    "END;"
+};
+
+#define SCHEMA_VERSION ((int) (sizeof(migrations) / sizeof(migrations[0])))
+
+// find_rate looks up the rate of a currency on a date: the last one
+// effective by then, or the first one for earlier dates. It returns
+// 0 if the currency has no rate.
+static int find_rate(const FX_Table *fx, const char *currency, const char *date, double *rate) {
+    int cmp;
+    size_t low = 0, high = fx->count, mid;
+
+    // First rate after (currency, date)
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        cmp = strcmp(fx->rates[mid].currency, currency);
+        if (cmp == 0) {
+            cmp = strcmp(fx->rates[mid].date, date);
+        }
+        if (cmp <= 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    if (low > 0 && strcmp(fx->rates[low - 1].currency, currency) == 0) {
+        *rate = fx->rates[low - 1].rate;
+        return 1;
+    }
+
+    if (low < fx->count && strcmp(fx->rates[low].currency, currency) == 0) {
+        *rate = fx->rates[low].rate;
+        return 1;
+    }
+
+    return 0;
+}
+
+// convert_amount converts an amount between currencies, NULL or an
+// empty code being the base currency, at the rates of the date loaded
+// by load_rates. It returns 0, counting the amount as missing, if a
+// rate is unknown.
+int convert_amount(DB_Handler *handler, double amount, const char *from, const char *to, const char *date, double *result) {
+    double from_rate = 1.0, to_rate = 1.0;
+
+    if (from != NULL && from[0] == '\0') {
+        from = NULL;
+    }
+    if (to != NULL && to[0] == '\0') {
+        to = NULL;
+    }
+    if (date == NULL || date[0] == '\0') {
+        date = "9999-12-31";
+    }
+
+    if ((from != NULL && !find_rate(&handler->fx, from, date, &from_rate)) ||
+        (to != NULL && !find_rate(&handler->fx, to, date, &to_rate))) {
+        handler->fx.missing++;
+        return 0;
+    }
+
+    *result = amount * from_rate / to_rate;
+
+    return 1;
+}
+
+// fx_func implements fx(amount, from, to, date) with convert_amount.
+// Amounts already in the right currency are returned as is. The
+// result is NULL if a rate is unknown.
+static void fx_func(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+    DB_Handler *handler = (DB_Handler *) sqlite3_user_data(ctx);
+    const char *from, *to;
+    double amount;
+
+    (void) argc;
+
+    if (sqlite3_value_type(argv[0]) == SQLITE_NULL) {
+        sqlite3_result_null(ctx);
+        return;
+    }
+
+    from = (const char *) sqlite3_value_text(argv[1]);
+    to = (const char *) sqlite3_value_text(argv[2]);
+
+    // Same currency, both NULL included
+    if (from == to || (from != NULL && to != NULL && strcmp(from, to) == 0)) {
+        sqlite3_result_value(ctx, argv[0]);
+        return;
+    }
+
+    if (!convert_amount(handler, sqlite3_value_double(argv[0]), from, to,
+        (const char *) sqlite3_value_text(argv[3]), &amount)) {
+        sqlite3_result_null(ctx);
+        return;
+    }
+
+    sqlite3_result_double(ctx, amount);
+}
+
+// count_row counts a row written to one of the records of the
+// ledger. Rows the triggers write to the counts, the journals or
+// the budget totals aren't records and are left out.
+static void count_row(void *udata, int op, const char *schema, const char *table, sqlite3_int64 row_id) {
+    int i;
+    DB_Handler *handler = (DB_Handler *) udata;
+
+    (void) op;
+    (void) row_id;
+
+    if (strcmp(schema, "main") != 0) {
+        return;
+    }
+
+    for (i = 0; i < NUM_CHANGE_TABLES; i++) {
+        if (strcmp(table, change_tables[i][0]) == 0) {
+            handler->rows++;
+            return;
+        }
+    }
+}
+
+// connect establishes a connection to SQLite database.
+// Each handler owns its connection, so handlers may be used
+// from different threads as long as one handler is not shared.
+// A read-only connection never creates the database file.
+DB_Handler *connect(const char *name, int read_only) {
+    int rc;
+    int flags;
+    sqlite3 *db;
+
+    if (name == NULL || name[0] == '\0') {
+        name = DB_NAME;
+    }
+
+    DB_Handler *handler = (DB_Handler *) calloc(1, sizeof(DB_Handler));
+
+    if (!handler) {
+        log_fatal("Memory allocation error");
+        exit(1);
+    }
+
+    snprintf(handler->db_name, DB_NAME_SIZE, "%s", name);
+
+    if (read_only) {
+        flags = SQLITE_OPEN_READONLY;
+    } else {
+        flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+    }
+
+    rc = sqlite3_open_v2(name, &db, flags | SQLITE_OPEN_NOMUTEX, NULL);
+
+    if (rc != SQLITE_OK) {
+        handler->db = NULL;
+        sqlite3_close(db);
+        return handler;
+    }
+
+    handler->db = db;
+
+    sqlite3_create_function(db, "fx", 4, SQLITE_UTF8, handler, &fx_func, NULL, NULL);
+    sqlite3_update_hook(db, &count_row, handler);
+
+    return handler;
+}
+
+// disconnect finalizes cached statements, closes the connection
+// and frees the handler.
+void disconnect(DB_Handler *handler) {
+    int i;
+
+    if (handler == NULL) {
+        return;
+    }
+
+    for (i = 0; i < NUM_DB_STMT; i++) {
+        sqlite3_finalize(handler->stmts[i]);
+        handler->stmts[i] = NULL;
+    }
+
+    cache_close(handler->cache);
+    clear_results(handler);
+    free(handler->fx.rates);
+
+    sqlite3_close(handler->db);
+
+    free(handler);
+}
+
+// prepare_stmt returns a cached statement ready to be bound.
+// The statement is compiled on first use.
+static sqlite3_stmt *prepare_stmt(DB_Handler *handler, DB_STMT id) {
+    int rc;
+    sqlite3_stmt *stmt;
+
+    stmt = handler->stmts[id];
+
+    if (stmt != NULL) {
+        return stmt;
+    }
+
+    rc = sqlite3_prepare_v3(handler->db, stmt_sql[id], -1,
+        SQLITE_PREPARE_PERSISTENT, &stmt, NULL);
+
+    if (rc != SQLITE_OK) {
+        log_warn("%s", sqlite3_errmsg(handler->db));
+        return NULL;
+    }
+
+    handler->stmts[id] = stmt;
+
+    return stmt;
+}
+
+// release_stmt resets a cached statement so it can be reused
+// and no longer holds a lock on the database.
+static void release_stmt(sqlite3_stmt *stmt) {
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+}
+
+// exec_stmt runs a cached statement which does not return rows.
+static int exec_stmt(DB_Handler *handler, sqlite3_stmt *stmt) {
+    int rc;
+
+    rc = sqlite3_step(stmt);
+
+    if (rc == SQLITE_DONE || rc == SQLITE_ROW) {
+        rc = SQLITE_OK;
+    } else {
+        log_warn("%s", sqlite3_errmsg(handler->db));
+    }
+
+    release_stmt(stmt);
+
+    return rc;
+}
+
+// copy_text copies a column into a fixed-size field.
+static void copy_text(char *dest, size_t size, const unsigned char *text) {
+    if (text != NULL) {
+        snprintf(dest, size, "%s", (const char *) text);
+    } else {
+        dest[0] = '\0';
+    }
+}
+
+// utc_today writes today's date, in UTC like date('now').
+static void utc_today(char *date, size_t size) {
+    time_t now = time(NULL);
+
+    strftime(date, size, "%Y-%m-%d", gmtime(&now));
+}
+
+// exec_sql runs SQL that neither takes parameters nor returns rows.
+static int exec_sql(DB_Handler *handler, const char *sql) {
+    char *zErrMsg = 0;
+    int rc;
+
+    rc = sqlite3_exec(handler->db, sql, NULL, 0, &zErrMsg);
+
+    if (rc != SQLITE_OK) {
+        log_warn("%s", zErrMsg);
+    }
+
+    sqlite3_free(zErrMsg);
+
+    return rc;
+}
+
+// new_record allocates a record of a Queue list, counting it.
+static Queue *new_record(void) {
+    Queue *record = (Queue *) malloc(sizeof(Queue));
+
+    if (!record) {
+        log_fatal("Memory allocation error");
+        exit(1);
+    }
+
+    pthread_mutex_lock(&queue_mutex);
+    if (++queue_nodes > queue_peak) {
+        queue_peak = queue_nodes;
+    }
+    pthread_mutex_unlock(&queue_mutex);
+
+    return record;
+}
+
+// copy_queue returns a copy of a list of records.
+static Queue *copy_queue(const Queue *origin) {
+    Queue *copy = NULL, *last = NULL, *record;
+
+    for (; origin != NULL; origin = origin->next) {
+        record = new_record();
+
+        record->record = origin->record;
+        record->next = NULL;
+
+        if (copy != NULL) {
+            last->next = record;
+        } else {
+            copy = record;
+        }
+        last = record;
+    }
+
+    return copy;
+}
+
+// lookup_result finds the result of a query with the given key,
+// still valid for the database as it is now. It returns 1 and a
+// copy of the result, which may be NULL for no rows, if found.
+static int lookup_result(DB_Handler *handler, DB_STMT stmt, const char *key, Queue **records) {
+    int i, version;
+    Result_Entry *entry;
+
+    if (data_version(handler, &version) != SQLITE_OK) {
+        return 0;
+    }
+
+    for (i = 0; i < RESULT_CACHE_SIZE; i++) {
+        entry = &handler->results.entries[i];
+
+        if (!entry->used || entry->stmt != stmt || strcmp(entry->key, key) != 0) {
+            continue;
+        }
+
+        if (entry->version != version || entry->changes != count_changes(handler)) {
+            clear_queue(entry->records);
+            entry->used = 0;
+            break;
+        }
+
+        handler->results.hits++;
+        *records = copy_queue(entry->records);
+        return 1;
+    }
+
+    handler->results.misses++;
+
+    return 0;
+}
+
+// store_result keeps a copy of the result of a query, in place of
+// the oldest one.
+static void store_result(DB_Handler *handler, DB_STMT stmt, const char *key, const Queue *records) {
+    int version;
+    Result_Entry *entry;
+
+    if (strlen(key) >= sizeof(entry->key) || data_version(handler, &version) != SQLITE_OK) {
+        return;
+    }
+
+    entry = &handler->results.entries[handler->results.next];
+    handler->results.next = (handler->results.next + 1) % RESULT_CACHE_SIZE;
+
+    if (entry->used) {
+        clear_queue(entry->records);
+    }
+
+    entry->used = 1;
+    entry->stmt = stmt;
+    snprintf(entry->key, sizeof(entry->key), "%s", key);
+    entry->version = version;
+    entry->changes = count_changes(handler);
+    entry->records = copy_queue(records);
+}
+
+// clear_results drops every cached query result.
+void clear_results(DB_Handler *handler) {
+    int i;
+
+    for (i = 0; i < RESULT_CACHE_SIZE; i++) {
+        if (handler->results.entries[i].used) {
+            clear_queue(handler->results.entries[i].records);
+            handler->results.entries[i].used = 0;
+        }
+    }
+}
+
+// read_generation reads the transactions generation, which is
+// bumped by triggers on every change to transactions.
+static int read_generation(DB_Handler *handler, int64_t *generation) {
+    int rc;
+    sqlite3_stmt *stmt;
+
+    stmt = prepare_stmt(handler, STMT_GET_GENERATION);
+
+    if (stmt == NULL) {
+        return SQLITE_ERROR;
+    }
+
+    rc = sqlite3_step(stmt);
+
+    if (rc == SQLITE_ROW) {
+        *generation = sqlite3_column_int64(stmt, 0);
+        rc = SQLITE_OK;
+    }
+
+    release_stmt(stmt);
+
+    return rc;
+}
+
+// is_cache_fresh tells whether the transactions cache reflects
+// every transaction of the database.
+int is_cache_fresh(DB_Handler *handler) {
+    int64_t generation;
+
+    if (handler->cache == NULL) {
+        return 0;
+    }
+
+    if (read_generation(handler, &generation) != SQLITE_OK) {
+        return 0;
+    }
+
+    return generation == handler->cache->header->generation;
+}
+
+// append_cache appends a transaction just inserted through this
+// handler to the cache, unless another change happened since the
+// cache was last in sync, in which case the cache stays stale.
+static void append_cache(DB_Handler *handler, sqlite3_int64 id, Transaction *transaction) {
+    int64_t generation;
+    char today[11];
+    const char *date = transaction->date;
+    Cache *cache = handler->cache;
+
+    if (read_generation(handler, &generation) != SQLITE_OK) {
+        return;
+    }
+
+    if (cache->header->generation != generation - 1) {
+        return;
+    }
+
+    // Same default as the insert
+    if (date[0] == '\0') {
+        utc_today(today, sizeof(today));
+        date = today;
+    }
+
+    if (cache_append(cache, id, transaction->amount, transaction->wallet.id, transaction->category.id, date) != 0) {
+        return;
+    }
+
+    cache->header->generation = generation;
+}
+
+// rebuild_cache writes the transactions cache from scratch
+// from a consistent snapshot of the database.
+int rebuild_cache(DB_Handler *handler) {
+    int rc;
+    int64_t generation;
+    uint64_t capacity;
+    char path[DB_NAME_SIZE + sizeof(CACHE_SUFFIX)];
+    Cache *cache;
+    sqlite3_stmt *stmt;
+
+    cache_close(handler->cache);
+    handler->cache = NULL;
+
+    rc = exec_sql(handler, "BEGIN;");
+
+    if (rc != SQLITE_OK) {
+        return rc;
+    }
+
+    rc = read_generation(handler, &generation);
+
+    if (rc != SQLITE_OK) {
+        exec_sql(handler, "ROLLBACK;");
+        return rc;
+    }
+
+    capacity = CACHE_CAPACITY;
+    while (capacity < count_records(handler, TRANSACTION_TYPE)) {
+        capacity *= 2;
+    }
+
+    snprintf(path, sizeof(path), "%s%s", handler->db_name, CACHE_SUFFIX);
+
+    cache = cache_open(path, capacity);
+    stmt = prepare_stmt(handler, STMT_GET_CACHE_ROWS);
+
+    if (cache == NULL || stmt == NULL) {
+        log_warn("Couldn't create cache \"%s\"", path);
+        cache_close(cache);
+        exec_sql(handler, "ROLLBACK;");
+        return SQLITE_CANTOPEN;
+    }
+
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        if (cache_append(cache,
+            sqlite3_column_int64(stmt, 0),
+            sqlite3_column_double(stmt, 1),
+            sqlite3_column_int(stmt, 2),
+            sqlite3_column_int(stmt, 3),
+            (const char *) sqlite3_column_text(stmt, 4)) != 0) {
+            rc = SQLITE_IOERR;
+            break;
+        }
+    }
+
+    release_stmt(stmt);
+    exec_sql(handler, "COMMIT;");
+
+    if (rc != SQLITE_DONE) {
+        cache_close(cache);
+        return rc == SQLITE_ROW ? SQLITE_IOERR : rc;
+    }
+
+    cache->header->generation = generation;
+    handler->cache = cache;
+
+    return SQLITE_OK;
+}
+
+// enable_cache maps the transactions cache of the database,
+// rebuilding it when it is missing or stale.
+int enable_cache(DB_Handler *handler) {
+    char path[DB_NAME_SIZE + sizeof(CACHE_SUFFIX)];
+
+    if (handler->cache == NULL) {
+        snprintf(path, sizeof(path), "%s%s", handler->db_name, CACHE_SUFFIX);
+        handler->cache = cache_open(path, 0);
+    }
+
+    if (is_cache_fresh(handler)) {
+        return SQLITE_OK;
+    }
+
+    return rebuild_cache(handler);
+}
+
+// disable_cache unmaps the transactions cache.
+void disable_cache(DB_Handler *handler) {
+    cache_close(handler->cache);
+    handler->cache = NULL;
+}
+
+// schema_version reads the version of the schema stored
+// in the database header.
+static int schema_version(DB_Handler *handler, int *version) {
+    int rc;
+    sqlite3_stmt *stmt;
+
+    rc = sqlite3_prepare_v2(handler->db, "PRAGMA user_version;", -1, &stmt, NULL);
+
+    if (rc != SQLITE_OK) {
+        log_fatal("%s", sqlite3_errmsg(handler->db));
+        return rc;
+    }
+
+    rc = sqlite3_step(stmt);
+
+    if (rc == SQLITE_ROW) {
+        *version = sqlite3_column_int(stmt, 0);
+        rc = SQLITE_OK;
+    } else {
+        log_fatal("%s", sqlite3_errmsg(handler->db));
+    }
+
+    sqlite3_finalize(stmt);
+
+    return rc;
+}
+
+// change_batch_func is the SQL function telling the triggers which
+// batch changes go to, or NULL when they aren't journaled.
+static void change_batch_func(sqlite3_context *context, int argc, sqlite3_value **argv) {
+    DB_Handler *handler = (DB_Handler *) sqlite3_user_data(context);
+
+    (void) argc;
+    (void) argv;
+
+    if (handler->change_batch > 0) {
+        sqlite3_result_int64(context, handler->change_batch);
+    } else {
+        sqlite3_result_null(context);
+    }
+}
+
+// next_change_batch starts the batch the next changes are journaled
+// in, undone and redone together. The journal keeps the last
+// UNDO_DEPTH batches.
+void next_change_batch(DB_Handler *handler) {
+    sqlite3_int64 batch = 0;
+    sqlite3_stmt *stmt;
+
+    stmt = prepare_stmt(handler, STMT_NEXT_BATCH);
+
+    if (stmt == NULL) {
+        return;
+    }
+
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        batch = sqlite3_column_int64(stmt, 0);
+    }
+
+    release_stmt(stmt);
+
+    // Batches only move on once changes were journaled, so trim
+    // once per UNDO_DEPTH of them.
+    if (batch != handler->change_batch && batch > UNDO_DEPTH && batch % UNDO_DEPTH == 0) {
+        stmt = prepare_stmt(handler, STMT_TRIM_CHANGES);
+        if (stmt != NULL) {
+            sqlite3_bind_int64(stmt, 1, batch - UNDO_DEPTH);
+            exec_stmt(handler, stmt);
+        }
+    }
+
+    handler->change_batch = batch;
+}
+
+// column_list prefixes every column of a comma separated list,
+// as in NEW.id,NEW.name. It must be freed with sqlite3_free.
+static char *column_list(const char *prefix, const char *columns) {
+    char *list = NULL, *next;
+    const char *end;
+
+    for (;;) {
+        end = strchr(columns, ',');
+        if (end == NULL) {
+            end = columns + strlen(columns);
+        }
+
+        if (list == NULL) {
+            next = sqlite3_mprintf("%s%.*s", prefix, (int) (end - columns), columns);
+        } else {
+            next = sqlite3_mprintf("%s,%s%.*s", list, prefix, (int) (end - columns), columns);
+        }
+
+        sqlite3_free(list);
+
+        if (next == NULL) {
+            log_fatal("Memory allocation error");
+            exit(1);
+        }
+
+        list = next;
+
+        if (*end == '\0') {
+            return list;
+        }
+
+        columns = end + 1;
+    }
+}
+
+// start_changes journals the changes made through this connection.
+// The triggers are TEMP so they only exist on connections which
+// registered the functions they call.
+static int start_changes(DB_Handler *handler) {
+    int rc, i;
+    char *sql, *old_columns, *new_columns;
+
+    if (sqlite3_db_readonly(handler->db, "main")) {
+        return SQLITE_OK;
+    }
+
+    rc = sqlite3_create_function(handler->db, "change_pack", -1,
+        SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL, &change_pack, NULL, NULL);
+
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_create_function(handler->db, "change_batch", 0,
+            SQLITE_UTF8, handler, &change_batch_func, NULL, NULL);
+    }
+
+    for (i = 0; i < NUM_CHANGE_TABLES && rc == SQLITE_OK; i++) {
+        old_columns = column_list("OLD.", change_tables[i][1]);
+        new_columns = column_list("NEW.", change_tables[i][1]);
+
+        sql = sqlite3_mprintf(
+            "CREATE TEMP TRIGGER IF NOT EXISTS changes_%s_insert " \
+            "AFTER INSERT ON main.%s WHEN change_batch() IS NOT NULL BEGIN " \
+            "INSERT INTO changes(batch, tbl, new) VALUES(change_batch(), %d, change_pack(%s)); " \
+            "END;" \
+
+            "CREATE TEMP TRIGGER IF NOT EXISTS changes_%s_update " \
+            "AFTER UPDATE ON main.%s WHEN change_batch() IS NOT NULL BEGIN " \
+            "INSERT INTO changes(batch, tbl, old, new) VALUES(change_batch(), %d, change_pack(%s), change_pack(%s)); " \
+            "END;" \
+
+            "CREATE TEMP TRIGGER IF NOT EXISTS changes_%s_delete " \
+            "AFTER DELETE ON main.%s WHEN change_batch() IS NOT NULL BEGIN " \
+            "INSERT INTO changes(batch, tbl, old) VALUES(change_batch(), %d, change_pack(%s)); " \
+            "END;",
+            change_tables[i][0], change_tables[i][0], i, new_columns,
+            change_tables[i][0], change_tables[i][0], i, old_columns, new_columns,
+            change_tables[i][0], change_tables[i][0], i, old_columns
+        );
+
+        if (sql == NULL) {
+            log_fatal("Memory allocation error");
+            exit(1);
+        }
+
+        rc = exec_sql(handler, sql);
+
+        sqlite3_free(sql);
+        sqlite3_free(old_columns);
+        sqlite3_free(new_columns);
+    }
+
+    if (rc == SQLITE_OK) {
+        next_change_batch(handler);
+    }
+
+    return rc;
+}
+
+// stop_changes drops the journaling triggers, before the tables they
+// are on are replaced. start_changes makes them again.
+static void stop_changes(DB_Handler *handler) {
+    int i;
+    char *sql;
+
+    for (i = 0; i < NUM_CHANGE_TABLES; i++) {
+        sql = sqlite3_mprintf(
+            "DROP TRIGGER IF EXISTS temp.changes_%s_insert;" \
+            "DROP TRIGGER IF EXISTS temp.changes_%s_update;" \
+            "DROP TRIGGER IF EXISTS temp.changes_%s_delete;",
+            change_tables[i][0], change_tables[i][0], change_tables[i][0]
+        );
+
+        if (sql == NULL) {
+            log_fatal("Memory allocation error");
+            exit(1);
+        }
+
+        exec_sql(handler, sql);
+        sqlite3_free(sql);
+    }
+}
+
+// init_db brings the schema up to date.
+// When it is current, this is a single pragma read. Otherwise the
+// missing migrations are applied in order within one transaction.
+int init_db(DB_Handler *handler) {
+    char *sql;
+    char *zErrMsg = 0;
+    int rc;
+    int version;
+
+    rc = schema_version(handler, &version);
+
+    if (rc != SQLITE_OK) {
+        return rc;
+    }
+
+    if (version == SCHEMA_VERSION) {
+        return start_changes(handler);
+    }
+
+    if (version > SCHEMA_VERSION) {
+        log_fatal("Database \"%s\" has a newer schema (%d)", handler->db_name, version);
+        return SQLITE_ERROR;
+    }
+
+    if (sqlite3_db_readonly(handler->db, "main")) {
+        log_fatal("Database \"%s\" must be opened once in read-write mode to be upgraded", handler->db_name);
+        return SQLITE_READONLY;
+    }
+
+    rc = sqlite3_exec(handler->db, "BEGIN IMMEDIATE;", NULL, 0, &zErrMsg);
+
+    // Another process may have upgraded the schema meanwhile
+    if (rc == SQLITE_OK) {
+        rc = schema_version(handler, &version);
+    }
+
+    while (rc == SQLITE_OK && version < SCHEMA_VERSION) {
+        rc = sqlite3_exec(handler->db, migrations[version], NULL, 0, &zErrMsg);
+
+        if (rc == SQLITE_OK) {
+            version++;
+            sql = sqlite3_mprintf("PRAGMA user_version = %d;", version);
+            rc = sqlite3_exec(handler->db, sql, NULL, 0, &zErrMsg);
+            sqlite3_free(sql);
+        }
+    }
+
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_exec(handler->db, "COMMIT;", NULL, 0, &zErrMsg);
+    }
+
+    if (rc != SQLITE_OK) {
+        log_fatal("%s", zErrMsg != NULL ? zErrMsg : sqlite3_errstr(rc));
+        sqlite3_exec(handler->db, "ROLLBACK;", NULL, 0, NULL);
+    }
+
+    sqlite3_free(zErrMsg);
+
+    if (rc == SQLITE_OK) {
+        rc = start_changes(handler);
+    }
+
+    return rc;
+}
+
+// add_wallet inserts a new wallet into the database.
+int add_wallet(DB_Handler *handler, Wallet *wallet) {
+    sqlite3_stmt *stmt;
+
+    stmt = prepare_stmt(handler, STMT_ADD_WALLET);
+
+    if (stmt == NULL) {
+        return SQLITE_ERROR;
+    }
+
+    sqlite3_bind_text(stmt, 1, wallet->name, -1, SQLITE_STATIC);
+    if (wallet->currency[0] != '\0') {
+        sqlite3_bind_text(stmt, 2, wallet->currency, -1, SQLITE_STATIC);
+    }
+
+    return exec_stmt(handler, stmt);
+}
+
+// add_category inserts a new category into the database.
+int add_category(DB_Handler *handler, Category *category) {
+    sqlite3_stmt *stmt;
+
+    stmt = prepare_stmt(handler, STMT_ADD_CATEGORY);
+
+    if (stmt == NULL) {
+        return SQLITE_ERROR;
+    }
+
+    sqlite3_bind_text(stmt, 1, category->name, -1, SQLITE_STATIC);
+
+    return exec_stmt(handler, stmt);
+}
+
+// read_budget reads the BUDGET_COLUMNS of a row.
+static void read_budget(sqlite3_stmt *stmt, Budget *budget) {
+    budget->id = sqlite3_column_int(stmt, 0);
+    budget->wallet.id = sqlite3_column_int(stmt, 1);
+    copy_text(budget->wallet.name, sizeof(budget->wallet.name), sqlite3_column_text(stmt, 2));
+    budget->wallet.balance = 0.0;
+    budget->category.id = sqlite3_column_int(stmt, 3);
+    copy_text(budget->category.name, sizeof(budget->category.name), sqlite3_column_text(stmt, 4));
+    budget->category.amount = 0.0;
+    budget->period = parse_rule((const char *) sqlite3_column_text(stmt, 5));
+    budget->limit = sqlite3_column_double(stmt, 6);
+    budget->warn = sqlite3_column_double(stmt, 7);
+    copy_text(budget->start, sizeof(budget->start), sqlite3_column_text(stmt, 8));
+    budget->spent = sqlite3_column_double(stmt, 9);
+}
+
+// check_budgets calls the budget hook for each budget whose
+// threshold or limit the transaction id just crossed.
+static void check_budgets(DB_Handler *handler, sqlite3_int64 id) {
+    Budget budget;
+    sqlite3_stmt *stmt;
+
+    if (handler->budget_hook == NULL) {
+        return;
+    }
+
+    stmt = prepare_stmt(handler, STMT_CHECK_BUDGETS);
+
+    if (stmt == NULL) {
+        return;
+    }
+
+    sqlite3_bind_int64(stmt, 1, id);
+
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        read_budget(stmt, &budget);
+        handler->budget_hook(&budget, sqlite3_column_int(stmt, 10), handler->budget_udata);
+    }
+
+    release_stmt(stmt);
+}
+
+// add_transaction inserts a new transaction into the database and
+// checks the budgets counting it.
+int add_transaction(DB_Handler *handler, Transaction *transaction) {
+    int rc;
+    sqlite3_stmt *stmt;
+
+    stmt = prepare_stmt(handler, STMT_ADD_TRANSACTION);
+
+    if (stmt == NULL) {
+        return SQLITE_ERROR;
+    }
+
+    sqlite3_bind_text(stmt, 1, transaction->name, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, transaction->description, -1, SQLITE_STATIC);
+    sqlite3_bind_double(stmt, 3, transaction->amount);
+    sqlite3_bind_int(stmt, 4, transaction->wallet.id);
+    sqlite3_bind_int(stmt, 5, transaction->category.id);
+    if (transaction->date[0] != '\0') {
+        sqlite3_bind_text(stmt, 6, transaction->date, -1, SQLITE_STATIC);
+    } else {
+        sqlite3_bind_null(stmt, 6);
+    }
+    if (transaction->currency[0] != '\0') {
+        sqlite3_bind_text(stmt, 7, transaction->currency, -1, SQLITE_STATIC);
+    }
+
+    rc = exec_stmt(handler, stmt);
+
+    if (rc == SQLITE_OK && handler->cache != NULL) {
+        append_cache(handler, sqlite3_last_insert_rowid(handler->db), transaction);
+    }
+
+    if (rc == SQLITE_OK) {
+        check_budgets(handler, sqlite3_last_insert_rowid(handler->db));
+    }
+
+    return rc;
+}
+
+// insert_leg inserts one side of a transfer.
+static int insert_leg(DB_Handler *handler, Transfer *transfer, sqlite3_int64 id, Wallet *wallet, double amount, const char *description) {
+    sqlite3_stmt *stmt;
+
+    stmt = prepare_stmt(handler, STMT_ADD_TRANSFER_LEG);
+
+    if (stmt == NULL) {
+        return SQLITE_ERROR;
+    }
+
+    sqlite3_bind_text(stmt, 1, description, -1, SQLITE_TRANSIENT);
+    sqlite3_bind_double(stmt, 2, amount);
+    sqlite3_bind_int(stmt, 3, wallet->id);
+    sqlite3_bind_text(stmt, 4, transfer->date, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 5, id);
+
+    return exec_stmt(handler, stmt);
+}
+
+// insert_transfer writes a transfer and both of its legs. It must
+// run inside a transaction so the legs are never seen apart.
+static int insert_transfer(DB_Handler *handler, Transfer *transfer) {
+    int rc;
+    char description[128];
+    sqlite3_int64 id;
+    sqlite3_stmt *stmt;
+
+    if (transfer->amount <= 0.0 || transfer->from.id == transfer->to.id) {
+        return SQLITE_CONSTRAINT;
+    }
+
+    if (transfer->date[0] == '\0') {
+        utc_today(transfer->date, sizeof(transfer->date));
+    }
+
+    stmt = prepare_stmt(handler, STMT_ADD_TRANSFER);
+
+    if (stmt == NULL) {
+        return SQLITE_ERROR;
+    }
+
+    sqlite3_bind_int(stmt, 1, transfer->from.id);
+    sqlite3_bind_int(stmt, 2, transfer->to.id);
+    sqlite3_bind_double(stmt, 3, transfer->amount);
+    sqlite3_bind_text(stmt, 4, transfer->date, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 5, transfer->description, -1, SQLITE_STATIC);
+
+    rc = exec_stmt(handler, stmt);
+
+    if (rc != SQLITE_OK) {
+        return rc;
+    }
+
+    id = sqlite3_last_insert_rowid(handler->db);
+    transfer->id = (unsigned int) id;
+
+    snprintf(description, sizeof(description), "%s", transfer->description);
+    if (description[0] == '\0') {
+        snprintf(description, sizeof(description), "to %s", transfer->to.name);
+    }
+    rc = insert_leg(handler, transfer, id, &transfer->from, -transfer->amount, description);
+
+    if (rc == SQLITE_OK) {
+        snprintf(description, sizeof(description), "%s", transfer->description);
+        if (description[0] == '\0') {
+            snprintf(description, sizeof(description), "from %s", transfer->from.name);
+        }
+        rc = insert_leg(handler, transfer, id, &transfer->to, transfer->amount, description);
+    }
+
+    return rc;
+}
+
+// add_transfer moves money between two wallets. The transfer and
+// its debit and credit legs are committed together or not at all.
+int add_transfer(DB_Handler *handler, Transfer *transfer) {
+    return add_transfers(handler, transfer, 1);
+}
+
+// add_transfers writes a batch of transfers in a single
+// transaction. Either every transfer is written or none is.
+int add_transfers(DB_Handler *handler, Transfer *transfers, size_t count) {
+    int rc;
+    size_t i;
+
+    rc = exec_sql(handler, "BEGIN IMMEDIATE;");
+
+    if (rc != SQLITE_OK) {
+        return rc;
+    }
+
+    for (i = 0; i < count && rc == SQLITE_OK; i++) {
+        rc = insert_transfer(handler, &transfers[i]);
+    }
+
+    if (rc != SQLITE_OK) {
+        exec_sql(handler, "ROLLBACK;");
+        return rc;
+    }
+
+    return exec_sql(handler, "COMMIT;");
+}
+
+// load_rates loads every exchange rate into the FX_Table of the
+// handler, for the query or the scan about to run.
+int load_rates(DB_Handler *handler) {
+    FX_Table *fx = &handler->fx;
+    sqlite3_stmt *stmt;
+
+    fx->count = 0;
+    fx->missing = 0;
+
+    stmt = prepare_stmt(handler, STMT_GET_RATES);
+
+    if (stmt == NULL) {
+        return SQLITE_ERROR;
+    }
+
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        if (fx->count == fx->capacity) {
+            fx->capacity = fx->capacity > 0 ? fx->capacity * 2 : 64;
+            fx->rates = (FX_Rate *) realloc(fx->rates, fx->capacity * sizeof(FX_Rate));
+            if (!fx->rates) {
+                log_fatal("Memory allocation error");
+                exit(1);
+            }
+        }
+        copy_text(fx->rates[fx->count].currency, sizeof(fx->rates[fx->count].currency), sqlite3_column_text(stmt, 0));
+        copy_text(fx->rates[fx->count].date, sizeof(fx->rates[fx->count].date), sqlite3_column_text(stmt, 1));
+        fx->rates[fx->count].rate = sqlite3_column_double(stmt, 2);
+        fx->count++;
+    }
+
+    release_stmt(stmt);
+
+    return SQLITE_OK;
+}
+
+// has_currencies checks if any wallet or transaction is in another
+// currency than the base one.
+int has_currencies(DB_Handler *handler) {
+    int found = 0;
+    sqlite3_stmt *stmt;
+
+    stmt = prepare_stmt(handler, STMT_HAS_CURRENCIES);
+
+    if (stmt == NULL) {
+        return 0;
+    }
+
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        found = sqlite3_column_int(stmt, 0);
+    }
+
+    release_stmt(stmt);
+
+    return found;
+}
+
+// get_cached_wallets retrieves wallets from the database and
+// computes their balances from the transactions cache.
+static Queue *get_cached_wallets(DB_Handler *handler, Wallet *wallet) {
+    unsigned int max_id = 0;
+    int64_t *sums;
+    Queue *origin, *last, *record;
+    sqlite3_stmt *stmt;
+
+    origin = NULL;
+
+    stmt = prepare_stmt(handler, STMT_GET_WALLET_NAMES);
+
+    if (stmt == NULL) {
+        return origin;
+    }
+
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        unsigned int id = sqlite3_column_int(stmt, 0);
+        const char *name = (const char *) sqlite3_column_text(stmt, 1);
+
+        // Filter
+        if (wallet != NULL && wallet->name[0] != '\0') {
+            if (strcmp(name, wallet->name) != 0 && id != wallet->id) {
+                continue;
+            }
+        }
+
+        record = new_record();
+
+        record->record.wallet.id = id;
+        copy_text(record->record.wallet.name, sizeof(record->record.wallet.name), (const unsigned char *) name);
+        copy_text(record->record.wallet.currency, sizeof(record->record.wallet.currency), sqlite3_column_text(stmt, 2));
+        record->next = NULL;
+
+        if (id > max_id) {
+            max_id = id;
+        }
+
+        if (origin != NULL) {
+            last->next = record;
+            last = record;
+        } else {
+            origin = record;
+            last = record;
+        }
+    }
+
+    release_stmt(stmt);
+
+    sums = (int64_t *) malloc((max_id + 1) * sizeof(int64_t));
+
+    if (!sums) {
+        log_fatal("Memory allocation error");
+        exit(1);
+    }
+
+    cache_sum_by_wallet(handler->cache, sums, max_id + 1);
+
+    for (record = origin; record != NULL; record = record->next) {
+        record->record.wallet.balance = sums[record->record.wallet.id] / 100.0;
+    }
+
+    free(sums);
+
+    return origin;
+}
+
+// get_wallets retrieves wallets and put them into
+// a linked list.
+Queue *get_wallets(DB_Handler *handler, Wallet *wallet) {
+    Queue *origin, *last = NULL;
+    sqlite3_stmt *stmt;
+    char key[48] = "";
+
+    handler->fx.missing = 0;
+
+    // The cache has no currencies, amounts are summed as they are
+    if (is_cache_fresh(handler) && !has_currencies(handler)) {
+        return get_cached_wallets(handler, wallet);
+    }
+
+    if (wallet != NULL && wallet->name[0] != '\0') {
+        snprintf(key, sizeof(key), "%u:%s", wallet->id, wallet->name);
+    }
+
+    if (lookup_result(handler, STMT_GET_WALLETS, key, &origin)) {
+        return origin;
+    }
+
+    origin = NULL;
+
+    // Amounts are only converted if there is any other currency
+    if (has_currencies(handler)) {
+        stmt = prepare_stmt(handler, STMT_GET_WALLETS_FX);
+        if (stmt != NULL && load_rates(handler) != SQLITE_OK) {
+            stmt = NULL;
+        }
+    } else {
+        stmt = prepare_stmt(handler, STMT_GET_WALLETS);
+    }
+
+    if (stmt == NULL) {
+        return origin;
+    }
+
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        unsigned int id = sqlite3_column_int(stmt, 0);
+        const char *name = (const char *) sqlite3_column_text(stmt, 1);
+        double balance = sqlite3_column_double(stmt, 2);
+
+        // Filter
+        if (wallet != NULL && wallet->name[0] != '\0') {
+            if (strcmp(name, wallet->name) != 0 && id != wallet->id) {
+                continue;
+            }
+        }
+
+        Queue *record = new_record();
+
+        record->record.wallet.id = id;
+        if (name != NULL) {
+            strcpy(record->record.wallet.name, name);
+        } else {
+            record->record.wallet.name[0] = '\0';
+        }
+        record->record.wallet.balance = balance;
+        copy_text(record->record.wallet.currency, sizeof(record->record.wallet.currency), sqlite3_column_text(stmt, 3));
+        record->next = NULL;
+
+        if (origin != NULL) {
+            last->next = record;
+            last = record;
+        } else {
+            origin = record;
+            last = record;
+        }
+    }
+
+    release_stmt(stmt);
+
+    store_result(handler, STMT_GET_WALLETS, key, origin);
+
+    return origin;
+}
+
+// get_categories retrieves categories and put them into
+// a linked list.
+Queue *get_categories(DB_Handler *handler, Category *category) {
+    Queue *origin, *last = NULL;
+    sqlite3_stmt *stmt;
+    char key[48] = "";
+
+    if (category != NULL && category->name[0] != '\0') {
+        snprintf(key, sizeof(key), "%u:%s", category->id, category->name);
+    }
+
+    if (lookup_result(handler, STMT_GET_CATEGORIES, key, &origin)) {
+        return origin;
+    }
+
+    origin = NULL;
+
+    stmt = prepare_stmt(handler, STMT_GET_CATEGORIES);
+
+    if (stmt == NULL) {
+        return origin;
+    }
+
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        unsigned int id = sqlite3_column_int(stmt, 0);
+        const char *name = (const char *) sqlite3_column_text(stmt, 1);
+
+        // Filter
+        if (category != NULL && category->name[0] != '\0') {
+            if (strcmp(name, category->name) != 0 && id != category->id) {
+                continue;
+            }
+        }
+
+        Queue *record = new_record();
+
+        record->record.category.id = id;
+        if (name != NULL) {
+            strcpy(record->record.category.name, name);
+        } else {
+            record->record.category.name[0] = '\0';
+        }
+        record->next = NULL;
+
+        if (origin != NULL) {
+            last->next = record;
+            last = record;
+        } else {
+            origin = record;
+            last = record;
+        }
+    }
+
+    release_stmt(stmt);
+
+    store_result(handler, STMT_GET_CATEGORIES, key, origin);
+
+    return origin;
+}
+
+// read_transaction reads a row of STMT_GET_TRANSACTIONS.
+static void read_transaction(sqlite3_stmt *stmt, Transaction *transaction) {
+    transaction->id = sqlite3_column_int(stmt, 0);
+    copy_text(transaction->name, sizeof(transaction->name), sqlite3_column_text(stmt, 1));
+    copy_text(transaction->description, sizeof(transaction->description), sqlite3_column_text(stmt, 2));
+    transaction->amount = sqlite3_column_double(stmt, 3);
+    transaction->wallet.id = sqlite3_column_int(stmt, 4);
+    copy_text(transaction->wallet.name, sizeof(transaction->wallet.name), sqlite3_column_text(stmt, 5));
+    transaction->wallet.balance = 0.0;
+    transaction->category.id = sqlite3_column_int(stmt, 6);
+    copy_text(transaction->category.name, sizeof(transaction->category.name), sqlite3_column_text(stmt, 7));
+    transaction->category.amount = 0.0;
+    copy_text(transaction->date, sizeof(transaction->date), sqlite3_column_text(stmt, 8));
+    copy_text(transaction->currency, sizeof(transaction->currency), sqlite3_column_text(stmt, 9));
+    transaction->wallet.currency[0] = '\0';
+}
+
+// iterate_transactions calls back for every transaction straight from
+// the cursor, without building a list. Iteration stops early when the
+// callback returns non-zero.
+int iterate_transactions(DB_Handler *handler, Transaction *transaction, Transaction_Callback callback, void *udata) {
+    int rc;
+    Transaction row;
+    sqlite3_stmt *stmt;
+
+    stmt = prepare_stmt(handler, STMT_GET_TRANSACTIONS);
+
+    if (stmt == NULL) {
+        return SQLITE_ERROR;
+    }
+
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        const unsigned char *name = sqlite3_column_text(stmt, 1);
+
+        // Filter
+        if (transaction != NULL && transaction->name[0] != '\0') {
+            if (name == NULL || strcmp((const char *) name, transaction->name) != 0) {
+                continue;
+            }
+        }
+
+        read_transaction(stmt, &row);
+
+        if (callback(&row, udata) != 0) {
+            rc = SQLITE_DONE;
+            break;
+        }
+    }
+
+    if (rc != SQLITE_DONE) {
+        log_warn("%s", sqlite3_errmsg(handler->db));
+    }
+
+    release_stmt(stmt);
+
+    return rc == SQLITE_DONE ? SQLITE_OK : rc;
+}
+
+// iterate_cash_flows calls back for every transaction moving money in
+// or out of the ledger, leaving out transfers between wallets and
+// opening balances. Iteration stops early when the callback returns
+// non-zero.
+int iterate_cash_flows(DB_Handler *handler, Transaction_Callback callback, void *udata) {
+    int rc;
+    Transaction row;
+    sqlite3_stmt *stmt;
+
+    stmt = prepare_stmt(handler, STMT_GET_CASH_FLOWS);
+
+    if (stmt == NULL) {
+        return SQLITE_ERROR;
+    }
+
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        read_transaction(stmt, &row);
+
+        if (callback(&row, udata) != 0) {
+            rc = SQLITE_DONE;
+            break;
+        }
+    }
+
+    if (rc != SQLITE_DONE) {
+        log_warn("%s", sqlite3_errmsg(handler->db));
+    }
+
+    release_stmt(stmt);
+
+    return rc == SQLITE_DONE ? SQLITE_OK : rc;
+}
+
+// attach_archive attaches the archive of a year under the given schema name.
+static int attach_archive(DB_Handler *handler, const char *path, const char *schema) {
+    int rc;
+    char *sql;
+
+    sql = sqlite3_mprintf("ATTACH DATABASE %Q AS %s;", path, schema);
+    rc = exec_sql(handler, sql);
+    sqlite3_free(sql);
+
+    return rc;
+}
+
+// upgrade_archive adds the currency column to an attached archive
+// written before currencies existed. An archive attached read-only is
+// left as it is, and currency is set to 0 so its rows are read in the
+// currency of their wallet.
+static int upgrade_archive(DB_Handler *handler, const char *schema, int *currency) {
+    int rc;
+    char *sql;
+    sqlite3_stmt *stmt;
+
+    sql = sqlite3_mprintf("SELECT 1 FROM pragma_table_info('transactions', %Q) WHERE name = 'currency';", schema);
+    rc = sqlite3_prepare_v2(handler->db, sql, -1, &stmt, NULL);
+    sqlite3_free(sql);
+
+    if (rc != SQLITE_OK) {
+        log_warn("%s", sqlite3_errmsg(handler->db));
+        return rc;
+    }
+
+    rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+
+    *currency = rc == SQLITE_ROW;
+
+    if (rc != SQLITE_ROW && rc != SQLITE_DONE) {
+        log_warn("%s", sqlite3_errmsg(handler->db));
+        return rc;
+    }
+
+    if (*currency || sqlite3_db_readonly(handler->db, schema) == 1) {
+        return SQLITE_OK;
+    }
+
+    sql = sqlite3_mprintf("ALTER TABLE %s.transactions ADD COLUMN currency TEXT;", schema);
+    rc = exec_sql(handler, sql);
+    sqlite3_free(sql);
+
+    *currency = rc == SQLITE_OK;
+
+    return rc;
+}
+
+// detach_archive detaches a schema attached by attach_archive.
+static void detach_archive(DB_Handler *handler, const char *schema) {
+    char *sql;
+
+    sql = sqlite3_mprintf("DETACH DATABASE %s;", schema);
+    exec_sql(handler, sql);
+    sqlite3_free(sql);
+}
+
+// iterate_transactions_between calls back for every transaction dated
+// between from and to, inclusive, in date order. Either bound may be
+// NULL. Opening balances are left out, and the archives of the years
+// in the range are attached only for the time of the scan.
+int iterate_transactions_between(DB_Handler *handler, const char *from, const char *to, Transaction_Callback callback, void *udata) {
+    int rc;
+    int i, attached = 0, limit;
+    int currency;
+    char schemas[ARCHIVE_MAX_ATTACHED][16];
+    Transaction row;
+    sqlite3_str *sql;
+    sqlite3_stmt *stmt;
+
+    if (from == NULL) {
+        from = "0000-00-00";
+    }
+    if (to == NULL) {
+        to = "9999-99-99";
+    }
+
+    sql = sqlite3_str_new(handler->db);
+    sqlite3_str_appendall(sql,
+        "SELECT t.id, t.name, t.description, t.amount, t.wallet_id, wallets.name, " \
+        "t.category_id, categories.name, t.date, COALESCE(t.currency, wallets.currency) FROM (" \
+        "SELECT " ARCHIVE_COLUMNS " FROM main.transactions " \
+        "WHERE opening = 0 AND date >= ?1 AND date <= ?2"
+    );
+
+    // Archives overlapping the range
+    stmt = prepare_stmt(handler, STMT_GET_ARCHIVES);
+
+    if (stmt == NULL) {
+        sqlite3_free(sqlite3_str_finish(sql));
+        return SQLITE_ERROR;
+    }
+
+    sqlite3_bind_int(stmt, 1, atoi(from));
+    sqlite3_bind_int(stmt, 2, atoi(to));
+
+    // One slot is left for attaching during archive
+    limit = sqlite3_limit(handler->db, SQLITE_LIMIT_ATTACHED, -1) - 1;
+    if (limit > ARCHIVE_MAX_ATTACHED) {
+        limit = ARCHIVE_MAX_ATTACHED;
+    }
+
+    rc = SQLITE_OK;
+
+    while (rc == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW) {
+        if (attached == limit) {
+            log_warn("Date range spans more than %d archives", limit);
+            rc = SQLITE_RANGE;
+            break;
+        }
+
+        snprintf(schemas[attached], sizeof(schemas[attached]), "archive_%d", sqlite3_column_int(stmt, 0));
+        rc = attach_archive(handler, (const char *) sqlite3_column_text(stmt, 1), schemas[attached]);
+
+        if (rc != SQLITE_OK) {
+            break;
+        }
+
+        rc = upgrade_archive(handler, schemas[attached], &currency);
+
+        if (rc == SQLITE_OK) {
+            // Rows of an older read-only archive are in the wallet's currency
+            sqlite3_str_appendf(sql,
+                " UNION ALL SELECT %s FROM %s.transactions " \
+                "WHERE date >= ?1 AND date <= ?2",
+                currency ? ARCHIVE_COLUMNS : LEGACY_ARCHIVE_COLUMNS ",NULL",
+                schemas[attached]
+            );
+        }
+        attached++;
+    }
+
+    release_stmt(stmt);
+
+    sqlite3_str_appendall(sql,
+        ") AS t " \
+        "LEFT JOIN main.wallets ON t.wallet_id = wallets.id " \
+        "LEFT JOIN main.categories ON t.category_id = categories.id " \
+        "ORDER BY t.date ASC, t.id ASC;"
+    );
+
+    stmt = NULL;
+
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_prepare_v2(handler->db, sqlite3_str_value(sql), -1, &stmt, NULL);
+    }
+
+    sqlite3_free(sqlite3_str_finish(sql));
+
+    if (rc == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, from, -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 2, to, -1, SQLITE_STATIC);
+
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+            read_transaction(stmt, &row);
+
+            if (callback(&row, udata) != 0) {
+                rc = SQLITE_DONE;
+                break;
+            }
+        }
+
+        rc = rc == SQLITE_DONE ? SQLITE_OK : rc;
+    }
+
+    if (rc != SQLITE_OK) {
+        log_warn("%s", sqlite3_errmsg(handler->db));
+    }
+
+    sqlite3_finalize(stmt);
+
+    for (i = 0; i < attached; i++) {
+        detach_archive(handler, schemas[i]);
+    }
+
+    return rc;
+}
+
+// append_transaction appends a transaction to the list
+// built by get_transactions.
+static int append_transaction(const Transaction *transaction, void *udata) {
+    Queue **last = (Queue **) udata;
+    Queue *record = new_record();
+
+    record->record.transaction = *transaction;
+    record->next = NULL;
+
+    (*last)->next = record;
+    *last = record;
+
+    return 0;
+}
+
+// get_transactions retrieves transactions and put them into
+// a linked list.
+Queue *get_transactions(DB_Handler *handler, Transaction *transaction) {
+    Queue origin;
+    Queue *last;
+
+    origin.next = NULL;
+    last = &origin;
+
+    iterate_transactions(handler, transaction, &append_transaction, &last);
+
+    return origin.next;
+}
+
+// compare_amounts orders categories by amount.
+static int compare_amounts(const void *a, const void *b) {
+    const Category *x = &(*(Queue * const *) a)->record.category;
+    const Category *y = &(*(Queue * const *) b)->record.category;
+
+    if (x->amount != y->amount) {
+        return x->amount < y->amount ? -1 : 1;
+    }
+
+    return x->id < y->id ? -1 : x->id > y->id;
+}
+
+// get_cached_categories_overview retrieves categories from the
+// database and computes spent amounts from the transactions cache.
+static Queue *get_cached_categories_overview(DB_Handler *handler) {
+    size_t i;
+    size_t count = 0;
+    unsigned int max_id = 0;
+    int64_t *sums;
+    Queue **records;
+    Queue *origin, *record;
+
+    origin = get_categories(handler, NULL);
+
+    for (record = origin; record != NULL; record = record->next) {
+        if (record->record.category.id > max_id) {
+            max_id = record->record.category.id;
+        }
+        count++;
+    }
+
+    if (count == 0) {
+        return origin;
+    }
+
+    sums = (int64_t *) malloc((max_id + 1) * sizeof(int64_t));
+    records = (Queue **) malloc(count * sizeof(Queue *));
+
+    if (!sums || !records) {
+        log_fatal("Memory allocation error");
+        exit(1);
+    }
+
+    cache_sum_by_category(handler->cache, sums, max_id + 1);
+
+    for (i = 0, record = origin; record != NULL; record = record->next) {
+        record->record.category.amount = sums[record->record.category.id] / 100.0;
+        records[i++] = record;
+    }
+
+    // ORDER BY amount ASC
+    qsort(records, count, sizeof(Queue *), &compare_amounts);
+
+    for (i = 0; i + 1 < count; i++) {
+        records[i]->next = records[i + 1];
+    }
+    records[count - 1]->next = NULL;
+    origin = records[0];
+
+    free(records);
+    free(sums);
+
+    return origin;
+}
+
+// get_categories_overview retrieves categories, spent amounts and put them into
+// a linked list.
+Queue *get_categories_overview(DB_Handler *handler, Category *category) {
+    Queue *origin, *last = NULL;
+    sqlite3_stmt *stmt;
+
+    handler->fx.missing = 0;
+
+    if (is_cache_fresh(handler) && !has_currencies(handler)) {
+        return get_cached_categories_overview(handler);
+    }
+
+    if (lookup_result(handler, STMT_GET_CATEGORIES_OVERVIEW, "", &origin)) {
+        return origin;
+    }
+
+    origin = NULL;
+
+    if (has_currencies(handler)) {
+        stmt = prepare_stmt(handler, STMT_GET_CATEGORIES_OVERVIEW_FX);
+        if (stmt != NULL && load_rates(handler) != SQLITE_OK) {
+            stmt = NULL;
+        }
+    } else {
+        stmt = prepare_stmt(handler, STMT_GET_CATEGORIES_OVERVIEW);
+    }
+
+    if (stmt == NULL) {
+        return origin;
+    }
+
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        Queue *record = new_record();
+
+        unsigned int id = sqlite3_column_int(stmt, 0);
+        const char *name = (const char *) sqlite3_column_text(stmt, 1);
+        double amount = sqlite3_column_double(stmt, 2);
+
+        record->record.category.id = id;
+        if (name != NULL) {
+            strcpy(record->record.category.name, name);
+        } else {
+            record->record.category.name[0] = '\0';
+        }
+        record->record.category.amount = amount;
+        record->next = NULL;
+
+        if (origin != NULL) {
+            last->next = record;
+            last = record;
+        } else {
+            origin = record;
+            last = record;
+        }
+    }
+
+    release_stmt(stmt);
+
+    store_result(handler, STMT_GET_CATEGORIES_OVERVIEW, "", origin);
+
+    return origin;
+}
+
+// remove_wallet deletes wallet from database.
+int remove_wallet(DB_Handler *handler, Wallet *wallet) {
+    int rc;
+    sqlite3_stmt *stmt;
+
+    rc = exec_sql(handler, "BEGIN;");
+
+    if (rc != SQLITE_OK) {
+        return rc;
+    }
+
+    stmt = prepare_stmt(handler, STMT_REMOVE_WALLET_TRANSACTIONS);
+    if (stmt == NULL) {
+        exec_sql(handler, "ROLLBACK;");
+        return SQLITE_ERROR;
+    }
+    sqlite3_bind_int(stmt, 1, wallet->id);
+    rc = exec_stmt(handler, stmt);
+
+    if (rc == SQLITE_OK) {
+        stmt = prepare_stmt(handler, STMT_REMOVE_WALLET);
+        if (stmt == NULL) {
+            exec_sql(handler, "ROLLBACK;");
+            return SQLITE_ERROR;
+        }
+        sqlite3_bind_int(stmt, 1, wallet->id);
+        rc = exec_stmt(handler, stmt);
+    }
+
+    if (rc != SQLITE_OK) {
+        exec_sql(handler, "ROLLBACK;");
+        return rc;
+    }
+
+    return exec_sql(handler, "COMMIT;");
+}
+
+// remove_category deletes category from database.
+int remove_category(DB_Handler *handler, Category *category) {
+    int rc;
+    sqlite3_stmt *stmt;
+
+    rc = exec_sql(handler, "BEGIN;");
+
+    if (rc != SQLITE_OK) {
+        return rc;
+    }
+
+    stmt = prepare_stmt(handler, STMT_UNSET_CATEGORY);
+    if (stmt == NULL) {
+        exec_sql(handler, "ROLLBACK;");
+        return SQLITE_ERROR;
+    }
+    sqlite3_bind_int(stmt, 1, category->id);
+    rc = exec_stmt(handler, stmt);
+
+    if (rc == SQLITE_OK) {
+        stmt = prepare_stmt(handler, STMT_REMOVE_CATEGORY);
+        if (stmt == NULL) {
+            exec_sql(handler, "ROLLBACK;");
+            return SQLITE_ERROR;
+        }
+        sqlite3_bind_int(stmt, 1, category->id);
+        rc = exec_stmt(handler, stmt);
+    }
+
+    if (rc != SQLITE_OK) {
+        exec_sql(handler, "ROLLBACK;");
+        return rc;
+    }
+
+    return exec_sql(handler, "COMMIT;");
+}
+
+// remove_transaction removes transaction from database.
+int remove_transaction(DB_Handler *handler, Transaction *transaction) {
+    sqlite3_stmt *stmt;
+
+    stmt = prepare_stmt(handler, STMT_REMOVE_TRANSACTION);
+
+    if (stmt == NULL) {
+        return SQLITE_ERROR;
+    }
+
+    sqlite3_bind_int(stmt, 1, transaction->id);
+
+    return exec_stmt(handler, stmt);
+}
+
+// bind_match binds the filter of a bulk delete, up to last_id
+// unless it is 0.
+static void bind_match(sqlite3_stmt *stmt, Transaction *filter, const char *before, sqlite3_int64 last_id) {
+    if (filter->name[0] != '\0') {
+        sqlite3_bind_text(stmt, 1, filter->name, -1, SQLITE_STATIC);
+    }
+    if (before != NULL) {
+        sqlite3_bind_text(stmt, 2, before, -1, SQLITE_STATIC);
+    }
+    if (filter->wallet.id != 0) {
+        sqlite3_bind_int(stmt, 3, filter->wallet.id);
+    }
+    if (last_id != 0) {
+        sqlite3_bind_int64(stmt, 6, last_id);
+    }
+}
+
+// count_upto counts the transactions matching a filter up to last_id,
+// unless it is 0, and sets last_id to the last one.
+static unsigned int count_upto(DB_Handler *handler, Transaction *filter, const char *before, sqlite3_int64 *last_id) {
+    unsigned int count = 0;
+    sqlite3_stmt *stmt;
+
+    stmt = prepare_stmt(handler, STMT_COUNT_MATCHING);
+
+    if (stmt == NULL) {
+        return 0;
+    }
+
+    bind_match(stmt, filter, before, *last_id);
+
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        count = sqlite3_column_int(stmt, 0);
+        *last_id = sqlite3_column_int64(stmt, 1);
+    }
+
+    release_stmt(stmt);
+
+    return count;
+}
+
+// count_matching returns the number of transactions a bulk delete
+// with the same filter would remove. last_id is set to the last of
+// them, for remove_matching to remove no other.
+unsigned int count_matching(DB_Handler *handler, Transaction *filter, const char *before, sqlite3_int64 *last_id) {
+    *last_id = 0;
+
+    return count_upto(handler, filter, before, last_id);
+}
+
+// remove_chunk removes the next chunk of matching transactions
+// in its own transaction. last is the id the chunk starts after,
+// and is moved to the id it ended at. It returns SQLITE_DONE
+// when no transaction is left.
+static int remove_chunk(DB_Handler *handler, Transaction *filter, const char *before, sqlite3_int64 last_id, int chunk, sqlite3_int64 *last, unsigned int *deleted) {
+    int rc, changes;
+    sqlite3_int64 end = 0;
+    sqlite3_stmt *stmt;
+
+    rc = exec_sql(handler, "BEGIN IMMEDIATE;");
+
+    if (rc != SQLITE_OK) {
+        return rc;
+    }
+
+    stmt = prepare_stmt(handler, STMT_GET_CHUNK_END);
+    if (stmt == NULL) {
+        exec_sql(handler, "ROLLBACK;");
+        return SQLITE_ERROR;
+    }
+    bind_match(stmt, filter, before, last_id);
+    sqlite3_bind_int64(stmt, 4, *last);
+    sqlite3_bind_int(stmt, 5, chunk);
+
+    rc = sqlite3_step(stmt);
+    if (rc == SQLITE_ROW) {
+        if (sqlite3_column_type(stmt, 0) == SQLITE_NULL) {
+            rc = SQLITE_DONE;
+        } else {
+            end = sqlite3_column_int64(stmt, 0);
+            rc = SQLITE_OK;
+        }
+    }
+    release_stmt(stmt);
+
+    if (rc != SQLITE_OK) {
+        exec_sql(handler, "ROLLBACK;");
+        return rc;
+    }
+
+    stmt = prepare_stmt(handler, STMT_REMOVE_CHUNK);
+    if (stmt == NULL) {
+        exec_sql(handler, "ROLLBACK;");
+        return SQLITE_ERROR;
+    }
+    bind_match(stmt, filter, before, last_id);
+    sqlite3_bind_int64(stmt, 4, *last);
+    sqlite3_bind_int64(stmt, 5, end);
+    rc = exec_stmt(handler, stmt);
+
+    if (rc != SQLITE_OK) {
+        exec_sql(handler, "ROLLBACK;");
+        return rc;
+    }
+
+    changes = sqlite3_changes(handler->db);
+    rc = exec_sql(handler, "COMMIT;");
+
+    if (rc == SQLITE_OK) {
+        *deleted += changes;
+        *last = end;
+    }
+
+    return rc;
+}
+
+// remove_matching removes the transactions matching a name, an end
+// date and a wallet, each ignored when unset, chunk rows at a time.
+// Only the ones up to last_id, as counted by count_matching, go, so
+// rows added since the count are kept. Each chunk is committed on its
+// own, so the write lock and the WAL stay small however many rows go.
+// A failure keeps the chunks already committed, deleted tells how
+// many rows went.
+int remove_matching(DB_Handler *handler, Transaction *filter, const char *before, sqlite3_int64 last_id, int chunk, unsigned int *deleted, DB_Progress progress, void *udata) {
+    int rc;
+    unsigned int total;
+    sqlite3_int64 last = 0, counted = last_id;
+
+    *deleted = 0;
+
+    if (last_id == 0) {
+        return SQLITE_OK;
+    }
+
+    if (chunk < 1) {
+        chunk = DELETE_CHUNK;
+    }
+
+    total = count_upto(handler, filter, before, &counted);
+
+    while ((rc = remove_chunk(handler, filter, before, last_id, chunk, &last, deleted)) == SQLITE_OK) {
+        if (progress != NULL) {
+            progress(*deleted < total ? total - *deleted : 0, total, udata);
+        }
+    }
+
+    return rc == SQLITE_DONE ? SQLITE_OK : rc;
+}
+
+// count_records returns number of records in the table,
+// as counted by the triggers of the table.
+unsigned int count_records(DB_Handler *handler, RECORD_TYPES type) {
+    unsigned int count = 0;
+    sqlite3_stmt *stmt;
+
+    switch (type) {
+        case WALLET_TYPE:
+            stmt = prepare_stmt(handler, STMT_COUNT_WALLETS);
+            break;
+        case CATEGORY_TYPE:
+            stmt = prepare_stmt(handler, STMT_COUNT_CATEGORIES);
+            break;
+        case TRANSACTION_TYPE:
+            stmt = prepare_stmt(handler, STMT_COUNT_TRANSACTIONS);
+            break;
+        default:
+            return 0;
+    }
+
+    if (stmt == NULL) {
+        return 0;
+    }
+
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        count = sqlite3_column_int(stmt, 0);
+    }
+
+    release_stmt(stmt);
+
+    return count;
+}
+
+// has_records tells whether the table has any record,
+// stopping at the first row.
+int has_records(DB_Handler *handler, RECORD_TYPES type) {
+    int found;
+    sqlite3_stmt *stmt;
+
+    switch (type) {
+        case WALLET_TYPE:
+            stmt = prepare_stmt(handler, STMT_HAS_WALLETS);
+            break;
+        case CATEGORY_TYPE:
+            stmt = prepare_stmt(handler, STMT_HAS_CATEGORIES);
+            break;
+        case TRANSACTION_TYPE:
+            stmt = prepare_stmt(handler, STMT_HAS_TRANSACTIONS);
+            break;
+        default:
+            return 0;
+    }
+
+    if (stmt == NULL) {
+        return 0;
+    }
+
+    found = sqlite3_step(stmt) == SQLITE_ROW;
+
+    release_stmt(stmt);
+
+    return found;
+}
+
+// count_changes returns the number of rows inserted, updated or
+// deleted through the handler since it was connected.
+int count_changes(DB_Handler *handler) {
+    return sqlite3_total_changes(handler->db);
+}
+
+// count_rows returns the number of rows of wallets, categories,
+// transactions and the other records inserted, updated or deleted
+// through the handler since it was connected. Unlike count_changes,
+// rows written by triggers to keep counts, journals and totals
+// aren't counted.
+sqlite3_int64 count_rows(DB_Handler *handler) {
+    return handler->rows;
+}
+
+// parse_rule returns the rule called name, or -1.
+int parse_rule(const char *name) {
+    int i;
+
+    for (i = 0; i < NUM_RULES; i++) {
+        if (strcmp(rule_names[i], name) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// rule_name returns the name of a rule.
+const char *rule_name(RECURRING_RULE rule) {
+    return rule >= 0 && rule < NUM_RULES ? rule_names[rule] : "";
+}
+
+// days_from_civil returns the number of days from 1970-01-01.
+static long days_from_civil(long y, unsigned int m, unsigned int d) {
+    long era;
+    unsigned int yoe, doy, doe;
+
+    y -= m <= 2;
+    era = (y >= 0 ? y : y - 399) / 400;
+    yoe = (unsigned int) (y - era * 400);
+    doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+    return era * 146097 + (long) doe - 719468;
+}
+
+// civil_from_days is the inverse of days_from_civil.
+static void civil_from_days(long z, long *y, unsigned int *m, unsigned int *d) {
+    long era;
+    unsigned int doe, yoe, doy, mp;
+
+    z += 719468;
+    era = (z >= 0 ? z : z - 146096) / 146097;
+    doe = (unsigned int) (z - era * 146097);
+    yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    mp = (5 * doy + 2) / 153;
+    *d = doy - (153 * mp + 2) / 5 + 1;
+    *m = mp < 10 ? mp + 3 : mp - 9;
+    *y = (long) yoe + era * 400 + (*m <= 2);
+}
+
+// days_in_month returns the number of days of a month.
+static unsigned int days_in_month(long y, unsigned int m) {
+    static const unsigned int days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+    if (m == 2 && (y % 4 == 0 && (y % 100 != 0 || y % 400 == 0))) {
+        return 29;
+    }
+
+    return days[m - 1];
+}
+
+// occurrence_date writes the date of the nth occurrence of a
+// recurring transaction. Months and years are counted from the
+// start date and clamped to the end of shorter months, so the 31st
+// stays the last day of every month instead of drifting.
+static int occurrence_date(const Recurring *recurring, unsigned int n, char *date, size_t size) {
+    long y, months;
+    unsigned int m, d;
+
+    if (sscanf(recurring->start_date, "%4ld-%2u-%2u", &y, &m, &d) != 3 || m < 1 || m > 12 || d < 1) {
+        return SQLITE_MISMATCH;
+    }
+
+    switch (recurring->rule) {
+    case RULE_DAILY:
+    case RULE_WEEKLY:
+        civil_from_days(
+            days_from_civil(y, m, d) + (long) n * recurring->every * (recurring->rule == RULE_WEEKLY ? 7 : 1),
+            &y, &m, &d
+        );
+        break;
+    case RULE_MONTHLY:
+    case RULE_YEARLY:
+        months = (long) n * recurring->every * (recurring->rule == RULE_YEARLY ? 12 : 1);
+        months += y * 12 + (m - 1);
+        y = months / 12;
+        m = months % 12 + 1;
+        if (d > days_in_month(y, m)) {
+            d = days_in_month(y, m);
+        }
+        break;
+    default:
+        return SQLITE_MISMATCH;
+    }
+
+    snprintf(date, size, "%04ld-%02u-%02u", y, m, d);
+
+    return SQLITE_OK;
+}
+
+// add_recurring inserts a new recurring transaction template,
+// starting today if it has no start date.
+int add_recurring(DB_Handler *handler, Recurring *recurring) {
+    sqlite3_stmt *stmt;
+
+    stmt = prepare_stmt(handler, STMT_ADD_RECURRING);
+
+    if (stmt == NULL) {
+        return SQLITE_ERROR;
+    }
+
+    sqlite3_bind_text(stmt, 1, recurring->name, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, recurring->description, -1, SQLITE_STATIC);
+    sqlite3_bind_double(stmt, 3, recurring->amount);
+    sqlite3_bind_int(stmt, 4, recurring->wallet.id);
+    sqlite3_bind_int(stmt, 5, recurring->category.id);
+    sqlite3_bind_text(stmt, 6, rule_name(recurring->rule), -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 7, recurring->every);
+    if (recurring->start_date[0] != '\0') {
+        sqlite3_bind_text(stmt, 8, recurring->start_date, -1, SQLITE_STATIC);
+    } else {
+        sqlite3_bind_null(stmt, 8);
+    }
+
+    return exec_stmt(handler, stmt);
+}
+
+// read_recurring reads a row of STMT_GET_RECURRING.
+static void read_recurring(sqlite3_stmt *stmt, Recurring *recurring) {
+    recurring->id = sqlite3_column_int(stmt, 0);
+    copy_text(recurring->name, sizeof(recurring->name), sqlite3_column_text(stmt, 1));
+    copy_text(recurring->description, sizeof(recurring->description), sqlite3_column_text(stmt, 2));
+    recurring->amount = sqlite3_column_double(stmt, 3);
+    recurring->wallet.id = sqlite3_column_int(stmt, 4);
+    copy_text(recurring->wallet.name, sizeof(recurring->wallet.name), sqlite3_column_text(stmt, 5));
+    recurring->wallet.balance = 0.0;
+    recurring->category.id = sqlite3_column_int(stmt, 6);
+    copy_text(recurring->category.name, sizeof(recurring->category.name), sqlite3_column_text(stmt, 7));
+    recurring->category.amount = 0.0;
+    recurring->rule = parse_rule((const char *) sqlite3_column_text(stmt, 8));
+    recurring->every = sqlite3_column_int(stmt, 9);
+    copy_text(recurring->start_date, sizeof(recurring->start_date), sqlite3_column_text(stmt, 10));
+    recurring->occurrences = sqlite3_column_int(stmt, 11);
+
+    if (occurrence_date(recurring, recurring->occurrences, recurring->next_date, sizeof(recurring->next_date)) != SQLITE_OK) {
+        recurring->next_date[0] = '\0';
+    }
+}
+
+// get_recurring retrieves recurring transaction templates and
+// put them into a linked list.
+Queue *get_recurring(DB_Handler *handler, Recurring *recurring) {
+    Queue origin, *last, *record;
+    sqlite3_stmt *stmt;
+
+    origin.next = NULL;
+    last = &origin;
+
+    stmt = prepare_stmt(handler, STMT_GET_RECURRING);
+
+    if (stmt == NULL) {
+        return NULL;
+    }
+
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        const unsigned char *name = sqlite3_column_text(stmt, 1);
+
+        // Filter
+        if (recurring != NULL && recurring->name[0] != '\0') {
+            if (name == NULL || strcmp((const char *) name, recurring->name) != 0) {
+                continue;
+            }
+        }
+
+        record = new_record();
+
+        read_recurring(stmt, &record->record.recurring);
+        record->next = NULL;
+
+        last->next = record;
+        last = record;
+    }
+
+    release_stmt(stmt);
+
+    return origin.next;
+}
+
+// remove_recurring deletes a recurring transaction template.
+// Transactions already materialized are kept.
+int remove_recurring(DB_Handler *handler, Recurring *recurring) {
+    sqlite3_stmt *stmt;
+
+    stmt = prepare_stmt(handler, STMT_REMOVE_RECURRING);
+
+    if (stmt == NULL) {
+        return SQLITE_ERROR;
+    }
+
+    sqlite3_bind_int(stmt, 1, recurring->id);
+
+    return exec_stmt(handler, stmt);
+}
+
+// materialize_template inserts the occurrences of a template due
+// until the given date and records how many there are now.
+static int materialize_template(DB_Handler *handler, Recurring *recurring, const char *until, unsigned int *created) {
+    int rc = SQLITE_OK;
+    unsigned int n;
+    char date[11];
+    sqlite3_stmt *stmt;
+
+    stmt = prepare_stmt(handler, STMT_ADD_RECURRING_TRANSACTION);
+
+    if (stmt == NULL) {
+        return SQLITE_ERROR;
+    }
+
+    sqlite3_bind_text(stmt, 1, recurring->name, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, recurring->description, -1, SQLITE_STATIC);
+    sqlite3_bind_double(stmt, 3, recurring->amount);
+    sqlite3_bind_int(stmt, 4, recurring->wallet.id);
+    sqlite3_bind_int(stmt, 5, recurring->category.id);
+    sqlite3_bind_int(stmt, 7, recurring->id);
+
+    for (n = recurring->occurrences; rc == SQLITE_OK; n++) {
+        rc = occurrence_date(recurring, n, date, sizeof(date));
+
+        if (rc != SQLITE_OK || strcmp(date, until) > 0) {
+            break;
+        }
+
+        sqlite3_bind_text(stmt, 6, date, -1, SQLITE_STATIC);
+
+        if (sqlite3_step(stmt) != SQLITE_DONE) {
+            log_warn("%s", sqlite3_errmsg(handler->db));
+            rc = SQLITE_ERROR;
+        } else {
+            // Occurrences materialized before are ignored
+            if (sqlite3_changes(handler->db) > 0) {
+                *created += 1;
+                check_budgets(handler, sqlite3_last_insert_rowid(handler->db));
+            }
+        }
+
+        sqlite3_reset(stmt);
+    }
+
+    release_stmt(stmt);
+
+    if (rc != SQLITE_OK || n == recurring->occurrences) {
+        return rc;
+    }
+
+    stmt = prepare_stmt(handler, STMT_UPDATE_RECURRING);
+
+    if (stmt == NULL) {
+        return SQLITE_ERROR;
+    }
 
-// connect establishes a connection to SQLite database.
-DB_Handler *connect(const char *name) {
+    sqlite3_bind_int(stmt, 1, n);
+    sqlite3_bind_int(stmt, 2, recurring->id);
+
+    return exec_stmt(handler, stmt);
+}
+
+// materialize_recurring inserts every occurrence of the recurring
+// transactions due until the given date, or today if it is NULL,
+// in a single transaction. Running it again for the same dates
+// inserts nothing, so it is safe to retry.
+int materialize_recurring(DB_Handler *handler, const char *until, unsigned int *created) {
     int rc;
+    char today[11];
+    Recurring recurring;
+    sqlite3_stmt *stmt;
 
-    if (name == NULL || name[0] == '\0') {
-        name = DB_NAME;
-    }
+    *created = 0;
 
-    DB_Handler *handler = (DB_Handler *)malloc(sizeof(DB_Handler));
-    strcpy(handler->db_name, name);
+    if (until == NULL) {
+        utc_today(today, sizeof(today));
+        until = today;
+    }
 
-    rc = sqlite3_open(name, &db);
+    rc = exec_sql(handler, "BEGIN IMMEDIATE;");
 
     if (rc != SQLITE_OK) {
-        handler->db = NULL;
-        sqlite3_close(db);
-        return handler;
+        return rc;
     }
 
-    handler->db = db;
+    stmt = prepare_stmt(handler, STMT_GET_RECURRING);
 
-    return handler;
+    if (stmt == NULL) {
+        exec_sql(handler, "ROLLBACK;");
+        return SQLITE_ERROR;
+    }
+
+    while (rc == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW) {
+        read_recurring(stmt, &recurring);
+        rc = materialize_template(handler, &recurring, until, created);
+    }
+
+    release_stmt(stmt);
+
+    if (rc != SQLITE_OK) {
+        exec_sql(handler, "ROLLBACK;");
+        *created = 0;
+        return rc;
+    }
+
+    return exec_sql(handler, "COMMIT;");
 }
 
-// init_db creates three tables : wallets, categories and transactions.
-// This also creates indexes.
-int init_db() {
-    char *sql;
-    char *zErrMsg = 0;
+// add_budget inserts a budget, whose running totals are summed by a
+// trigger from the transactions already in the ledger. Wallet or
+// category ids of 0 count every wallet or category.
+int add_budget(DB_Handler *handler, Budget *budget) {
     int rc;
+    sqlite3_stmt *stmt;
 
-    sql = "BEGIN;" \
-
-        "CREATE TABLE IF NOT EXISTS wallets(" \
-        "id INTEGER PRIMARY KEY AUTOINCREMENT NOT NULL," \
-        "name VARCHAR(32) UNIQUE NOT NULL" \
-        ");" \
-
-        "CREATE TABLE IF NOT EXISTS categories(" \
-        "id INTEGER PRIMARY KEY AUTOINCREMENT NOT NULL," \
-        "name VARCHAR(32) UNIQUE NOT NULL" \
-        ");" \
-
-        "CREATE TABLE IF NOT EXISTS transactions(" \
-        "id INTEGER PRIMARY KEY AUTOINCREMENT NOT NULL," \
-        "name VARCHAR(64) NOT NULL," \
-        "description TEXT," \
-        "amount REAL NOT NULL," \
-        "wallet_id INTEGER NOT NULL," \
-        "category_id INTEGER," \
-        "FOREIGN KEY(wallet_id) REFERENCES wallets(id)," \
-        "FOREIGN KEY(category_id) REFERENCES categories(id)" \
-        ");" \
-
-        "CREATE INDEX IF NOT EXISTS idx_wallet ON wallets(" \
-        "id," \
-        "name" \
-        ");" \
-
-        "CREATE INDEX IF NOT EXISTS idx_category ON categories(" \
-        "id," \
-        "name" \
-        ");" \
-
-        "CREATE INDEX IF NOT EXISTS idx_transaction ON transactions(" \
-        "name," \
-        "amount,"\
-        "wallet_id," \
-        "category_id" \
-        ");" \
+    stmt = prepare_stmt(handler, STMT_ADD_BUDGET);
 
-        "COMMIT;";
-    
-    rc = sqlite3_exec(db, sql, NULL, 0, &zErrMsg);
+    if (stmt == NULL) {
+        return SQLITE_ERROR;
+    }
 
-    if (rc != SQLITE_OK) {
-        log_fatal("%s", zErrMsg);
+    if (budget->wallet.id != 0) {
+        sqlite3_bind_int(stmt, 1, budget->wallet.id);
     }
+    if (budget->category.id != 0) {
+        sqlite3_bind_int(stmt, 2, budget->category.id);
+    }
+    sqlite3_bind_text(stmt, 3, rule_name(budget->period), -1, SQLITE_STATIC);
+    sqlite3_bind_double(stmt, 4, budget->limit);
+    sqlite3_bind_double(stmt, 5, budget->warn);
 
-    sqlite3_free(zErrMsg);
+    rc = exec_stmt(handler, stmt);
+
+    if (rc == SQLITE_OK) {
+        budget->id = sqlite3_last_insert_rowid(handler->db);
+    }
 
     return rc;
 }
 
-// add_wallet inserts a new wallet into the database.
-int add_wallet(Wallet *wallet) {
-    char *sql;
-    char *zErrMsg = 0;
+// get_budgets retrieves the budgets and their spending over the
+// period containing date, or today if it is NULL.
+Queue *get_budgets(DB_Handler *handler, const char *date) {
+    Queue origin, *last, *record;
+    sqlite3_stmt *stmt;
+
+    origin.next = NULL;
+    last = &origin;
+
+    stmt = prepare_stmt(handler, STMT_GET_BUDGETS);
+
+    if (stmt == NULL) {
+        return NULL;
+    }
+
+    if (date != NULL) {
+        sqlite3_bind_text(stmt, 1, date, -1, SQLITE_STATIC);
+    }
+
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        record = new_record();
+
+        read_budget(stmt, &record->record.budget);
+        record->next = NULL;
+
+        last->next = record;
+        last = record;
+    }
+
+    release_stmt(stmt);
+
+    return origin.next;
+}
+
+// remove_budget deletes a budget along with its running totals.
+int remove_budget(DB_Handler *handler, Budget *budget) {
+    sqlite3_stmt *stmt;
+
+    stmt = prepare_stmt(handler, STMT_REMOVE_BUDGET);
+
+    if (stmt == NULL) {
+        return SQLITE_ERROR;
+    }
+
+    sqlite3_bind_int(stmt, 1, budget->id);
+
+    return exec_stmt(handler, stmt);
+}
+
+// set_budget_hook sets the function called when a new transaction
+// crosses the threshold or the limit of a budget, NULL for none.
+void set_budget_hook(DB_Handler *handler, Budget_Callback hook, void *udata) {
+    handler->budget_hook = hook;
+    handler->budget_udata = udata;
+}
+
+// set_rate sets the exchange rate of a currency from a date on,
+// today if it is empty, replacing the rate set for that date.
+int set_rate(DB_Handler *handler, FX_Rate *rate) {
+    sqlite3_stmt *stmt;
+
+    stmt = prepare_stmt(handler, STMT_SET_RATE);
+
+    if (stmt == NULL) {
+        return SQLITE_ERROR;
+    }
+
+    sqlite3_bind_text(stmt, 1, rate->currency, -1, SQLITE_STATIC);
+    if (rate->date[0] != '\0') {
+        sqlite3_bind_text(stmt, 2, rate->date, -1, SQLITE_STATIC);
+    }
+    sqlite3_bind_double(stmt, 3, rate->rate);
+
+    return exec_stmt(handler, stmt);
+}
+
+// get_rates retrieves the exchange rates of a currency, or of every
+// currency if it is NULL or empty, by currency and date.
+Queue *get_rates(DB_Handler *handler, const char *currency) {
+    Queue origin, *last, *record;
+    sqlite3_stmt *stmt;
+
+    origin.next = NULL;
+    last = &origin;
+
+    stmt = prepare_stmt(handler, STMT_GET_RATES);
+
+    if (stmt == NULL) {
+        return NULL;
+    }
+
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        const unsigned char *code = sqlite3_column_text(stmt, 0);
+
+        // Filter
+        if (currency != NULL && currency[0] != '\0') {
+            if (code == NULL || strcmp((const char *) code, currency) != 0) {
+                continue;
+            }
+        }
+
+        record = new_record();
+
+        copy_text(record->record.rate.currency, sizeof(record->record.rate.currency), code);
+        copy_text(record->record.rate.date, sizeof(record->record.rate.date), sqlite3_column_text(stmt, 1));
+        record->record.rate.rate = sqlite3_column_double(stmt, 2);
+        record->next = NULL;
+
+        last->next = record;
+        last = record;
+    }
+
+    release_stmt(stmt);
+
+    return origin.next;
+}
+
+// remove_rate deletes the exchange rate of a currency set for a date,
+// or every rate of the currency if the date is empty.
+int remove_rate(DB_Handler *handler, FX_Rate *rate) {
+    sqlite3_stmt *stmt;
+
+    stmt = prepare_stmt(handler, STMT_REMOVE_RATE);
+
+    if (stmt == NULL) {
+        return SQLITE_ERROR;
+    }
+
+    sqlite3_bind_text(stmt, 1, rate->currency, -1, SQLITE_STATIC);
+    if (rate->date[0] != '\0') {
+        sqlite3_bind_text(stmt, 2, rate->date, -1, SQLITE_STATIC);
+    }
+
+    return exec_stmt(handler, stmt);
+}
+
+// run_archive_stmt runs a cached archiving statement over the
+// dates [start, end).
+static int run_archive_stmt(DB_Handler *handler, DB_STMT id, const char *start, const char *end) {
+    sqlite3_stmt *stmt;
+
+    stmt = prepare_stmt(handler, id);
+
+    if (stmt == NULL) {
+        return SQLITE_ERROR;
+    }
+
+    if (start != NULL) {
+        sqlite3_bind_text(stmt, 1, start, -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 2, end, -1, SQLITE_STATIC);
+    }
+
+    return exec_stmt(handler, stmt);
+}
+
+// archive_year moves the transactions of a year dated before the
+// given date into the archive of that year, and folds them into the
+// opening balances. Everything happens in one transaction across
+// both databases, which can be retried if it fails.
+static int archive_year(DB_Handler *handler, int year, const char *before, unsigned int *moved) {
     int rc;
+    int rows = 0;
+    int currency;
+    char path[DB_NAME_SIZE + 32];
+    char start[24], end[24];
+    char *sql;
+    sqlite3_stmt *stmt;
 
-    sql = sqlite3_mprintf("INSERT INTO wallets(name)" \
-        "VALUES('%q');",
-        wallet->name
-    );
-    
-    rc = sqlite3_exec(db, sql, NULL, 0, &zErrMsg);
+    snprintf(path, sizeof(path), "%s%s%d", handler->db_name, ARCHIVE_SUFFIX, year);
+    snprintf(start, sizeof(start), "%04d-01-01", year);
+    snprintf(end, sizeof(end), "%04d-01-01", year + 1);
 
-    sqlite3_free(sql);
+    if (strcmp(before, end) < 0) {
+        snprintf(end, sizeof(end), "%s", before);
+    }
+
+    rc = attach_archive(handler, path, "archive");
 
     if (rc != SQLITE_OK) {
-        log_warn("%s", zErrMsg);
+        return rc;
     }
 
-    sqlite3_free(zErrMsg);
+    rc = exec_sql(handler, archive_schema);
+
+    if (rc == SQLITE_OK) {
+        rc = upgrade_archive(handler, "archive", &currency);
+    }
+
+    if (rc == SQLITE_OK) {
+        rc = exec_sql(handler, "BEGIN IMMEDIATE;");
+    }
+
+    if (rc != SQLITE_OK) {
+        detach_archive(handler, "archive");
+        return rc;
+    }
+
+    sql = sqlite3_mprintf(
+        "INSERT OR REPLACE INTO archive.transactions(" ARCHIVE_COLUMNS ") " \
+        "SELECT " ARCHIVE_COLUMNS " FROM main.transactions WHERE " \
+        "opening = 0 AND date >= %Q AND date < %Q;",
+        start, end
+    );
+    rc = exec_sql(handler, sql);
+    sqlite3_free(sql);
+
+    if (rc == SQLITE_OK) {
+        rows = sqlite3_changes(handler->db);
+        rc = run_archive_stmt(handler, STMT_ADD_OPENING_BALANCES, start, end);
+    }
+    // Budgets keep the spending aside, the flag stops the delete
+    // trigger from taking it out of their totals
+    if (rc == SQLITE_OK) {
+        rc = run_archive_stmt(handler, STMT_ARCHIVE_BUDGETS, start, end);
+    }
+    if (rc == SQLITE_OK) {
+        rc = exec_sql(handler, "INSERT INTO meta(key, value) VALUES('archiving', 1);");
+    }
+    if (rc == SQLITE_OK) {
+        rc = run_archive_stmt(handler, STMT_REMOVE_ARCHIVED, start, end);
+    }
+    if (rc == SQLITE_OK) {
+        rc = exec_sql(handler, "DELETE FROM meta WHERE key = 'archiving';");
+    }
+    if (rc == SQLITE_OK) {
+        rc = run_archive_stmt(handler, STMT_SET_OPENING_BALANCES, NULL, NULL);
+    }
+    if (rc == SQLITE_OK) {
+        stmt = prepare_stmt(handler, STMT_ADD_ARCHIVE);
+        if (stmt == NULL) {
+            rc = SQLITE_ERROR;
+        } else {
+            sqlite3_bind_int(stmt, 1, year);
+            sqlite3_bind_text(stmt, 2, path, -1, SQLITE_STATIC);
+            sqlite3_bind_int(stmt, 3, rows);
+            sqlite3_bind_text(stmt, 4, end, -1, SQLITE_STATIC);
+            rc = exec_stmt(handler, stmt);
+        }
+    }
+
+    if (rc == SQLITE_OK) {
+        rc = exec_sql(handler, "COMMIT;");
+    } else {
+        exec_sql(handler, "ROLLBACK;");
+    }
+
+    detach_archive(handler, "archive");
+
+    if (rc == SQLITE_OK) {
+        *moved += rows;
+    }
 
     return rc;
 }
 
-// add_category inserts a new category into the database.
-int add_category(Category *category) {
-    char *sql;
-    char *zErrMsg = 0;
-    int rc;
+// archive_transactions moves every transaction dated before the given
+// date into per-year archive databases, leaving one opening balance
+// per wallet and category in their place. Balances and overviews are
+// unchanged, and the archives stay reachable through
+// iterate_transactions_between.
+int archive_transactions(DB_Handler *handler, const char *before, unsigned int *moved, unsigned int *years) {
+    int rc = SQLITE_OK;
+    int count = 0, capacity = 16;
+    int i;
+    int *list;
+    sqlite3_int64 batch;
+    sqlite3_stmt *stmt;
 
-    sql = sqlite3_mprintf("INSERT INTO categories(name)" \
-        "VALUES('%q');",
-        category->name
-    );
-    
-    rc = sqlite3_exec(db, sql, NULL, 0, &zErrMsg);
+    *moved = 0;
+    *years = 0;
 
-    sqlite3_free(sql);
+    list = (int *) malloc(capacity * sizeof(int));
 
-    if (rc != SQLITE_OK) {
-        log_warn("%s", zErrMsg);
+    if (!list) {
+        log_fatal("Memory allocation error");
+        exit(1);
     }
 
-    sqlite3_free(zErrMsg);
+    stmt = prepare_stmt(handler, STMT_GET_ARCHIVE_YEARS);
+
+    if (stmt == NULL) {
+        free(list);
+        return SQLITE_ERROR;
+    }
+
+    sqlite3_bind_text(stmt, 1, before, -1, SQLITE_STATIC);
+
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        if (count == capacity) {
+            capacity *= 2;
+            list = (int *) realloc(list, capacity * sizeof(int));
+            if (!list) {
+                log_fatal("Memory allocation error");
+                exit(1);
+            }
+        }
+        list[count++] = sqlite3_column_int(stmt, 0);
+    }
+
+    release_stmt(stmt);
+
+    // Archived transactions leave the journal behind, undoing
+    // older changes would bring them back twice.
+    batch = handler->change_batch;
+    handler->change_batch = 0;
+
+    for (i = 0; i < count && rc == SQLITE_OK; i++) {
+        rc = archive_year(handler, list[i], before, moved);
+        if (rc == SQLITE_OK) {
+            (*years)++;
+        }
+    }
+
+    handler->change_batch = batch;
+
+    if (*moved > 0) {
+        stmt = prepare_stmt(handler, STMT_CLEAR_CHANGES);
+        if (stmt != NULL) {
+            exec_stmt(handler, stmt);
+        }
+    }
+
+    free(list);
 
     return rc;
 }
 
-// add_transaction inserts a new transaction into the database.
-int add_transaction(Transaction *transaction) {
-    char *sql;
-    char *zErrMsg = 0;
+// iterate_change_log calls back for every event of the change log
+// after since, in order. Events are read a page at a time so no read
+// transaction is held for long. last is set to the seq of the last
+// event called back, or since if there is none.
+int iterate_change_log(DB_Handler *handler, sqlite3_int64 since, Change_Callback callback, void *udata, sqlite3_int64 *last) {
+    int rc, rows, stop = 0;
+    Change_Event event;
+    sqlite3_stmt *stmt;
+
+    *last = since;
+
+    stmt = prepare_stmt(handler, STMT_GET_CHANGE_LOG);
+
+    if (stmt == NULL) {
+        return SQLITE_ERROR;
+    }
+
+    do {
+        rows = 0;
+
+        sqlite3_bind_int64(stmt, 1, *last);
+        sqlite3_bind_int(stmt, 2, CHANGE_LOG_PAGE);
+
+        while (!stop && (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+            event.seq = sqlite3_column_int64(stmt, 0);
+            copy_text(event.time, sizeof(event.time), sqlite3_column_text(stmt, 1));
+            copy_text(event.op, sizeof(event.op), sqlite3_column_text(stmt, 2));
+            copy_text(event.table, sizeof(event.table), sqlite3_column_text(stmt, 3));
+            event.row_id = sqlite3_column_int64(stmt, 4);
+            event.has_transaction = sqlite3_column_type(stmt, 5) != SQLITE_NULL;
+
+            if (event.has_transaction) {
+                event.transaction.id = sqlite3_column_int(stmt, 5);
+                copy_text(event.transaction.name, sizeof(event.transaction.name), sqlite3_column_text(stmt, 6));
+                copy_text(event.transaction.description, sizeof(event.transaction.description), sqlite3_column_text(stmt, 7));
+                event.transaction.amount = sqlite3_column_double(stmt, 8);
+                event.transaction.wallet.id = sqlite3_column_int(stmt, 9);
+                copy_text(event.transaction.wallet.name, sizeof(event.transaction.wallet.name), sqlite3_column_text(stmt, 10));
+                event.transaction.category.id = sqlite3_column_int(stmt, 11);
+                copy_text(event.transaction.category.name, sizeof(event.transaction.category.name), sqlite3_column_text(stmt, 12));
+                copy_text(event.transaction.date, sizeof(event.transaction.date), sqlite3_column_text(stmt, 13));
+                copy_text(event.transaction.currency, sizeof(event.transaction.currency), sqlite3_column_text(stmt, 14));
+            }
+
+            *last = event.seq;
+            rows++;
+
+            stop = callback(&event, udata);
+        }
+
+        release_stmt(stmt);
+
+        // Busy is left to the caller to retry
+        if (!stop && rc != SQLITE_DONE) {
+            if (rc != SQLITE_BUSY) {
+                log_warn("%s", sqlite3_errmsg(handler->db));
+            }
+            return rc;
+        }
+    } while (!stop && rows == CHANGE_LOG_PAGE);
+
+    return SQLITE_OK;
+}
+
+// prune_change_log removes the events up to seq, once every
+// consumer has read them.
+int prune_change_log(DB_Handler *handler, sqlite3_int64 seq, unsigned int *pruned) {
     int rc;
+    sqlite3_stmt *stmt;
 
-    sql = sqlite3_mprintf("INSERT INTO transactions(" \
-        "name," \
-        "description," \
-        "amount," \
-        "wallet_id," \
-        "category_id)" \
-        "VALUES(" \
-        "'%q'," \
-        "'%q'," \
-        "%lf," \
-        "%d," \
-        "%d" \
-        ");",
-        transaction->name,
-        transaction->description,
-        transaction->amount,
-        transaction->wallet.id,
-        transaction->category.id
-    );
-    
-    rc = sqlite3_exec(db, sql, NULL, 0, &zErrMsg);
+    *pruned = 0;
 
-    sqlite3_free(sql);
+    stmt = prepare_stmt(handler, STMT_PRUNE_CHANGE_LOG);
 
-    if (rc != SQLITE_OK) {
-        log_warn("%s", zErrMsg);
+    if (stmt == NULL) {
+        return SQLITE_ERROR;
     }
 
-    sqlite3_free(zErrMsg);
+    sqlite3_bind_int64(stmt, 1, seq);
+
+    rc = exec_stmt(handler, stmt);
+
+    if (rc == SQLITE_OK) {
+        *pruned = sqlite3_changes(handler->db);
+    }
 
     return rc;
 }
 
-// get_wallets retrieves wallets and put them into
-// a linked list.
-Queue *get_wallets(Wallet *wallet) {
-    char *sql;
+// data_version reads a number which changes whenever another
+// connection commits to the database.
+int data_version(DB_Handler *handler, int *version) {
     int rc;
-    Queue *origin, *last;
     sqlite3_stmt *stmt;
 
-    origin = NULL;
+    stmt = prepare_stmt(handler, STMT_DATA_VERSION);
+
+    if (stmt == NULL) {
+        return SQLITE_ERROR;
+    }
+
+    rc = sqlite3_step(stmt);
+
+    if (rc == SQLITE_ROW) {
+        *version = sqlite3_column_int(stmt, 0);
+        rc = SQLITE_OK;
+    }
+
+    release_stmt(stmt);
+
+    return rc;
+}
+
+// prepare_change_stmts prepares, for every journaled table, the
+// statements inserting a packed row and removing a row by id.
+static int prepare_change_stmts(DB_Handler *handler, sqlite3_stmt **inserts, sqlite3_stmt **removes) {
+    int rc = SQLITE_OK, i;
+    char *sql, *params;
+
+    for (i = 0; i < NUM_CHANGE_TABLES && rc == SQLITE_OK; i++) {
+        params = column_list(":", change_tables[i][1]);
+        sql = sqlite3_mprintf("INSERT INTO main.%s(%s) VALUES(%s);",
+            change_tables[i][0], change_tables[i][1], params);
+        sqlite3_free(params);
+
+        if (sql == NULL) {
+            log_fatal("Memory allocation error");
+            exit(1);
+        }
+
+        rc = sqlite3_prepare_v2(handler->db, sql, -1, &inserts[i], NULL);
+        sqlite3_free(sql);
+
+        if (rc != SQLITE_OK) {
+            break;
+        }
+
+        sql = sqlite3_mprintf("DELETE FROM main.%s WHERE id = ?;", change_tables[i][0]);
+
+        if (sql == NULL) {
+            log_fatal("Memory allocation error");
+            exit(1);
+        }
+
+        rc = sqlite3_prepare_v2(handler->db, sql, -1, &removes[i], NULL);
+        sqlite3_free(sql);
+    }
+
+    if (rc != SQLITE_OK) {
+        log_warn("%s", sqlite3_errmsg(handler->db));
+    }
+
+    return rc;
+}
+
+// apply_packed runs a statement with the row packed in a column
+// of the journal, if the column isn't NULL.
+static int apply_packed(DB_Handler *handler, sqlite3_stmt *stmt, sqlite3_stmt *change, int column) {
+    int rc;
+    const unsigned char *row;
+
+    if (sqlite3_column_type(change, column) == SQLITE_NULL) {
+        return SQLITE_OK;
+    }
+
+    row = (const unsigned char *) sqlite3_column_blob(change, column);
+
+    if (change_bind(stmt, row, sqlite3_column_bytes(change, column)) < 0) {
+        log_warn("Malformed row in the change journal");
+        return SQLITE_CORRUPT;
+    }
+
+    rc = sqlite3_step(stmt);
+
+    if (rc == SQLITE_DONE) {
+        rc = SQLITE_OK;
+    } else {
+        log_warn("%s", sqlite3_errmsg(handler->db));
+    }
+
+    release_stmt(stmt);
+
+    return rc;
+}
 
-    sql = "SELECT wallets.id," \
-        "wallets.name," \
-        "SUM(transactions.amount) AS balance " \
-        "FROM wallets " \
-        "LEFT JOIN transactions ON wallets.id = transactions.wallet_id " \
-        "GROUP BY wallets.name " \
-        "ORDER BY wallets.id ASC;";
+// apply_batch undoes or redoes the changes of a batch, the last
+// one first when undoing.
+static int apply_batch(DB_Handler *handler, int undo, sqlite3_int64 batch, sqlite3_stmt **inserts, sqlite3_stmt **removes, unsigned int *rows) {
+    int rc = SQLITE_OK, tbl;
+    // Undoing removes the new row and puts the old one back
+    int drop = undo ? 2 : 1;
+    int put = undo ? 1 : 2;
+    sqlite3_stmt *stmt;
 
-    rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+    stmt = prepare_stmt(handler, undo ? STMT_GET_UNDO_CHANGES : STMT_GET_REDO_CHANGES);
 
-    if (rc != SQLITE_OK) {
-        return origin;
+    if (stmt == NULL) {
+        return SQLITE_ERROR;
     }
 
-    while (sqlite3_step(stmt) != SQLITE_DONE) {
-        unsigned int id = sqlite3_column_int(stmt, 0);
-        const char *name = (const char *) sqlite3_column_text(stmt, 1);
-        double balance = sqlite3_column_double(stmt, 2);
+    sqlite3_bind_int64(stmt, 1, batch);
 
-        // Filter
-        if (wallet != NULL && wallet->name[0] != '\0') {
-            if (strcmp(name, wallet->name) != 0 && id != wallet->id) {
-                continue;
-            }
+    while (rc == SQLITE_OK && (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        tbl = sqlite3_column_int(stmt, 0);
+
+        if (tbl < 0 || tbl >= NUM_CHANGE_TABLES) {
+            log_warn("Unknown table %d in the change journal", tbl);
+            rc = SQLITE_CORRUPT;
+            break;
         }
 
-        Queue *record = (Queue *) malloc(sizeof(Queue));
+        rc = apply_packed(handler, removes[tbl], stmt, drop);
 
-        if (!record) {
-            log_fatal("Memory allocation error");
-            exit(1);
+        if (rc == SQLITE_OK) {
+            rc = apply_packed(handler, inserts[tbl], stmt, put);
         }
 
-        record->record.wallet.id = id;
-        if (name != NULL) {
-            strcpy(record->record.wallet.name, name);
-        } else {
-            record->record.wallet.name[0] = '\0';
+        if (rc == SQLITE_OK) {
+            (*rows)++;
         }
-        record->record.wallet.balance = balance;
-        record->next = NULL;
+    }
 
-        if (origin != NULL) {
-            last->next = record;
-            last = record;
-        } else {
-            origin = record;
-            last = record;
+    release_stmt(stmt);
+
+    if (rc == SQLITE_DONE) {
+        stmt = prepare_stmt(handler, STMT_SET_UNDONE);
+        if (stmt == NULL) {
+            return SQLITE_ERROR;
         }
+        sqlite3_bind_int(stmt, 1, undo);
+        sqlite3_bind_int64(stmt, 2, batch);
+        rc = exec_stmt(handler, stmt);
     }
 
-    sqlite3_finalize(stmt);
-
-    return origin;
+    return rc;
 }
 
-// get_categories retrieves categories and put them into
-// a linked list.
-Queue *get_categories(Category *category) {
-    char *sql;
-    int rc;
-    Queue *origin, *last;
+// apply_batches undoes the last n batches of changes, or redoes
+// the first n undone ones, in a single transaction. batches and
+// rows tell how many batches and changes were applied.
+static int apply_batches(DB_Handler *handler, int undo, int n, unsigned int *batches, unsigned int *rows) {
+    int rc, i, count = 0;
+    sqlite3_int64 saved, *list;
     sqlite3_stmt *stmt;
+    sqlite3_stmt *inserts[NUM_CHANGE_TABLES] = {NULL};
+    sqlite3_stmt *removes[NUM_CHANGE_TABLES] = {NULL};
 
-    origin = NULL;
+    *batches = 0;
+    *rows = 0;
 
-    sql = "SELECT categories.id," \
-        "categories.name " \
-        "FROM categories;";
+    if (n < 1) {
+        return SQLITE_OK;
+    }
+
+    list = (sqlite3_int64 *) malloc(n * sizeof(sqlite3_int64));
+
+    if (!list) {
+        log_fatal("Memory allocation error");
+        exit(1);
+    }
 
-    rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+    rc = exec_sql(handler, "BEGIN IMMEDIATE;");
 
     if (rc != SQLITE_OK) {
-        return origin;
+        free(list);
+        return rc;
     }
 
-    while (sqlite3_step(stmt) != SQLITE_DONE) {
-        unsigned int id = sqlite3_column_int(stmt, 0);
-        const char *name = (const char *) sqlite3_column_text(stmt, 1);
+    // Applying changes must not journal them again
+    saved = handler->change_batch;
+    handler->change_batch = 0;
 
-        // Filter
-        if (category != NULL && category->name[0] != '\0') {
-            if (strcmp(name, category->name) != 0 && id != category->id) {
-                continue;
-            }
-        }
+    stmt = prepare_stmt(handler, STMT_PURGE_REDO);
+    rc = stmt != NULL ? exec_stmt(handler, stmt) : SQLITE_ERROR;
 
-        Queue *record = (Queue *) malloc(sizeof(Queue));
+    if (rc == SQLITE_OK) {
+        stmt = prepare_stmt(handler, undo ? STMT_GET_UNDO_BATCHES : STMT_GET_REDO_BATCHES);
+        rc = stmt != NULL ? SQLITE_OK : SQLITE_ERROR;
+    }
 
-        if (!record) {
-            log_fatal("Memory allocation error");
-            exit(1);
+    if (rc == SQLITE_OK) {
+        sqlite3_bind_int(stmt, 1, n);
+        while (count < n && sqlite3_step(stmt) == SQLITE_ROW) {
+            list[count++] = sqlite3_column_int64(stmt, 0);
         }
+        release_stmt(stmt);
+    }
 
-        record->record.category.id = id;
-        if (name != NULL) {
-            strcpy(record->record.category.name, name);
-        } else {
-            record->record.category.name[0] = '\0';
-        }
-        record->next = NULL;
+    if (rc == SQLITE_OK && count > 0) {
+        rc = prepare_change_stmts(handler, inserts, removes);
+    }
 
-        if (origin != NULL) {
-            last->next = record;
-            last = record;
-        } else {
-            origin = record;
-            last = record;
-        }
+    for (i = 0; i < count && rc == SQLITE_OK; i++) {
+        rc = apply_batch(handler, undo, list[i], inserts, removes, rows);
     }
 
-    sqlite3_finalize(stmt);
+    for (i = 0; i < NUM_CHANGE_TABLES; i++) {
+        sqlite3_finalize(inserts[i]);
+        sqlite3_finalize(removes[i]);
+    }
 
-    return origin;
+    handler->change_batch = saved;
+    free(list);
+
+    if (rc != SQLITE_OK) {
+        exec_sql(handler, "ROLLBACK;");
+        *rows = 0;
+        return rc;
+    }
+
+    rc = exec_sql(handler, "COMMIT;");
+
+    if (rc == SQLITE_OK) {
+        *batches = count;
+    } else {
+        *rows = 0;
+    }
+
+    return rc;
 }
 
-// get_transactions retrieves transactions and put them into
-// a linked list.
-Queue *get_transactions(Transaction *transaction) {
-    char *sql;
-    int rc;
-    Queue *origin, *last;
-    sqlite3_stmt *stmt;
+// undo_changes undoes the last n batches of changes.
+int undo_changes(DB_Handler *handler, int n, unsigned int *batches, unsigned int *rows) {
+    return apply_batches(handler, 1, n, batches, rows);
+}
 
-    origin = NULL;
+// redo_changes redoes the last n batches of changes undone,
+// as long as no change was made since.
+int redo_changes(DB_Handler *handler, int n, unsigned int *batches, unsigned int *rows) {
+    return apply_batches(handler, 0, n, batches, rows);
+}
 
-    sql = "SELECT transactions.id," \
-        "transactions.name," \
-        "transactions.description," \
-        "transactions.amount," \
-        "transactions.wallet_id," \
-        "wallets.name AS wallet," \
-        "transactions.category_id," \
-        "categories.name AS category " \
-        "FROM transactions " \
-        "LEFT JOIN wallets ON transactions.wallet_id = wallets.id " \
-        "LEFT JOIN categories ON transactions.category_id = categories.id " \
-        "GROUP BY transactions.id;";
+// copy_db copies a database into another one, a few pages at a time.
+// Locks are released between steps so other connections keep reading
+// and writing; the copy restarts by itself if the source changes.
+static int copy_db(sqlite3 *dest, sqlite3 *src, int pages, int sleep_ms, DB_Progress progress, void *udata) {
+    int rc;
+    sqlite3_backup *backup;
 
-    rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+    if (pages <= 0) {
+        pages = BACKUP_PAGES;
+    }
 
-    if (rc != SQLITE_OK) {
-        return origin;
+    backup = sqlite3_backup_init(dest, "main", src, "main");
+
+    if (backup == NULL) {
+        log_warn("%s", sqlite3_errmsg(dest));
+        return sqlite3_errcode(dest);
     }
 
-    while (sqlite3_step(stmt) != SQLITE_DONE) {
-        unsigned int id = sqlite3_column_int(stmt, 0);
-        const char *name = (const char *) sqlite3_column_text(stmt, 1);
-        const char *description = (const char *) sqlite3_column_text(stmt, 2);
-        double amount = sqlite3_column_double(stmt, 3);
-        unsigned int wallet_id = sqlite3_column_int(stmt, 4);
-        const char *wallet_name = (const char *) sqlite3_column_text(stmt, 5);
-        unsigned int category_id = sqlite3_column_int(stmt, 6);
-        const char *category_name = (const char *) sqlite3_column_text(stmt, 7);
+    do {
+        rc = sqlite3_backup_step(backup, pages);
 
-        // Filter
-        if (transaction != NULL && transaction->name[0] != '\0') {
-            if (strcmp(name, transaction->name) != 0) {
-                continue;
+        if (progress != NULL) {
+            progress(
+                sqlite3_backup_remaining(backup),
+                sqlite3_backup_pagecount(backup),
+                udata
+            );
+        }
+
+        if (rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED) {
+            if (sleep_ms > 0) {
+                sqlite3_sleep(sleep_ms);
             }
         }
+    } while (rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED);
 
-        Queue *record = (Queue *) malloc(sizeof(Queue));
+    sqlite3_backup_finish(backup);
 
-        if (!record) {
-            log_fatal("Memory allocation error");
-            exit(1);
-        }
-        
-        record->record.transaction.id = id;
-        if (name != NULL) {
-            strcpy(record->record.transaction.name, name);
-        } else {
-            record->record.transaction.name[0] = '\0';
-        }
-        if (description != NULL) {
-            strcpy(record->record.transaction.description, description);
-        } else {
-            record->record.transaction.description[0] = '\0';
-        }
-        record->record.transaction.amount = amount;
-        record->record.transaction.wallet.id = id;
-        if (wallet_name != NULL) {
-            strcpy(record->record.transaction.wallet.name, wallet_name);
-        } else {
-            record->record.transaction.wallet.name[0] = '\0';
-        }
-        record->record.transaction.category.id = category_id;
-        if (category_name != NULL) {
-            strcpy(record->record.transaction.category.name, category_name);
-        } else {
-            record->record.transaction.category.name[0] = '\0';
-        }
-        record->next = NULL;
+    if (rc != SQLITE_DONE) {
+        log_warn("%s", sqlite3_errstr(rc));
+        return rc;
+    }
 
-        if (origin != NULL) {
-            last->next = record;
-            last = record;
-        } else {
-            origin = record;
-            last = record;
-        }
+    return SQLITE_OK;
+}
+
+// backup_db takes a hot snapshot of the database into a file.
+int backup_db(DB_Handler *handler, const char *path, int pages, int sleep_ms, DB_Progress progress, void *udata) {
+    int rc;
+    sqlite3 *dest;
+
+    rc = sqlite3_open(path, &dest);
+
+    if (rc == SQLITE_OK) {
+        rc = copy_db(dest, handler->db, pages, sleep_ms, progress, udata);
+    } else {
+        log_warn("%s", sqlite3_errmsg(dest));
     }
 
-    sqlite3_finalize(stmt);
+    sqlite3_close(dest);
 
-    return origin;
+    return rc;
 }
 
-// get_categories_overview retrieves categories, spent amounts and put them into
-// a linked list.
-Queue *get_categories_overview(Category *category) {
-    char *sql;
+// restore_db replaces the content of the database with a snapshot.
+// A snapshot of an older schema is upgraded once copied, and one of
+// a newer schema is refused before anything is copied.
+int restore_db(DB_Handler *handler, const char *path, int pages, int sleep_ms, DB_Progress progress, void *udata) {
     int rc;
-    Queue *origin, *last;
+    int version = 0;
+    sqlite3 *src;
     sqlite3_stmt *stmt;
 
-    origin = NULL;
+    rc = sqlite3_open_v2(path, &src, SQLITE_OPEN_READONLY, NULL);
 
-    sql = "SELECT categories.id," \
-        "categories.name," \
-        "SUM(transactions.amount) AS amount " \
-        "FROM categories " \
-        "LEFT JOIN transactions ON categories.id = transactions.category_id " \
-        "GROUP BY categories.name " \
-        "ORDER BY amount ASC;";
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_prepare_v2(src, "PRAGMA user_version;", -1, &stmt, NULL);
+    }
 
-    rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+    if (rc == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            version = sqlite3_column_int(stmt, 0);
+        }
+        rc = sqlite3_finalize(stmt);
+    }
 
     if (rc != SQLITE_OK) {
-        return origin;
+        log_warn("%s", sqlite3_errmsg(src));
+        sqlite3_close(src);
+        return rc;
     }
 
-    while (sqlite3_step(stmt) != SQLITE_DONE) {
-        Queue *record = (Queue *) malloc(sizeof(Queue));
+    if (version > SCHEMA_VERSION) {
+        log_warn("Snapshot \"%s\" has a newer schema (%d)", path, version);
+        sqlite3_close(src);
+        return SQLITE_ERROR;
+    }
 
-        if (!record) {
-            log_fatal("Memory allocation error");
-            exit(1);
-        }
+    // The journaling triggers would outlive the tables they are on.
+    // Restoring changes neither data_version nor the changes.
+    stop_changes(handler);
+    rc = copy_db(handler->db, src, pages, sleep_ms, progress, udata);
+    clear_results(handler);
 
-        unsigned int id = sqlite3_column_int(stmt, 0);
-        const char *name = (const char *) sqlite3_column_text(stmt, 1);
-        double amount = sqlite3_column_double(stmt, 2);
+    sqlite3_close(src);
 
-        record->record.category.id = id;
-        if (name != NULL) {
-            strcpy(record->record.category.name, name);
-        } else {
-            record->record.category.name[0] = '\0';
-        }
-        record->record.category.amount = amount;
-        record->next = NULL;
+    // Upgrades the schema and picks up the change journal of the
+    // snapshot, or of the database left as it was
+    if (init_db(handler) != SQLITE_OK && rc == SQLITE_OK) {
+        rc = SQLITE_ERROR;
+    }
 
-        if (origin != NULL) {
-            last->next = record;
-            last = record;
-        } else {
-            origin = record;
-            last = record;
-        }
+    // The snapshot may be at the generation the cache was built at
+    if (rc == SQLITE_OK && handler->cache != NULL) {
+        rc = rebuild_cache(handler);
     }
 
-    sqlite3_finalize(stmt);
+    return rc;
+}
 
-    return origin;
+// get_query_sql returns the SQL of a cached statement.
+const char *get_query_sql(DB_STMT id) {
+    if (id < 0 || id >= NUM_DB_STMT) {
+        return NULL;
+    }
+
+    return stmt_sql[id];
 }
 
-// remove_wallet deletes wallet from database.
-int remove_wallet(Wallet *wallet) {
-    char *sql;
-    char *zErrMsg = 0;
+// get_query_plan returns the query plan SQLite picks for a cached
+// statement, one step per line and indented by depth.
+// The result must be freed with sqlite3_free.
+char *get_query_plan(DB_Handler *handler, DB_STMT id) {
     int rc;
+    int i;
+    int depth;
+    int count = 0;
+    int ids[64];
+    int depths[64];
+    char *sql;
+    sqlite3_str *plan;
+    sqlite3_stmt *stmt;
 
-    sql = sqlite3_mprintf("BEGIN;" \
-        "DELETE FROM transactions WHERE " \
-        "transactions.wallet_id = %d;" \
-        "DELETE FROM wallets WHERE " \
-        "wallets.id = %d;" \
-        "COMMIT;",
-        wallet->id,
-        wallet->id
-    );
-    
-    rc = sqlite3_exec(db, sql, NULL, 0, &zErrMsg);
+    if (id < 0 || id >= NUM_DB_STMT) {
+        return NULL;
+    }
+
+    sql = sqlite3_mprintf("EXPLAIN QUERY PLAN %s", stmt_sql[id]);
+
+    rc = sqlite3_prepare_v2(handler->db, sql, -1, &stmt, NULL);
 
     sqlite3_free(sql);
 
     if (rc != SQLITE_OK) {
-        log_warn("%s", zErrMsg);
+        log_warn("%s", sqlite3_errmsg(handler->db));
+        return NULL;
     }
 
-    sqlite3_free(zErrMsg);
-
-    return rc;
-}
+    plan = sqlite3_str_new(handler->db);
 
-// remove_category deletes category from database.
-int remove_category(Category *category) {
-    char *sql;
-    char *zErrMsg = 0;
-    int rc;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        int node = sqlite3_column_int(stmt, 0);
+        int parent = sqlite3_column_int(stmt, 1);
+        const char *detail = (const char *) sqlite3_column_text(stmt, 3);
 
-    sql = sqlite3_mprintf("BEGIN;" \
-        "UPDATE transactions SET category_id = 0 WHERE " \
-        "category_id = %d;" \
-        "DELETE FROM categories WHERE " \
-        "id = %d;" \
-        "COMMIT;",
-        category->id,
-        category->id
-    );
-    
-    rc = sqlite3_exec(db, sql, NULL, 0, &zErrMsg);
+        // Depth is one more than the parent's
+        depth = 0;
+        for (i = count - 1; i >= 0; i--) {
+            if (ids[i] == parent) {
+                depth = depths[i] + 1;
+                break;
+            }
+        }
 
-    sqlite3_free(sql);
+        if (count < 64) {
+            ids[count] = node;
+            depths[count] = depth;
+            count++;
+        }
 
-    if (rc != SQLITE_OK) {
-        log_warn("%s", zErrMsg);
+        sqlite3_str_appendchar(plan, depth * 2, ' ');
+        sqlite3_str_appendf(plan, "%s\n", detail != NULL ? detail : "");
     }
 
-    sqlite3_free(zErrMsg);
+    sqlite3_finalize(stmt);
 
-    return rc;
+    return sqlite3_str_finish(plan);
 }
 
-// remove_transaction removes transaction from database.
-int remove_transaction(Transaction *transaction) {
-    char *sql;
-    char *zErrMsg = 0;
-    int rc;
+// db_memory reads how much memory SQLite, the connection of the
+// handler and the Queue lists use.
+void db_memory(DB_Handler *handler, DB_Memory *memory) {
+    int current, highwater;
+    sqlite3_int64 current64, highwater64;
+    sqlite3_stmt *stmt;
 
-    sql = sqlite3_mprintf("BEGIN;" \
-        "DELETE FROM transactions WHERE " \
-        "transactions.id = %d;" \
-        "COMMIT;",
-        transaction->id,
-        transaction->name
-    );
-    
-    rc = sqlite3_exec(db, sql, NULL, 0, &zErrMsg);
+    sqlite3_status64(SQLITE_STATUS_MEMORY_USED, &current64, &highwater64, 0);
+    memory->used = current64;
+    memory->highwater = highwater64;
 
-    sqlite3_free(sql);
+    sqlite3_status64(SQLITE_STATUS_MALLOC_COUNT, &current64, &highwater64, 0);
+    memory->allocations = current64;
 
-    if (rc != SQLITE_OK) {
-        log_warn("%s", zErrMsg);
-    }
+    sqlite3_db_status(handler->db, SQLITE_DBSTATUS_CACHE_USED, &current, &highwater, 0);
+    memory->cache_used = current;
 
-    sqlite3_free(zErrMsg);
+    sqlite3_db_status(handler->db, SQLITE_DBSTATUS_SCHEMA_USED, &current, &highwater, 0);
+    memory->schema_used = current;
 
-    return rc;
-}
+    sqlite3_db_status(handler->db, SQLITE_DBSTATUS_STMT_USED, &current, &highwater, 0);
+    memory->stmt_used = current;
 
-// count_records returns number of records in the table.
-unsigned int count_records(RECORD_TYPES type) {
-    char *sql;
-    int rc;
-    unsigned int count = 0;
-    sqlite3_stmt *stmt;
+    pthread_mutex_lock(&queue_mutex);
+    memory->queue_used = queue_nodes * sizeof(Queue);
+    memory->queue_highwater = queue_peak * sizeof(Queue);
+    pthread_mutex_unlock(&queue_mutex);
 
-    switch (type) {
-        case WALLET_TYPE:
-            sql = "SELECT COUNT(*) from wallets;";
-            break;
-        case CATEGORY_TYPE:
-            sql = "SELECT COUNT(*) from categories;";
-            break;
-        case TRANSACTION_TYPE:
-            sql = "SELECT COUNT(*) from transactions;";
-            break;
-        default:
-            return 0;
+    memory->mapped = handler->cache != NULL ? handler->cache->size : 0;
+
+    memory->heap_limit = sqlite3_soft_heap_limit64(-1);
+
+    // Negative cache sizes are in KiB, positive ones in pages
+    memory->cache_limit = 0;
+    if (sqlite3_prepare_v2(handler->db, "SELECT cache_size, page_size FROM pragma_cache_size(), pragma_page_size();", -1, &stmt, NULL) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            current64 = sqlite3_column_int64(stmt, 0);
+            if (current64 < 0) {
+                memory->cache_limit = -current64 * 1024;
+            } else {
+                memory->cache_limit = current64 * sqlite3_column_int64(stmt, 1);
+            }
+        }
+        sqlite3_finalize(stmt);
     }
+}
 
-    rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+// set_memory_limits sets the soft heap limit of SQLite, shared by
+// every connection of the process, and the size of the page cache
+// of the handler's connection, in bytes. SQLite keeps under the
+// heap limit by recycling cache pages. Negative values are left
+// unchanged, and a heap limit of 0 removes it.
+int set_memory_limits(DB_Handler *handler, sqlite3_int64 heap_limit, sqlite3_int64 cache_limit) {
+    int rc = SQLITE_OK;
+    char *sql;
 
-    while (sqlite3_step(stmt) != SQLITE_DONE) {
-        count = sqlite3_column_int(stmt, 0);
+    if (heap_limit >= 0) {
+        sqlite3_soft_heap_limit64(heap_limit);
     }
 
-    sqlite3_finalize(stmt);
+    if (cache_limit >= 0) {
+        // At least a page, in KiB
+        sql = sqlite3_mprintf("PRAGMA cache_size = -%lld;", cache_limit > 1024 ? cache_limit / 1024 : 1LL);
+        if (sql == NULL) {
+            log_fatal("Memory allocation error");
+            exit(1);
+        }
+        rc = exec_sql(handler, sql);
+        sqlite3_free(sql);
+    }
 
-    return count;
+    return rc;
 }
 
 // clear_queue frees up the memory.
 void clear_queue(Queue *origin) {
     Queue *temp;
+    size_t count = 0;
     while (origin != NULL) {
         temp = origin;
         origin = origin->next;
         free(temp);
+        count++;
+    }
+    if (count > 0) {
+        pthread_mutex_lock(&queue_mutex);
+        queue_nodes -= count;
+        pthread_mutex_unlock(&queue_mutex);
     }
 }
\ No newline at end of file
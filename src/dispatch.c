@@ -0,0 +1,100 @@
+#include <string.h>
+
+#include "dispatch.h"
+
+// Number of seeds tried before giving up on a perfect hash
+#define DISPATCH_MAX_SEED 1000000
+
+// dispatch_hash mixes the length, the first two and the last
+// characters of a name with a seed. It does not walk the whole
+// name, the final comparison does.
+static unsigned int dispatch_hash(unsigned int seed, const char *name, size_t length) {
+    unsigned int hash;
+
+    if (length == 0) {
+        return 0;
+    }
+
+    hash = seed ^ (unsigned int) length;
+    hash = (hash ^ (unsigned char) name[0]) * 16777619u;
+    hash = (hash ^ (unsigned char) name[length > 1]) * 16777619u;
+    hash = (hash ^ (unsigned char) name[length - 1]) * 16777619u;
+
+    return (hash ^ (hash >> 15)) & (DISPATCH_SLOTS - 1);
+}
+
+// dispatch_init searches a seed for which every name lands in its
+// own slot. Names are not copied and must outlive the table.
+// It returns 0 on success and -1 if no seed was found.
+int dispatch_init(Dispatch *dispatch, char **names, int count) {
+    int i;
+    unsigned int seed;
+    unsigned int slot;
+    size_t length;
+
+    dispatch->names = names;
+    dispatch->count = count;
+
+    if (count >= DISPATCH_SLOTS || count > 255) {
+        return -1;
+    }
+
+    for (seed = 0; seed < DISPATCH_MAX_SEED; seed++) {
+        memset(dispatch->slots, 0, sizeof(dispatch->slots));
+
+        for (i = 0; i < count; i++) {
+            length = strlen(names[i]);
+            slot = dispatch_hash(seed, names[i], length);
+            if (dispatch->slots[slot] != 0 || length > 255) {
+                break;
+            }
+            // Slots store index + 1, 0 is an empty slot
+            dispatch->slots[slot] = i + 1;
+            dispatch->lengths[slot] = length;
+        }
+
+        if (i == count) {
+            dispatch->seed = seed;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+// dispatch_lookup returns the index of a name or of the only name
+// it is a prefix of. It returns DISPATCH_AMBIGUOUS if the prefix
+// matches several names and DISPATCH_NOT_FOUND if none.
+int dispatch_lookup(const Dispatch *dispatch, const char *name) {
+    int i;
+    int index;
+    int found = DISPATCH_NOT_FOUND;
+    unsigned int slot;
+    size_t length;
+
+    length = strlen(name);
+
+    slot = dispatch_hash(dispatch->seed, name, length);
+    index = dispatch->slots[slot] - 1;
+
+    if (index >= 0 && dispatch->lengths[slot] == length &&
+        memcmp(dispatch->names[index], name, length) == 0) {
+        return index;
+    }
+
+    if (length == 0) {
+        return DISPATCH_NOT_FOUND;
+    }
+
+    // Not an exact name, look for an unambiguous prefix
+    for (i = 0; i < dispatch->count; i++) {
+        if (strncmp(dispatch->names[i], name, length) == 0) {
+            if (found != DISPATCH_NOT_FOUND) {
+                return DISPATCH_AMBIGUOUS;
+            }
+            found = i;
+        }
+    }
+
+    return found;
+}
@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "journal.h"
+#include "rxi/log.h"
+
+// journal_open opens a journal for appending, creating it
+// with its header if needed.
+Journal *journal_open(const char *path) {
+    Journal *journal;
+    FILE *file;
+
+    file = fopen(path, "a");
+
+    if (file == NULL) {
+        log_warn("Couldn't open history \"%s\"", path);
+        return NULL;
+    }
+
+    journal = (Journal *) malloc(sizeof(Journal));
+
+    if (!journal) {
+        log_fatal("Memory allocation error");
+        exit(1);
+    }
+
+    journal->file = file;
+    journal->created = ftell(file) == 0;
+
+    if (journal->created) {
+        fprintf(file, "%s\n", JOURNAL_HEADER);
+        fflush(file);
+    }
+
+    return journal;
+}
+
+// journal_append writes an entry to the journal. Tabs and line
+// breaks in the command are written as spaces.
+void journal_append(Journal *journal, double timestamp, double latency, int rows, const char *command) {
+    const char *c;
+
+    fprintf(journal->file, "%.3lf\t%.3lf\t%d\t", timestamp, latency, rows);
+
+    for (c = command; *c != '\0'; c++) {
+        fputc(*c == '\t' || *c == '\n' || *c == '\r' ? ' ' : *c, journal->file);
+    }
+
+    fputc('\n', journal->file);
+    fflush(journal->file);
+}
+
+// journal_snapshot records the path of the snapshot the commands of
+// a new journal start from, before any of them is appended.
+void journal_snapshot(Journal *journal, const char *path) {
+    fprintf(journal->file, "%s%s\n", JOURNAL_SNAPSHOT, path);
+    fflush(journal->file);
+}
+
+// journal_close closes a journal.
+void journal_close(Journal *journal) {
+    if (journal == NULL) {
+        return;
+    }
+
+    fclose(journal->file);
+    free(journal);
+}
+
+// journal_parse reads an entry from a line of a journal, in place:
+// the command of the entry points into the line. It returns 0 for
+// comments and malformed lines.
+int journal_parse(char *line, Journal_Entry *entry) {
+    char *end;
+
+    if (line[0] == '#' || line[0] == '\0') {
+        return 0;
+    }
+
+    entry->timestamp = strtod(line, &end);
+    if (*end != '\t') {
+        return 0;
+    }
+
+    entry->latency = strtod(end + 1, &end);
+    if (*end != '\t') {
+        return 0;
+    }
+
+    entry->rows = (int) strtol(end + 1, &end, 10);
+    if (*end != '\t') {
+        return 0;
+    }
+
+    entry->command = end + 1;
+
+    return 1;
+}
+
+// journal_parse_snapshot returns the path of the snapshot recorded by
+// a line of a journal, or NULL if the line isn't one.
+const char *journal_parse_snapshot(const char *line) {
+    size_t len = strlen(JOURNAL_SNAPSHOT);
+
+    if (strncmp(line, JOURNAL_SNAPSHOT, len) != 0 || line[len] == '\0') {
+        return NULL;
+    }
+
+    return line + len;
+}
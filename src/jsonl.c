@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jsonl.h"
+
+// Bytes which can't appear as is in a JSON string
+static const unsigned char escaped[256] = {
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    ['"'] = 1,
+    ['\\'] = 1
+};
+
+static const char hex[] = "0123456789abcdef";
+
+// jsonl_write appends bytes, flushing the buffer when needed.
+static void jsonl_write(Json_Writer *writer, const char *data, size_t size) {
+    if (writer->size + size > JSONL_BUFFER_SIZE) {
+        jsonl_flush(writer);
+        if (size > JSONL_BUFFER_SIZE) {
+            fwrite(data, 1, size, writer->file);
+            return;
+        }
+    }
+
+    memcpy(writer->buffer + writer->size, data, size);
+    writer->size += size;
+}
+
+// jsonl_quote appends a quoted string, copying the runs of bytes
+// which need no escaping at once.
+static void jsonl_quote(Json_Writer *writer, const char *text) {
+    const unsigned char *run, *p;
+    char escape[6] = { '\\', 'u', '0', '0' };
+
+    jsonl_write(writer, "\"", 1);
+
+    run = p = (const unsigned char *) text;
+
+    for (;;) {
+        while (!escaped[*p] && *p != '\0') {
+            p++;
+        }
+
+        jsonl_write(writer, (const char *) run, p - run);
+
+        if (*p == '\0') {
+            break;
+        }
+
+        switch (*p) {
+            case '"':
+                jsonl_write(writer, "\\\"", 2);
+                break;
+            case '\\':
+                jsonl_write(writer, "\\\\", 2);
+                break;
+            case '\n':
+                jsonl_write(writer, "\\n", 2);
+                break;
+            case '\r':
+                jsonl_write(writer, "\\r", 2);
+                break;
+            case '\t':
+                jsonl_write(writer, "\\t", 2);
+                break;
+            default:
+                escape[4] = hex[*p >> 4];
+                escape[5] = hex[*p & 0xf];
+                jsonl_write(writer, escape, sizeof(escape));
+                break;
+        }
+
+        run = ++p;
+    }
+
+    jsonl_write(writer, "\"", 1);
+}
+
+// jsonl_key appends the key of the next field. Keys come from
+// the program and are written without escaping.
+static void jsonl_key(Json_Writer *writer, const char *key) {
+    if (writer->fields++ > 0) {
+        jsonl_write(writer, ",\"", 2);
+    } else {
+        jsonl_write(writer, "\"", 1);
+    }
+
+    jsonl_write(writer, key, strlen(key));
+    jsonl_write(writer, "\":", 2);
+}
+
+// jsonl_digits writes the digits of a number at the end of a
+// buffer and returns where they start.
+static char *jsonl_digits(char *end, unsigned long long n) {
+    do {
+        *--end = '0' + n % 10;
+        n /= 10;
+    } while (n > 0);
+
+    return end;
+}
+
+// jsonl_init sets up a writer to a file.
+void jsonl_init(Json_Writer *writer, FILE *file) {
+    writer->file = file;
+    writer->size = 0;
+    writer->fields = 0;
+}
+
+// jsonl_begin starts an object.
+void jsonl_begin(Json_Writer *writer) {
+    writer->fields = 0;
+    jsonl_write(writer, "{", 1);
+}
+
+// jsonl_end ends an object and its line.
+void jsonl_end(Json_Writer *writer) {
+    jsonl_write(writer, "}\n", 2);
+}
+
+// jsonl_string appends a string field, null if text is NULL.
+void jsonl_string(Json_Writer *writer, const char *key, const char *text) {
+    jsonl_key(writer, key);
+
+    if (text == NULL) {
+        jsonl_write(writer, "null", 4);
+    } else {
+        jsonl_quote(writer, text);
+    }
+}
+
+// jsonl_int appends an integer field.
+void jsonl_int(Json_Writer *writer, const char *key, long long value) {
+    char digits[24];
+    char *start;
+
+    jsonl_key(writer, key);
+
+    start = jsonl_digits(digits + sizeof(digits), value < 0 ? 0ULL - (unsigned long long) value : (unsigned long long) value);
+
+    if (value < 0) {
+        *--start = '-';
+    }
+
+    jsonl_write(writer, start, digits + sizeof(digits) - start);
+}
+
+// jsonl_double appends a number field, with enough digits to read
+// back the amounts as entered. Whole cents, as most amounts are,
+// are written without going through printf. NaN and infinities
+// become null.
+void jsonl_double(Json_Writer *writer, const char *key, double value) {
+    char number[32];
+    char *start, *end = number + sizeof(number);
+    long long cents, fraction;
+    int size;
+
+    jsonl_key(writer, key);
+
+    if (value != value || value > 1e308 || value < -1e308) {
+        jsonl_write(writer, "null", 4);
+        return;
+    }
+
+    if (value > -1e13 && value < 1e13) {
+        cents = (long long) (value < 0 ? value * 100 - 0.5 : value * 100 + 0.5);
+
+        if (cents / 100.0 == value) {
+            start = end;
+            fraction = llabs(cents) % 100;
+
+            // Trailing zeros are dropped, as in 1.5
+            if (fraction != 0) {
+                if (fraction % 10 != 0) {
+                    *--start = '0' + fraction % 10;
+                }
+                *--start = '0' + fraction / 10;
+                *--start = '.';
+            }
+
+            start = jsonl_digits(start, llabs(cents) / 100);
+
+            if (cents < 0) {
+                *--start = '-';
+            }
+
+            jsonl_write(writer, start, end - start);
+            return;
+        }
+    }
+
+    size = snprintf(number, sizeof(number), "%.15g", value);
+    jsonl_write(writer, number, size);
+}
+
+// jsonl_flush writes the buffer to the file.
+void jsonl_flush(Json_Writer *writer) {
+    if (writer->size > 0) {
+        fwrite(writer->buffer, 1, writer->size, writer->file);
+        writer->size = 0;
+    }
+
+    fflush(writer->file);
+}
@@ -6,11 +6,13 @@
 
 #include "db.h"
 #include "shell.h"
+#include "journal.h"
+#include "misc.h"
 #include "rxi/log.h"
 #include "sqlite3/sqlite3.h"
 
-// Database handler
-DB_Handler *handler;
+// Database handler of the shell session
+static DB_Handler *handler;
 
 // File stream
 FILE *outFile = NULL;
@@ -20,32 +22,78 @@ FILE *outFile = NULL;
 // close file logger.
 void signal_handler(int signum) {
     log_info("Closing database \"%s\"", handler->db_name);
-    sqlite3_close(handler->db);
+    disconnect(handler);
     if (outFile != NULL) {
         fclose(outFile);
     }
-    free(handler);
     exit(1);
 }
 
 int main(int argc, const char *argv[]) {
     int i;
     int LOG_F = 0;
+    int READ_ONLY_F = 0;
+    int CACHE_F = 0;
+    int HISTORY_F = 1;
+    long long HEAP_LIMIT = -1;
+    long long CACHE_LIMIT = -1;
+    char history[DB_NAME_SIZE + 16];
+    int CMD_I = 0;
 
     // Lookup for command-line arguments
-    for (i = 0; i < argc; i++) {
+    for (i = 1; i < argc; i++) {
+        // Remaining arguments are a command to run without the shell
+        if (argv[i][0] != '-') {
+            CMD_I = i;
+            break;
+        }
         if (
             strcmp(argv[i], "-l") == 0 ||
             strcmp(argv[i], "--log") == 0
         ) {
             LOG_F = 1;
         }
+        if (
+            strcmp(argv[i], "-r") == 0 ||
+            strcmp(argv[i], "--read-only") == 0
+        ) {
+            READ_ONLY_F = 1;
+        }
+        if (
+            strcmp(argv[i], "-c") == 0 ||
+            strcmp(argv[i], "--cache") == 0
+        ) {
+            CACHE_F = 1;
+        }
+        if (strcmp(argv[i], "--no-history") == 0) {
+            HISTORY_F = 0;
+        }
+        if (
+            strcmp(argv[i], "--heap-limit") == 0 ||
+            strcmp(argv[i], "--cache-limit") == 0
+        ) {
+            if (i + 1 == argc || parse_size(argv[i + 1]) < 0) {
+                printf("%s expects a size, such as 64M\n", argv[i]);
+                exit(1);
+            }
+            if (strcmp(argv[i], "--heap-limit") == 0) {
+                HEAP_LIMIT = parse_size(argv[++i]);
+            } else {
+                CACHE_LIMIT = parse_size(argv[++i]);
+            }
+        }
         if (
             strcmp(argv[i], "-h") == 0 ||
             strcmp(argv[i], "--help") == 0
         ) {
             printf("Budget Manager\n");
+            printf("usage: myBudget [options] [command [args ...]]\n");
             printf("-l, --log\tEnable logger\n");
+            printf("-r, --read-only\tOpen the database without taking write locks\n");
+            printf("-c, --cache\tUse the transactions cache for reports\n");
+            printf("--no-history\tDon't record the commands of the shell\n");
+            printf("--heap-limit SIZE\tKeep the memory of SQLite under SIZE, such as 64M\n");
+            printf("--cache-limit SIZE\tKeep the page cache of the database under SIZE\n");
             printf("-h, --help\tDisplay this message\n");
             exit(0);
         }
@@ -62,29 +110,42 @@ int main(int argc, const char *argv[]) {
     }
 
     // Establish connection
-    handler = connect(NULL);
+    handler = connect(NULL, READ_ONLY_F);
     if (handler->db == NULL) {
         log_fatal("Error sqlite: Couldn't open database \"%s\"", handler->db_name);
-        free(handler);
+        disconnect(handler);
         exit(1);
     }
     
     // Initialize database
-    if (init_db() != SQLITE_OK) {
-        sqlite3_close(handler->db);
-        free(handler);
+    if (init_db(handler) != SQLITE_OK) {
+        disconnect(handler);
         exit(1);
     }
 
+    // Memory limits
+    if (set_memory_limits(handler, HEAP_LIMIT, CACHE_LIMIT) != SQLITE_OK) {
+        log_warn("Couldn't set the memory limits");
+    }
+
+    // Map transactions cache
+    if (CACHE_F && enable_cache(handler) != SQLITE_OK) {
+        log_warn("Transactions cache is unavailable");
+    }
+
     // Handle OS Signal
     signal(SIGINT, signal_handler);
 
-    // Init shell
-    sh_spawn();
-
-    sqlite3_close(handler->db);
+    if (CMD_I > 0) {
+        // Run a single command
+        sh_run(handler, argc - CMD_I, (char **) argv + CMD_I);
+    } else {
+        // Init shell, recording its commands
+        snprintf(history, sizeof(history), "%s%s", handler->db_name, JOURNAL_SUFFIX);
+        sh_spawn(handler, HISTORY_F ? history : NULL);
+    }
 
-    free(handler);
+    disconnect(handler);
 
     if (outFile != NULL) {
         fclose(outFile);
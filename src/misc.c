@@ -1,11 +1,10 @@
 #include <stdio.h>
 #include <stdarg.h>
+#include <time.h>
 
-#ifdef PRETTY_PRINT
 #if defined(_WIN32) || defined(_WIN64)
 #include <Windows.h>
 #endif
-#endif
 
 #include "misc.h"
 
@@ -75,4 +74,77 @@ void pretty_printf(FILE *output, int type, const char *fmt, ...) {
     va_end(args);
     fprintf(output, "\n");
     fflush(output);
+}
+
+// monotonic_time returns a time in seconds suitable to measure
+// elapsed time.
+double monotonic_time(void) {
+    #if defined(_WIN32) || defined(_WIN64)
+    return (double) GetTickCount64() / 1000.0;
+    #else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+    #endif
+}
+
+// wall_time returns the time of day in seconds since the epoch.
+double wall_time(void) {
+    #if defined(_WIN32) || defined(_WIN64)
+    FILETIME ft;
+    ULARGE_INTEGER t;
+
+    GetSystemTimeAsFileTime(&ft);
+    t.LowPart = ft.dwLowDateTime;
+    t.HighPart = ft.dwHighDateTime;
+
+    // FILETIME counts 100ns from 1601-01-01
+    return (double) (t.QuadPart - 116444736000000000ULL) / 1e7;
+    #else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+    #endif
+}
+
+// parse_size reads a size in bytes, optionally followed by K, M or G,
+// as in 64M. It returns -1 if the size is invalid.
+long long parse_size(const char *text) {
+    long long size = 0;
+
+    if (*text < '0' || *text > '9') {
+        return -1;
+    }
+
+    for (; *text >= '0' && *text <= '9'; text++) {
+        if (size > (1LL << 50)) {
+            return -1;
+        }
+        size = size * 10 + (*text - '0');
+    }
+
+    switch (*text) {
+        case '\0':
+            return size;
+        case 'k':
+        case 'K':
+            size <<= 10;
+            break;
+        case 'm':
+        case 'M':
+            size <<= 20;
+            break;
+        case 'g':
+        case 'G':
+            size <<= 30;
+            break;
+        default:
+            return -1;
+    }
+
+    return text[1] == '\0' ? size : -1;
 }
\ No newline at end of file
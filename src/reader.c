@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <io.h>
+#define read _read
+#define isatty _isatty
+#else
+#include <unistd.h>
+#endif
+
+#include "reader.h"
+#include "rxi/log.h"
+
+// reader_grow makes room for at least one more block in the buffer.
+static void reader_grow(Reader *reader) {
+    if (reader->size - reader->end > READER_BLOCK_SIZE / 2) {
+        return;
+    }
+
+    reader->size *= 2;
+    reader->buffer = (char *) realloc(reader->buffer, reader->size);
+
+    if (!reader->buffer) {
+        log_fatal("Memory allocation error");
+        exit(1);
+    }
+}
+
+// reader_init prepares a reader on a file descriptor. Terminals are
+// read a character at a time through stdio, anything else (pipes,
+// files) is read by blocks.
+void reader_init(Reader *reader, int fd) {
+    reader->fd = fd;
+    reader->interactive = isatty(fd);
+    reader->eof = 0;
+    reader->size = READER_BLOCK_SIZE;
+    reader->start = 0;
+    reader->end = 0;
+    reader->buffer = (char *) malloc(reader->size);
+
+    if (!reader->buffer) {
+        log_fatal("Memory allocation error");
+        exit(1);
+    }
+}
+
+// reader_interactive_line reads a line from the terminal.
+static char *reader_interactive_line(Reader *reader, size_t *length) {
+    int c;
+    size_t position = 0;
+
+    for (;;) {
+        c = getchar();
+
+        if (c == EOF && position == 0) {
+            return NULL;
+        }
+        if (c == '\n' || c == EOF) {
+            break;
+        }
+
+        reader->buffer[position++] = c;
+
+        // Keep room for the terminator
+        if (position + 1 >= reader->size) {
+            reader->end = position;
+            reader_grow(reader);
+        }
+    }
+
+    reader->buffer[position] = '\0';
+
+    if (length != NULL) {
+        *length = position;
+    }
+
+    return reader->buffer;
+}
+
+// reader_line returns the next line without its newline, or NULL
+// at the end of the input. The line is NUL-terminated in place.
+char *reader_line(Reader *reader, size_t *length) {
+    char *line;
+    char *newline;
+    size_t scanned;
+    long count;
+
+    if (reader->interactive) {
+        return reader_interactive_line(reader, length);
+    }
+
+    scanned = reader->start;
+
+    for (;;) {
+        newline = (char *) memchr(reader->buffer + scanned, '\n', reader->end - scanned);
+
+        if (newline != NULL || (reader->eof && reader->start < reader->end)) {
+            if (newline == NULL) {
+                // Last line without newline, there is always room left
+                newline = reader->buffer + reader->end;
+                reader->end++;
+            }
+
+            line = reader->buffer + reader->start;
+            *newline = '\0';
+            reader->start = newline - reader->buffer + 1;
+
+            if (newline > line && newline[-1] == '\r') {
+                newline[-1] = '\0';
+                newline--;
+            }
+
+            if (length != NULL) {
+                *length = newline - line;
+            }
+
+            return line;
+        }
+
+        if (reader->eof) {
+            return NULL;
+        }
+
+        // Move the partial line to the front and read another block
+        memmove(reader->buffer, reader->buffer + reader->start, reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->start = 0;
+        scanned = reader->end;
+
+        reader_grow(reader);
+
+        do {
+            count = read(reader->fd, reader->buffer + reader->end, reader->size - reader->end - 1);
+        } while (count < 0 && errno == EINTR);
+
+        if (count <= 0) {
+            reader->eof = 1;
+        } else {
+            reader->end += count;
+        }
+    }
+}
+
+// reader_free releases the buffer of the reader.
+void reader_free(Reader *reader) {
+    free(reader->buffer);
+    reader->buffer = NULL;
+}
@@ -0,0 +1,412 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "db.h"
+#include "report.h"
+#include "rxi/log.h"
+#include "sqlite3/sqlite3.h"
+
+// Name of the group of uncategorized transactions
+#define REPORT_NO_GROUP "(none)"
+
+// Name of the group of the names seen past REPORT_MAX_GROUPS
+#define REPORT_OTHER_GROUP "(other)"
+
+// Open addressing table of the groups seen during a scan.
+// Slots with a zero count are empty.
+typedef struct Group_Table {
+    Report_Entry *entries;
+    size_t capacity;
+    size_t count;
+} Group_Table;
+
+// State of a top scan
+typedef struct Top_Scan {
+    DB_Handler *handler;
+    REPORT_GROUP by;
+    Group_Table groups;
+} Top_Scan;
+
+// State of a percentiles scan
+typedef struct Percentiles_Scan {
+    DB_Handler *handler;
+    Sketch *sketch;
+} Percentiles_Scan;
+
+// hash_name hashes a group name with FNV-1a.
+static size_t hash_name(const char *name) {
+    size_t hash = 2166136261u;
+
+    while (*name != '\0') {
+        hash = (hash ^ (unsigned char) *name++) * 16777619u;
+    }
+
+    return hash;
+}
+
+// group_alloc allocates an empty table of capacity slots.
+static void group_alloc(Group_Table *table, size_t capacity) {
+    table->entries = (Report_Entry *) calloc(capacity, sizeof(Report_Entry));
+
+    if (!table->entries) {
+        log_fatal("Memory allocation error");
+        exit(1);
+    }
+
+    table->capacity = capacity;
+    table->count = 0;
+}
+
+// group_slot returns the slot of name, which is empty if
+// the group isn't in the table yet.
+static Report_Entry *group_slot(Group_Table *table, const char *name) {
+    size_t i = hash_name(name) & (table->capacity - 1);
+
+    while (table->entries[i].count != 0 && strcmp(table->entries[i].name, name) != 0) {
+        i = (i + 1) & (table->capacity - 1);
+    }
+
+    return &table->entries[i];
+}
+
+// group_find returns the entry of name, adding it if needed.
+// The table doubles once it is half full. Once it holds
+// REPORT_MAX_GROUPS groups, new names are counted together in
+// REPORT_OTHER_GROUP, so memory stays bounded.
+static Report_Entry *group_find(Group_Table *table, const char *name) {
+    size_t i;
+    Group_Table grown;
+    Report_Entry *entry;
+
+    if (table->count >= REPORT_MAX_GROUPS - 1 && group_slot(table, name)->count == 0) {
+        name = REPORT_OTHER_GROUP;
+    }
+
+    if ((table->count + 1) * 2 > table->capacity) {
+        group_alloc(&grown, table->capacity * 2);
+
+        for (i = 0; i < table->capacity; i++) {
+            if (table->entries[i].count != 0) {
+                *group_slot(&grown, table->entries[i].name) = table->entries[i];
+            }
+        }
+
+        grown.count = table->count;
+        free(table->entries);
+        *table = grown;
+    }
+
+    entry = group_slot(table, name);
+
+    if (entry->count == 0) {
+        snprintf(entry->name, sizeof(entry->name), "%s", name);
+        entry->amount = 0.0;
+        table->count++;
+    }
+
+    return entry;
+}
+
+// entry_less orders entries by amount, then by name so that
+// ties come out in alphabetical order.
+static int entry_less(const Report_Entry *a, const Report_Entry *b) {
+    if (a->amount != b->amount) {
+        return a->amount < b->amount;
+    }
+
+    return strcmp(a->name, b->name) > 0;
+}
+
+// top_sift_down restores the heap below index i.
+static void top_sift_down(Report_Entry *entries, int size, int i) {
+    int child;
+    Report_Entry tmp;
+
+    while ((child = 2 * i + 1) < size) {
+        if (child + 1 < size && entry_less(&entries[child + 1], &entries[child])) {
+            child++;
+        }
+
+        if (!entry_less(&entries[child], &entries[i])) {
+            break;
+        }
+
+        tmp = entries[i];
+        entries[i] = entries[child];
+        entries[child] = tmp;
+        i = child;
+    }
+}
+
+// top_init prepares a heap keeping the n largest entries.
+void top_init(Top_Heap *heap, int n) {
+    heap->entries = (Report_Entry *) malloc((n > 0 ? n : 1) * sizeof(Report_Entry));
+
+    if (!heap->entries) {
+        log_fatal("Memory allocation error");
+        exit(1);
+    }
+
+    heap->size = 0;
+    heap->capacity = n;
+}
+
+// top_push offers an entry to the heap, replacing the
+// smallest entry once the heap is full.
+void top_push(Top_Heap *heap, const Report_Entry *entry) {
+    int i, parent;
+    Report_Entry tmp;
+
+    if (heap->size < heap->capacity) {
+        i = heap->size++;
+        heap->entries[i] = *entry;
+
+        while (i > 0) {
+            parent = (i - 1) / 2;
+
+            if (!entry_less(&heap->entries[i], &heap->entries[parent])) {
+                break;
+            }
+
+            tmp = heap->entries[i];
+            heap->entries[i] = heap->entries[parent];
+            heap->entries[parent] = tmp;
+            i = parent;
+        }
+    } else if (heap->capacity > 0 && entry_less(&heap->entries[0], entry)) {
+        heap->entries[0] = *entry;
+        top_sift_down(heap->entries, heap->size, 0);
+    }
+}
+
+// top_sort sorts the entries largest first, after which the
+// heap can't be pushed to. Returns the number of entries.
+int top_sort(Top_Heap *heap) {
+    int size;
+    Report_Entry tmp;
+
+    for (size = heap->size; size > 1; size--) {
+        tmp = heap->entries[0];
+        heap->entries[0] = heap->entries[size - 1];
+        heap->entries[size - 1] = tmp;
+        top_sift_down(heap->entries, size - 1, 0);
+    }
+
+    return heap->size;
+}
+
+// top_free releases the entries of a heap.
+void top_free(Top_Heap *heap) {
+    free(heap->entries);
+    heap->entries = NULL;
+    heap->size = 0;
+}
+
+// sketch_init prepares an empty sketch with the given
+// relative accuracy.
+void sketch_init(Sketch *sketch, double accuracy) {
+    memset(sketch, 0, sizeof(Sketch));
+
+    sketch->gamma = (1.0 + accuracy) / (1.0 - accuracy);
+    sketch->log_gamma = log(sketch->gamma);
+    sketch->offset = (int) ceil(log(SKETCH_MIN_VALUE) / sketch->log_gamma);
+}
+
+// sketch_bucket returns the bucket of a positive magnitude.
+static int sketch_bucket(const Sketch *sketch, double value) {
+    int bucket;
+
+    if (value < SKETCH_MIN_VALUE) {
+        return 0;
+    }
+
+    bucket = (int) ceil(log(value) / sketch->log_gamma) - sketch->offset;
+
+    return bucket < SKETCH_BUCKETS ? bucket : SKETCH_BUCKETS - 1;
+}
+
+// sketch_value returns the magnitude a bucket stands for,
+// which is within the accuracy of every value in it.
+static double sketch_value(const Sketch *sketch, int bucket) {
+    return 2.0 * pow(sketch->gamma, bucket + sketch->offset) / (sketch->gamma + 1.0);
+}
+
+// sketch_add counts a value in the sketch.
+void sketch_add(Sketch *sketch, double value) {
+    if (sketch->count == 0 || value < sketch->min) {
+        sketch->min = value;
+    }
+    if (sketch->count == 0 || value > sketch->max) {
+        sketch->max = value;
+    }
+
+    sketch->count++;
+
+    if (value > 0.0) {
+        sketch->positive[sketch_bucket(sketch, value)]++;
+    } else if (value < 0.0) {
+        sketch->negative[sketch_bucket(sketch, -value)]++;
+    } else {
+        sketch->zeros++;
+    }
+}
+
+// sketch_quantile returns the approximate q-quantile, q in [0, 1],
+// of the values counted in the sketch.
+double sketch_quantile(const Sketch *sketch, double q) {
+    int i;
+    double value = 0.0;
+    uint64_t rank, seen = 0;
+
+    if (sketch->count == 0) {
+        return 0.0;
+    }
+
+    if (q <= 0.0) {
+        return sketch->min;
+    }
+    if (q >= 1.0) {
+        return sketch->max;
+    }
+
+    rank = (uint64_t) (q * (sketch->count - 1));
+
+    // Smallest values first: large debits, zeros, then credits
+    for (i = SKETCH_BUCKETS - 1; i >= 0 && seen <= rank; i--) {
+        seen += sketch->negative[i];
+        if (seen > rank) {
+            value = -sketch_value(sketch, i);
+        }
+    }
+
+    if (seen <= rank) {
+        seen += sketch->zeros;
+    }
+
+    for (i = 0; i < SKETCH_BUCKETS && seen <= rank; i++) {
+        seen += sketch->positive[i];
+        if (seen > rank) {
+            value = sketch_value(sketch, i);
+        }
+    }
+
+    if (value < sketch->min) {
+        return sketch->min;
+    }
+    if (value > sketch->max) {
+        return sketch->max;
+    }
+
+    return value;
+}
+
+// base_amount converts the amount of a transaction into the base
+// currency. It returns 0 if a rate is missing.
+static int base_amount(DB_Handler *handler, const Transaction *transaction, double *amount) {
+    if (transaction->currency[0] == '\0') {
+        *amount = transaction->amount;
+        return 1;
+    }
+
+    return convert_amount(handler, transaction->amount, transaction->currency, NULL, transaction->date, amount);
+}
+
+// add_spending adds the spending of a transaction to its group.
+static int add_spending(const Transaction *transaction, void *udata) {
+    Top_Scan *scan = (Top_Scan *) udata;
+    const char *name;
+    double amount;
+    Report_Entry *entry;
+
+    if (transaction->amount >= 0.0) {
+        return 0;
+    }
+
+    if (!base_amount(scan->handler, transaction, &amount)) {
+        return 0;
+    }
+
+    switch (scan->by) {
+    case GROUP_WALLET:
+        name = transaction->wallet.name;
+        break;
+    case GROUP_NAME:
+        name = transaction->name;
+        break;
+    default:
+        name = transaction->category.name;
+    }
+
+    entry = group_find(&scan->groups, name[0] != '\0' ? name : REPORT_NO_GROUP);
+    entry->amount -= amount;
+    entry->count++;
+
+    return 0;
+}
+
+// report_top fills heap with the groups that spent the most,
+// in one scan of the transactions. Only debits are counted, in the
+// base currency, transfers and opening balances aside.
+int report_top(DB_Handler *handler, REPORT_GROUP by, Top_Heap *heap) {
+    int rc;
+    size_t i;
+    Top_Scan scan;
+
+    rc = load_rates(handler);
+
+    if (rc != SQLITE_OK) {
+        return rc;
+    }
+
+    scan.handler = handler;
+    scan.by = by;
+    group_alloc(&scan.groups, 64);
+
+    rc = iterate_cash_flows(handler, &add_spending, &scan);
+
+    if (rc == SQLITE_OK) {
+        for (i = 0; i < scan.groups.capacity; i++) {
+            if (scan.groups.entries[i].count != 0) {
+                top_push(heap, &scan.groups.entries[i]);
+            }
+        }
+        top_sort(heap);
+    }
+
+    free(scan.groups.entries);
+
+    return rc;
+}
+
+// add_amount counts the amount of a transaction in a sketch.
+static int add_amount(const Transaction *transaction, void *udata) {
+    Percentiles_Scan *scan = (Percentiles_Scan *) udata;
+    double amount;
+
+    if (base_amount(scan->handler, transaction, &amount)) {
+        sketch_add(scan->sketch, amount);
+    }
+
+    return 0;
+}
+
+// report_percentiles counts the amounts of all transactions but
+// transfers and opening balances in sketch, in the base currency, in
+// one scan of the transactions.
+int report_percentiles(DB_Handler *handler, Sketch *sketch) {
+    int rc;
+    Percentiles_Scan scan;
+
+    rc = load_rates(handler);
+
+    if (rc != SQLITE_OK) {
+        return rc;
+    }
+
+    scan.handler = handler;
+    scan.sketch = sketch;
+
+    return iterate_cash_flows(handler, &add_amount, &scan);
+}
@@ -2,20 +2,61 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <signal.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <io.h>
+#define open _open
+#define close _close
+#define dup _dup
+#define dup2 _dup2
+#define NULL_DEVICE "NUL"
+#else
+#include <unistd.h>
+#define NULL_DEVICE "/dev/null"
+#endif
 
 #include "db.h"
 #include "shell.h"
+#include "consolidate.h"
+#include "dispatch.h"
+#include "arena.h"
+#include "reader.h"
+#include "columnar.h"
+#include "report.h"
+#include "journal.h"
+#include "jsonl.h"
 #include "rxi/log.h"
 #include "misc.h"
 #include "sqlite3/sqlite3.h"
 
-// List of commands
+// Database handler used by the shell session
+static DB_Handler *handler;
+
+// List of commands, record commands first in RECORD_TYPES order
 static char *lst_cmd[] = {
     "wallet",
     "category",
     "transaction",
     "export",
     "overview",
+    "consolidate",
+    "backup",
+    "restore",
+    "explain",
+    "cache",
+    "report",
+    "recurring",
+    "transfer",
+    "archive",
+    "replay",
+    "undo",
+    "redo",
+    "changes",
+    "mem",
+    "budget",
+    "fx",
     "help",
     "exit"
 };
@@ -31,6 +72,38 @@ static char *lst_sub_cmd[] = {
     "remove"
 };
 
+// Options which take no value
+static char *lst_flag[] = {
+    "--yes",
+    "--follow"
+};
+
+#define NUM_SH_FLAG (int) (sizeof(lst_flag) / sizeof(lst_flag[0]))
+
+// Whether the command being run was given --yes
+static int sh_yes = 0;
+
+// Whether the command being run was given --output jsonl,
+// and the writer its rows go to
+static int sh_jsonl = 0;
+static Json_Writer sh_writer;
+
+// Standard input of the shell
+static Reader sh_reader;
+
+// Set while replaying a journal, prompts then read EOF
+static int sh_replaying = 0;
+
+// History of the session, if any
+static Journal *sh_journal = NULL;
+
+// Memory of the arguments of the current command
+static Arena sh_arena;
+
+// Perfect hash tables of commands and sub-commands
+static Dispatch cmd_dispatch;
+static Dispatch sub_cmd_dispatch;
+
 // Array of pointers to command
 static int (*cmd_func[]) (int, char **) = {
     &wallet_cmd,
@@ -38,6 +111,22 @@ static int (*cmd_func[]) (int, char **) = {
     &transaction_cmd,
     &export_transactions,
     &categories_overview,
+    &consolidate_ledgers,
+    &backup_database,
+    &restore_database,
+    &explain_command,
+    &cache_command,
+    &report_command,
+    &recurring_command,
+    &transfer_command,
+    &archive_command,
+    &replay_command,
+    &undo_command,
+    &redo_command,
+    &changes_command,
+    &mem_command,
+    &budget_command,
+    &fx_command,
     &sh_help,
     &sh_exit
 };
@@ -59,85 +148,194 @@ static int (*sh_cmd_help[]) (void) = {
     &category_help,
     &transaction_help,
     &export_help,
-    &overview_help
+    &overview_help,
+    &consolidate_help,
+    &backup_help,
+    &restore_help,
+    &explain_help,
+    &cache_help,
+    &report_help,
+    &recurring_help,
+    &transfer_help,
+    &archive_help,
+    &replay_help,
+    &undo_help,
+    &redo_help,
+    &changes_help,
+    &mem_help,
+    &budget_help,
+    &fx_help
 };
 
-// sh_read_line allocates a memory space to store a string.
+// sh_read_line reads the next line of the standard input.
+// The line is a slice of the reader's buffer which is only valid
+// until the next call, callers copy what they need to keep.
+// At the end of the input the line starts with EOF.
 static char *sh_read_line(void) {
-    int bufsize = SH_BUFFER_SIZE;
-    int position = 0;
-    char *buffer = (char *) malloc(sizeof(char) * bufsize);
-    int c;
-    
-    if (!buffer) {
-        log_fatal("Memory allocation error");
-        exit(1);
+    static char eof[] = { EOF, '\0' };
+    char *line;
+
+    line = sh_replaying ? NULL : reader_line(&sh_reader, NULL);
+
+    if (line == NULL) {
+        return eof;
     }
-    
+
+    return line;
+}
+
+// sh_read_args splits the line into an array of arguments in a
+// single pass. Arguments are slices of the line itself: quotes and
+// escapes are removed in place and each slice is terminated where
+// its delimiter was, so no argument is copied. Double quotes and
+// single quotes group words, a backslash escapes the next character
+// outside single quotes. The array grows in the shell arena.
+static char **sh_read_args(char *line, int *argc) {
+    char **args, **tmpargs;
+    char quote = '\0';
+    int capacity = SH_ARGV_SIZE;
+    int position = 0;
+    size_t r = 0;
+    size_t w = 0;
+    size_t start;
+
+    args = (char **) arena_alloc(&sh_arena, sizeof(char *) * (capacity + 1));
+
     for (;;) {
-        c = getchar();
-        
-        if (c == '\n') {
-            buffer[position] = '\0';
-            return buffer;
-        } else if (c == EOF) {
-            buffer[position] = EOF;
-            return buffer;
-        } else {
-            buffer[position] = c;
-        }
-        position++;
-        
-        // Buffer overflow
-        if (position >= bufsize) {
-            bufsize += SH_BUFFER_SIZE;
-            buffer = (char *) realloc(buffer, bufsize);
-            if (!buffer) {
-                log_fatal("Memory allocation error");
-                exit(1);
+        // Skip delimiters
+        while (line[r] == ' ' || line[r] == '\t' || line[r] == '\r') {
+            r++;
+        }
+
+        if (line[r] == '\0') {
+            break;
+        }
+
+        start = w;
+
+        // Copy the token over itself, dropping quotes and escapes
+        for (; line[r] != '\0'; r++) {
+            if (quote == '\0' && (line[r] == ' ' || line[r] == '\t' || line[r] == '\r')) {
+                break;
             }
+            if (quote != '\'' && line[r] == '\\' && line[r + 1] != '\0') {
+                r++;
+            } else if (quote == '\0' && (line[r] == '"' || line[r] == '\'')) {
+                quote = line[r];
+                continue;
+            } else if (quote != '\0' && line[r] == quote) {
+                quote = '\0';
+                continue;
+            }
+            line[w++] = line[r];
+        }
+
+        if (line[r] != '\0') {
+            r++;
+        }
+        line[w++] = '\0';
+
+        if (position == capacity) {
+            capacity *= 2;
+            tmpargs = (char **) arena_alloc(&sh_arena, sizeof(char *) * (capacity + 1));
+            memcpy(tmpargs, args, sizeof(char *) * position);
+            args = tmpargs;
         }
+
+        args[position++] = line + start;
+    }
+
+    if (quote != '\0') {
+        pretty_fail("Missing closing quote %c", quote);
+        position = 0;
     }
+
+    args[position] = NULL;
+
+    *argc = position;
+
+    return args;
 }
 
-// sh_read_args splits the string into an array of strings.
-static char **sh_read_args(char *line, int *argc) {
-    char **args;
-    char *token;
-    int position = 0;
+// clear_args releases the shell arguments.
+static void clear_args(void) {
+    arena_reset(&sh_arena);
+}
 
-    // Create array of pointers to string
-    args = (char **) malloc(sizeof(char *) * SH_ARGV_SIZE);
+// sh_option returns the value following an option such as
+// "--pages" in the shell arguments, or NULL if it is missing.
+static char *sh_option(int argc, char **args, const char *name) {
+    int i;
 
-    if (!args) {
-        log_fatal("Memory allocation error");
-        exit(1);
+    for (i = 0; i < argc - 1; i++) {
+        if (strcmp(args[i], name) == 0) {
+            return args[i + 1];
+        }
     }
 
-    // Tokenize line
-    token = strtok(line, " \t");
-    while (token != NULL) {
-        args[position] = (char *) malloc(sizeof(char) * SH_BUFFER_SIZE);
-        strcpy(args[position], token);
+    return NULL;
+}
+
+// sh_flag checks if an option which takes no value, such as
+// "--yes", is in the shell arguments.
+static int sh_flag(int argc, char **args, const char *name) {
+    int i;
 
-        token = strtok(NULL, " \t");
-        position++;
+    for (i = 0; i < argc; i++) {
+        if (strcmp(args[i], name) == 0) {
+            return 1;
+        }
     }
 
-    *argc = position;
+    return 0;
+}
 
-    return args;
+// sh_is_flag checks if an argument is an option which takes no value.
+static int sh_is_flag(const char *arg) {
+    int i;
+
+    for (i = 0; i < NUM_SH_FLAG; i++) {
+        if (strcmp(arg, lst_flag[i]) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
 }
 
-// clear_args frees memory space occupied by the
-// shell arguments.
-static void clear_args(int argc, char **args) {
+// sh_confirm asks a yes/no question, unless the command
+// was given --yes.
+static int sh_confirm(const char *question) {
+    char *line;
+
+    if (sh_yes) {
+        return 1;
+    }
+
+    printf("%s (y/n)? ", question);
+    line = sh_read_line();
+
+    return line[0] == 'y' || line[0] == 'Y';
+}
+
+// sh_positional returns the n-th shell argument which is neither
+// an option nor the value of an option, or NULL if it is missing.
+static char *sh_positional(int argc, char **args, int n) {
     int i;
 
     for (i = 0; i < argc; i++) {
-        free(args[i]);
+        if (strncmp(args[i], "--", 2) == 0) {
+            if (!sh_is_flag(args[i])) {
+                i++;
+            }
+            continue;
+        }
+        if (n-- == 0) {
+            return args[i];
+        }
     }
-    free(args);
+
+    return NULL;
 }
 
 // sh_is_int checks if the string is an integer.
@@ -166,6 +364,45 @@ static int sh_is_int(char *line) {
     return 1;
 }
 
+// sh_is_date checks if the string is a YYYY-MM-DD date.
+static int sh_is_date(char *line) {
+    int i;
+
+    for (i = 0; i < 10; i++) {
+        if (i == 4 || i == 7) {
+            if (line[i] != '-') {
+                return 0;
+            }
+        } else if (!isdigit((unsigned char) line[i])) {
+            return 0;
+        }
+    }
+
+    return line[10] == '\0';
+}
+
+// sh_is_currency checks if the string is an ISO 4217 currency code,
+// such as EUR, and makes it upper case.
+static int sh_is_currency(char *line) {
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        if (!isalpha((unsigned char) line[i])) {
+            return 0;
+        }
+    }
+
+    if (line[3] != '\0') {
+        return 0;
+    }
+
+    for (i = 0; i < 3; i++) {
+        line[i] = toupper((unsigned char) line[i]);
+    }
+
+    return 1;
+}
+
 // sh_is_float checks if the string is a float.
 static int sh_is_float(char *line) {
     int i;
@@ -197,7 +434,7 @@ static int sh_is_float(char *line) {
 static int create_wallet(Wallet *wallet) {
     int status;
 
-    status = add_wallet(wallet);
+    status = add_wallet(handler, wallet);
 
     if (status == SQLITE_OK) {
         pretty_success("Create wallet \"%s\" successfully", wallet->name);
@@ -212,7 +449,7 @@ static int create_wallet(Wallet *wallet) {
 static int create_category(Category *category) {
     int status;
 
-    status = add_category(category);
+    status = add_category(handler, category);
 
     if (status == SQLITE_OK) {
         pretty_success("Create category \"%s\" successfully", category->name);
@@ -227,7 +464,7 @@ static int create_category(Category *category) {
 static int create_transaction(Transaction *transaction) {
     int status;
 
-    status = add_transaction(transaction);
+    status = add_transaction(handler, transaction);
 
     if (status == SQLITE_OK) {
         pretty_success("Create transaction \"%s\" successfully", transaction->name);
@@ -242,14 +479,33 @@ static int create_transaction(Transaction *transaction) {
 static int show_wallets(Wallet *wallet) {
     Queue *records, *tmprecord;
 
-    records = get_wallets(wallet);
+    records = get_wallets(handler, wallet);
+
+    if (handler->fx.missing > 0) {
+        pretty_warning("%u daily amounts have no exchange rate and were left out, see help fx", handler->fx.missing);
+    }
+
+    if (sh_jsonl) {
+        for (tmprecord = records; tmprecord != NULL; tmprecord = tmprecord->next) {
+            jsonl_begin(&sh_writer);
+            jsonl_int(&sh_writer, "id", tmprecord->record.wallet.id);
+            jsonl_string(&sh_writer, "name", tmprecord->record.wallet.name);
+            jsonl_double(&sh_writer, "balance", tmprecord->record.wallet.balance);
+            jsonl_string(&sh_writer, "currency", tmprecord->record.wallet.currency);
+            jsonl_end(&sh_writer);
+        }
+        clear_queue(records);
+        return 1;
+    }
+
     tmprecord = records;
     printf("\n+--id--|--------------name--------------|-----balance----+\n");
     while (tmprecord != NULL) {
-        printf("|%-6u|%-32.32s|%16.2lf|\n",
+        printf("|%-6u|%-32.32s|%12.2lf %-3.3s|\n",
             tmprecord->record.wallet.id,
             tmprecord->record.wallet.name,
-            tmprecord->record.wallet.balance
+            tmprecord->record.wallet.balance,
+            tmprecord->record.wallet.currency
         );
         tmprecord = tmprecord->next;
     }
@@ -265,7 +521,19 @@ static int show_wallets(Wallet *wallet) {
 static int show_categories(Category *category) {
     Queue *records, *tmprecord;
     
-    records = get_categories(category);
+    records = get_categories(handler, category);
+
+    if (sh_jsonl) {
+        for (tmprecord = records; tmprecord != NULL; tmprecord = tmprecord->next) {
+            jsonl_begin(&sh_writer);
+            jsonl_int(&sh_writer, "id", tmprecord->record.category.id);
+            jsonl_string(&sh_writer, "name", tmprecord->record.category.name);
+            jsonl_end(&sh_writer);
+        }
+        clear_queue(records);
+        return 1;
+    }
+
     tmprecord = records;
     printf("\n+--id--|--------------name--------------+\n");
     while (tmprecord != NULL) {
@@ -285,26 +553,89 @@ static int show_categories(Category *category) {
 
 // show_transactions displays and formats transactions.
 static int show_transactions(Transaction *transaction) {
-    Queue *records, *tmprecord;
-    
-    records = get_transactions(transaction);
-    tmprecord = records;
-    printf("\n+--id--|------name------|----------description----------|----amount----|-----wallet----|----category----+\n");
-    while (tmprecord != NULL) {
-        printf("|%-6u|%-16.16s|%-31.31s|%14.2lf|%-15.15s|%-16.16s|\n",
-            tmprecord->record.transaction.id,
-            tmprecord->record.transaction.name,
-            tmprecord->record.transaction.description,
-            tmprecord->record.transaction.amount,
-            tmprecord->record.transaction.wallet.name,
-            tmprecord->record.transaction.category.name
-        );
-        tmprecord = tmprecord->next;
+    unsigned int count = 0;
+
+    if (sh_jsonl) {
+        iterate_transactions(handler, transaction, &write_transaction, &count);
+        return 1;
     }
 
-    printf("+-------------------------------------------------------------------------------------------------------+\n");
+    printf("\n+--id--|---date---|------name------|----------description----------|----amount----|-----wallet----|----category----+\n");
 
-    clear_queue(records);
+    iterate_transactions(handler, transaction, &print_transaction, &count);
+
+    printf("+------------------------------------------------------------------------------------------------------------------+\n");
+
+    return 1;
+}
+
+// print_transaction prints a row of show_transactions.
+static int print_transaction(const Transaction *transaction, void *udata) {
+    unsigned int *count = (unsigned int *) udata;
+
+    printf("|%-6u|%-10.10s|%-16.16s|%-31.31s|%10.2lf %-3.3s|%-15.15s|%-16.16s|\n",
+        transaction->id,
+        transaction->date,
+        transaction->name,
+        transaction->description,
+        transaction->amount,
+        transaction->currency,
+        transaction->wallet.name,
+        transaction->category.name
+    );
+
+    (*count)++;
+
+    return 0;
+}
+
+// write_transaction writes a transaction as a JSON line.
+static int write_transaction(const Transaction *transaction, void *udata) {
+    unsigned int *count = (unsigned int *) udata;
+
+    jsonl_begin(&sh_writer);
+    jsonl_int(&sh_writer, "id", transaction->id);
+    jsonl_string(&sh_writer, "date", transaction->date);
+    jsonl_string(&sh_writer, "name", transaction->name);
+    jsonl_string(&sh_writer, "description", transaction->description);
+    jsonl_double(&sh_writer, "amount", transaction->amount);
+    jsonl_string(&sh_writer, "currency", transaction->currency);
+    jsonl_int(&sh_writer, "wallet_id", transaction->wallet.id);
+    jsonl_string(&sh_writer, "wallet", transaction->wallet.name);
+    jsonl_int(&sh_writer, "category_id", transaction->category.id);
+    jsonl_string(&sh_writer, "category", transaction->category.name);
+    jsonl_end(&sh_writer);
+
+    (*count)++;
+
+    return 0;
+}
+
+// show_transactions_between displays transactions dated between
+// two dates, archived or not.
+static int show_transactions_between(char *from, char *to) {
+    unsigned int count = 0;
+
+    if ((from != NULL && !sh_is_date(from)) || (to != NULL && !sh_is_date(to))) {
+        pretty_fail("Invalid date, expected YYYY-MM-DD");
+        return 1;
+    }
+
+    if (sh_jsonl) {
+        if (iterate_transactions_between(handler, from, to, &write_transaction, &count) != SQLITE_OK) {
+            pretty_fail("Failed to read transactions");
+        }
+        return 1;
+    }
+
+    printf("\n+--id--|---date---|------name------|----------description----------|----amount----|-----wallet----|----category----+\n");
+
+    if (iterate_transactions_between(handler, from, to, &print_transaction, &count) != SQLITE_OK) {
+        pretty_fail("Failed to read transactions");
+        return 1;
+    }
+
+    printf("+------------------------------------------------------------------------------------------------------------------+\n");
 
     return 1;
 }
@@ -313,7 +644,7 @@ static int show_transactions(Transaction *transaction) {
 static int delete_wallet(Wallet *wallet) {
     int status;
 
-    status = remove_wallet(wallet);
+    status = remove_wallet(handler, wallet);
 
     if (status == SQLITE_OK) {
         pretty_success("Delete wallet \"%s\" successfully", wallet->name);
@@ -328,106 +659,1929 @@ static int delete_wallet(Wallet *wallet) {
 static int delete_category(Category *category) {
     int status;
 
-    status = remove_category(category);
+    status = remove_category(handler, category);
+
+    if (status == SQLITE_OK) {
+        pretty_success("Delete category \"%s\" successfully", category->name);
+    } else {
+        pretty_fail("Failed to delete a category");
+    }
+
+    return 1;
+}
+
+// delete_transaction deletes the transaction.
+static int delete_transaction(Transaction *transaction) {
+    int status;
+
+    status = remove_transaction(handler, transaction);
+
+    if (status == SQLITE_OK) {
+        pretty_success("Delete transaction \"%s\" successfully", transaction->name);
+    } else {
+        pretty_fail("Failed to delete a transaction");
+    }
+
+    return 1;
+}
+
+// export_columnar_file exports transactions into a columnar file.
+static int export_columnar_file(char *fileName) {
+    uint64_t rows = 0;
+    double elapsed;
+
+    elapsed = monotonic_time();
+
+    if (export_columnar(handler, fileName, COLUMNAR_ROW_GROUP_SIZE, &rows) != SQLITE_OK) {
+        pretty_fail("Failed to export to \"%s\"", fileName);
+        return 1;
+    }
+
+    elapsed = monotonic_time() - elapsed;
+
+    pretty_success("%llu transactions exported to \"%s\" in %.3lfs",
+        (unsigned long long) rows,
+        fileName,
+        elapsed
+    );
+
+    return 1;
+}
+
+// export_transactions exports transactions into a CSV file
+// or a columnar file.
+static int export_transactions(int argc, char **args) {
+    char *fileName;
+    char *format;
+    FILE *outFile;
+    Queue *records, *tmprecords;
+
+    format = sh_option(argc, args, "--format");
+    fileName = sh_positional(argc, args, 0);
+
+    if (fileName == NULL) {
+        printf("File name: ");
+        fileName = sh_read_line();
+        if (fileName[0] == EOF) {
+            return 0;
+        }
+    }
+
+    if (format != NULL && strcmp(format, "columnar") == 0) {
+        return export_columnar_file(fileName);
+    } else if (format != NULL && strcmp(format, "csv") != 0) {
+        pretty_fail("Unknown export format \"%s\"", format);
+        return 1;
+    }
+
+    outFile = fopen(fileName, "w");
+
+    if (outFile == NULL) {
+        log_fatal("Couldn't open file \"%s\"", fileName);
+        return 1;
+    }
+
+    records = get_transactions(handler, NULL);
+    tmprecords = records;
+
+    // The currency is empty for the base one
+    fprintf(outFile, "id,title,description,amount,wallet,category,date,currency\n");
+
+    while (tmprecords != NULL) {
+        fprintf(outFile, "%u,%s,%s,%.2lf,%s,%s,%s,%s\n",
+            tmprecords->record.transaction.id,
+            tmprecords->record.transaction.name,
+            tmprecords->record.transaction.description,
+            tmprecords->record.transaction.amount,
+            tmprecords->record.transaction.wallet.name,
+            tmprecords->record.transaction.category.name,
+            tmprecords->record.transaction.date,
+            tmprecords->record.transaction.currency
+        );
+        tmprecords = tmprecords->next;
+    }
+
+    clear_queue(records);
+
+    fclose(outFile);
+
+    pretty_success("Data exported to \"%s\"", fileName);
+
+    return 1;
+}
+
+// categories_overview displays and format information about categories.
+static int categories_overview(int argc, char **args) {
+    double amount = 0.0L;
+    Queue *records, *tmprecord;
+    
+    records = get_categories_overview(handler, NULL);
+
+    if (handler->fx.missing > 0) {
+        pretty_warning("%u daily amounts have no exchange rate and were left out, see help fx", handler->fx.missing);
+    }
+
+    if (sh_jsonl) {
+        for (tmprecord = records; tmprecord != NULL; tmprecord = tmprecord->next) {
+            jsonl_begin(&sh_writer);
+            jsonl_int(&sh_writer, "id", tmprecord->record.category.id);
+            jsonl_string(&sh_writer, "name", tmprecord->record.category.name);
+            jsonl_double(&sh_writer, "amount", tmprecord->record.category.amount);
+            jsonl_end(&sh_writer);
+        }
+        clear_queue(records);
+        return 1;
+    }
+
+    tmprecord = records;
+    printf("\n+--id--|--------------name--------------|-----amount----+\n");
+    while (tmprecord != NULL) {
+        printf("|%-6u|%-32.32s|%15.2lf|\n",
+            tmprecord->record.category.id,
+            tmprecord->record.category.name,
+            tmprecord->record.category.amount
+        );
+        amount += tmprecord->record.category.amount;
+        tmprecord = tmprecord->next;
+    }
+
+    printf("+------|--------------------------------|-----amount----+\n");
+
+    printf("|%-6u|%-32.32s|%15.2lf|\n", 0, "Total", amount);
+
+    printf("+-------------------------------------------------------+\n");
+
+    clear_queue(records);
+
+    return 1;
+}
+
+// consolidate_ledgers displays wallet balances and category totals
+// added up across several database files. Wallets are totalled per
+// currency.
+static int consolidate_ledgers(int argc, char **args) {
+    double amount;
+    Consolidation result;
+    Queue *tmprecord, *other;
+
+    if (argc < 1) {
+        pretty_fail("Expect database files to \"consolidate\"");
+        return 1;
+    }
+
+    if (consolidate(argc, args, &result) != SQLITE_OK) {
+        pretty_fail("Failed to consolidate ledgers");
+        return 1;
+    }
+
+    tmprecord = result.wallets;
+    printf("\n+-------------------------wallet------------------------+\n");
+    while (tmprecord != NULL) {
+        printf("|%-39.39s|%11.2lf %-3.3s|\n",
+            tmprecord->record.wallet.name,
+            tmprecord->record.wallet.balance,
+            tmprecord->record.wallet.currency
+        );
+        tmprecord = tmprecord->next;
+    }
+    printf("+---------------------------------------|---------------+\n");
+
+    // One total per currency, at its first wallet
+    for (tmprecord = result.wallets; tmprecord != NULL; tmprecord = tmprecord->next) {
+        for (other = result.wallets; other != tmprecord; other = other->next) {
+            if (strcmp(other->record.wallet.currency, tmprecord->record.wallet.currency) == 0) {
+                break;
+            }
+        }
+        if (other != tmprecord) {
+            continue;
+        }
+
+        amount = 0.0L;
+        for (; other != NULL; other = other->next) {
+            if (strcmp(other->record.wallet.currency, tmprecord->record.wallet.currency) == 0) {
+                amount += other->record.wallet.balance;
+            }
+        }
+        printf("|%-39.39s|%11.2lf %-3.3s|\n", "Total", amount, tmprecord->record.wallet.currency);
+    }
+
+    if (result.wallets == NULL) {
+        printf("|%-39.39s|%15.2lf|\n", "Total", 0.0);
+    }
+    printf("+-------------------------------------------------------+\n");
+
+    amount = 0.0L;
+    tmprecord = result.categories;
+    printf("\n+------------------------category-----------------------+\n");
+    while (tmprecord != NULL) {
+        printf("|%-39.39s|%15.2lf|\n",
+            tmprecord->record.category.name,
+            tmprecord->record.category.amount
+        );
+        amount += tmprecord->record.category.amount;
+        tmprecord = tmprecord->next;
+    }
+    printf("+---------------------------------------|---------------+\n");
+    printf("|%-39.39s|%15.2lf|\n", "Total", amount);
+    printf("+-------------------------------------------------------+\n");
+
+    if (result.failures > 0) {
+        pretty_warning("%u of %d ledgers could not be read", result.failures, argc);
+    } else {
+        pretty_info("%u ledgers consolidated", result.ledgers);
+    }
+
+    clear_consolidation(&result);
+
+    return 1;
+}
+
+// copy_progress displays the progress of a backup or a restore.
+static void copy_progress(int remaining, int pagecount, void *udata) {
+    *(int *) udata = pagecount;
+
+    if (pagecount > 0) {
+        printf("\r%d/%d pages", pagecount - remaining, pagecount);
+        fflush(stdout);
+    }
+}
+
+// copy_database backs up the database into a file or restores it
+// from a file, while the database stays available.
+static int copy_database(int restore, int argc, char **args) {
+    int status;
+    int pages = BACKUP_PAGES;
+    int sleep_ms = BACKUP_SLEEP;
+    int pagecount = 0;
+    char *option;
+    double elapsed;
+
+    if (argc < 1 || strncmp(args[0], "--", 2) == 0) {
+        pretty_fail("Expect a file to \"%s\"", restore ? "restore" : "backup");
+        return 1;
+    }
+
+    option = sh_option(argc, args, "--pages");
+    if (option != NULL && sh_is_int(option)) {
+        pages = atoi(option);
+    }
+
+    option = sh_option(argc, args, "--sleep");
+    if (option != NULL && sh_is_int(option)) {
+        sleep_ms = atoi(option);
+    }
+
+    elapsed = monotonic_time();
+
+    if (restore) {
+        status = restore_db(handler, args[0], pages, sleep_ms, &copy_progress, &pagecount);
+    } else {
+        status = backup_db(handler, args[0], pages, sleep_ms, &copy_progress, &pagecount);
+    }
+
+    elapsed = monotonic_time() - elapsed;
+
+    if (pagecount > 0) {
+        printf("\n");
+    }
+
+    if (status != SQLITE_OK) {
+        pretty_fail("Failed to %s \"%s\"", restore ? "restore" : "back up", args[0]);
+        return 1;
+    }
+
+    if (restore) {
+        pretty_success("Database restored from \"%s\"", args[0]);
+    } else {
+        pretty_success("Database backed up to \"%s\"", args[0]);
+    }
+    pretty_info("%d pages in %.3lfs (%.0lf pages/s)",
+        pagecount,
+        elapsed,
+        elapsed > 0 ? pagecount / elapsed : 0.0
+    );
+
+    return 1;
+}
+
+// backup_database takes a snapshot of the database.
+static int backup_database(int argc, char **args) {
+    return copy_database(0, argc, args);
+}
+
+// restore_database restores the database from a snapshot.
+static int restore_database(int argc, char **args) {
+    return copy_database(1, argc, args);
+}
+
+// explain_stmts lists the statements a command runs. Balances
+// and overviews are converted only once the ledger has currencies,
+// and consolidate runs either variant depending on each ledger.
+// It returns the number of statements written into stmts.
+static int explain_stmts(int argc, char **args, DB_STMT *stmts) {
+    int cmd;
+    int sub;
+    int fx;
+    int (*sub_cmd)(RECORD_TYPES, Record *);
+
+    cmd = dispatch_lookup(&cmd_dispatch, args[0]);
+
+    if (cmd < 0) {
+        return 0;
+    }
+
+    fx = has_currencies(handler);
+
+    if (cmd_func[cmd] == &categories_overview) {
+        stmts[0] = fx ? STMT_GET_CATEGORIES_OVERVIEW_FX : STMT_GET_CATEGORIES_OVERVIEW;
+        return 1;
+    } else if (cmd_func[cmd] == &consolidate_ledgers) {
+        stmts[0] = STMT_GET_WALLETS;
+        stmts[1] = STMT_GET_WALLETS_FX;
+        stmts[2] = STMT_GET_CATEGORIES_OVERVIEW;
+        stmts[3] = STMT_GET_CATEGORIES_OVERVIEW_FX;
+        return 4;
+    } else if (cmd_func[cmd] == &export_transactions) {
+        stmts[0] = STMT_GET_TRANSACTIONS;
+        return 1;
+    } else if (cmd_func[cmd] == &report_command) {
+        stmts[0] = STMT_GET_CASH_FLOWS;
+        return 1;
+    }
+
+    if (argc < 2) {
+        return 0;
+    }
+
+    sub = dispatch_lookup(&sub_cmd_dispatch, args[1]);
+
+    if (sub < 0) {
+        return 0;
+    }
+
+    sub_cmd = sub_cmd_func[sub];
+
+    if (cmd_func[cmd] == &wallet_cmd) {
+        if (sub_cmd == &create_record) {
+            stmts[0] = STMT_ADD_WALLET;
+            return 1;
+        } else if (sub_cmd == &show_record) {
+            stmts[0] = fx ? STMT_GET_WALLETS_FX : STMT_GET_WALLETS;
+            return 1;
+        }
+        stmts[0] = STMT_REMOVE_WALLET_TRANSACTIONS;
+        stmts[1] = STMT_REMOVE_WALLET;
+        return 2;
+    } else if (cmd_func[cmd] == &category_cmd) {
+        if (sub_cmd == &create_record) {
+            stmts[0] = STMT_ADD_CATEGORY;
+            return 1;
+        } else if (sub_cmd == &show_record) {
+            stmts[0] = STMT_GET_CATEGORIES;
+            return 1;
+        }
+        stmts[0] = STMT_UNSET_CATEGORY;
+        stmts[1] = STMT_REMOVE_CATEGORY;
+        return 2;
+    } else if (cmd_func[cmd] == &transaction_cmd) {
+        if (sub_cmd == &create_record) {
+            stmts[0] = STMT_ADD_TRANSACTION;
+            return 1;
+        } else if (sub_cmd == &show_record) {
+            stmts[0] = STMT_GET_TRANSACTIONS;
+            return 1;
+        }
+        stmts[0] = STMT_REMOVE_TRANSACTION;
+        return 1;
+    }
+
+    return 0;
+}
+
+// explain_command displays the query plans of a command.
+static int explain_command(int argc, char **args) {
+    int i;
+    int count;
+    char *plan;
+    DB_STMT stmts[NUM_DB_STMT];
+
+    if (argc < 1) {
+        pretty_fail("Expect a command to \"explain\"");
+        return 1;
+    }
+
+    count = explain_stmts(argc, args, stmts);
+
+    if (count == 0) {
+        pretty_fail("No query to explain for \"%s\"", args[0]);
+        return 1;
+    }
+
+    for (i = 0; i < count; i++) {
+        plan = get_query_plan(handler, stmts[i]);
+        printf("\n%s\n\n%s", get_query_sql(stmts[i]), plan != NULL ? plan : "");
+        sqlite3_free(plan);
+    }
+    printf("\n");
+
+    return 1;
+}
+
+// cache_command manages the transactions cache.
+static int cache_command(int argc, char **args) {
+    int status;
+
+    if (argc < 1 || strcmp(args[0], "status") == 0) {
+        if (handler->cache == NULL) {
+            pretty_info("Cache is disabled");
+        } else {
+            pretty_info("Cache holds %llu transactions (%s)",
+                (unsigned long long) handler->cache->header->count,
+                is_cache_fresh(handler) ? "up to date" : "stale, using SQL"
+            );
+        }
+        pretty_info("Query results: %llu hits, %llu misses",
+            handler->results.hits,
+            handler->results.misses
+        );
+        return 1;
+    }
+
+    if (strcmp(args[0], "off") == 0) {
+        disable_cache(handler);
+        pretty_success("Cache disabled");
+        return 1;
+    }
+
+    if (strcmp(args[0], "on") == 0) {
+        status = enable_cache(handler);
+    } else if (strcmp(args[0], "rebuild") == 0) {
+        status = rebuild_cache(handler);
+    } else {
+        pretty_fail("Invalid command \"%s\" for cache", args[0]);
+        return 1;
+    }
+
+    if (status == SQLITE_OK) {
+        pretty_success("Cache holds %llu transactions",
+            (unsigned long long) handler->cache->header->count
+        );
+    } else {
+        pretty_fail("Failed to build the cache");
+    }
+
+    return 1;
+}
+
+// show_top displays the groups of transactions that spent the most.
+static int show_top(int argc, char **args) {
+    int i;
+    int n = REPORT_TOP_N;
+    char *by, *count;
+    REPORT_GROUP group = GROUP_CATEGORY;
+    Top_Heap heap;
+
+    by = sh_option(argc, args, "--by");
+    count = sh_option(argc, args, "--n");
+
+    if (by == NULL || strcmp(by, "category") == 0) {
+        group = GROUP_CATEGORY;
+    } else if (strcmp(by, "wallet") == 0) {
+        group = GROUP_WALLET;
+    } else if (strcmp(by, "name") == 0) {
+        group = GROUP_NAME;
+    } else {
+        pretty_fail("Can't group by \"%s\"", by);
+        return 1;
+    }
+
+    if (count != NULL) {
+        if (!sh_is_int(count) || (n = atoi(count)) <= 0) {
+            pretty_fail("Expect a positive number for --n");
+            return 1;
+        }
+    }
+
+    top_init(&heap, n);
+
+    if (report_top(handler, group, &heap) != SQLITE_OK) {
+        pretty_fail("Failed to read transactions");
+        top_free(&heap);
+        return 1;
+    }
+
+    if (handler->fx.missing > 0) {
+        pretty_warning("%u amounts have no exchange rate and were left out, see help fx", handler->fx.missing);
+    }
+
+    if (sh_jsonl) {
+        for (i = 0; i < heap.size; i++) {
+            jsonl_begin(&sh_writer);
+            jsonl_int(&sh_writer, "rank", i + 1);
+            jsonl_string(&sh_writer, "name", heap.entries[i].name);
+            jsonl_int(&sh_writer, "count", heap.entries[i].count);
+            jsonl_double(&sh_writer, "spent", heap.entries[i].amount);
+            jsonl_end(&sh_writer);
+        }
+        top_free(&heap);
+        return 1;
+    }
+
+    printf("\n+-rank-|--------------name--------------|-count-|------spent----+\n");
+    for (i = 0; i < heap.size; i++) {
+        printf("|%-6d|%-32.32s|%7u|%15.2lf|\n",
+            i + 1,
+            heap.entries[i].name,
+            heap.entries[i].count,
+            heap.entries[i].amount
+        );
+    }
+    printf("+---------------------------------------------------------------+\n");
+
+    top_free(&heap);
+
+    return 1;
+}
+
+// show_percentiles displays approximate percentiles of amounts.
+static int show_percentiles(int argc, char **args) {
+    int i;
+    char *field;
+    Sketch *sketch;
+    const char *labels[] = { "min", "p50", "p90", "p95", "p99", "max" };
+    const double quantiles[] = { 0.0, 0.5, 0.9, 0.95, 0.99, 1.0 };
+
+    field = sh_option(argc, args, "--field");
+
+    if (field != NULL && strcmp(field, "amount") != 0) {
+        pretty_fail("No percentiles for field \"%s\"", field);
+        return 1;
+    }
+
+    sketch = (Sketch *) malloc(sizeof(Sketch));
+
+    if (!sketch) {
+        log_fatal("Memory allocation error");
+        exit(1);
+    }
+
+    sketch_init(sketch, SKETCH_ACCURACY);
+
+    if (report_percentiles(handler, sketch) != SQLITE_OK) {
+        pretty_fail("Failed to read transactions");
+        free(sketch);
+        return 1;
+    }
+
+    if (handler->fx.missing > 0) {
+        pretty_warning("%u amounts have no exchange rate and were left out, see help fx", handler->fx.missing);
+    }
+
+    // A single object, keyed by percentile
+    if (sh_jsonl) {
+        jsonl_begin(&sh_writer);
+        jsonl_int(&sh_writer, "count", (long long) sketch->count);
+        for (i = 0; i < (int) (sizeof(quantiles) / sizeof(quantiles[0])); i++) {
+            jsonl_double(&sh_writer, labels[i], sketch_quantile(sketch, quantiles[i]));
+        }
+        jsonl_end(&sh_writer);
+        free(sketch);
+        return 1;
+    }
+
+    printf("\n+-percentile-|-----amount----+\n");
+    for (i = 0; i < (int) (sizeof(quantiles) / sizeof(quantiles[0])); i++) {
+        printf("|%-12s|%15.2lf|\n", labels[i], sketch_quantile(sketch, quantiles[i]));
+    }
+    printf("+------------|-----amount----+\n");
+    printf("|%-12s|%15llu|\n", "count", (unsigned long long) sketch->count);
+    printf("+----------------------------+\n");
+
+    free(sketch);
+
+    return 1;
+}
+
+// report_command displays spending reports.
+static int report_command(int argc, char **args) {
+    if (argc < 1) {
+        pretty_fail("Expect a report, see help report");
+        return 1;
+    }
+
+    if (strcmp(args[0], "top") == 0) {
+        return show_top(argc - 1, args + 1);
+    } else if (strcmp(args[0], "percentiles") == 0) {
+        return show_percentiles(argc - 1, args + 1);
+    }
+
+    pretty_fail("Invalid command \"%s\" for report", args[0]);
+
+    return 1;
+}
+
+// parse_recurring create a recurring transaction structure from
+// shell arguments. It returns 0 if an argument is invalid.
+static int parse_recurring(int argc, char **args, Recurring *recurring) {
+    int i;
+    int rule;
+    char *arg;
+    Queue *wallets;
+    Queue *categories;
+    Wallet wallet;
+    Category category;
+
+    // Looked up by name only
+    memset(&wallet, 0, sizeof(Wallet));
+    memset(&category, 0, sizeof(Category));
+
+    for (i = 0; (arg = sh_positional(argc, args, i)) != NULL; i++) {
+        switch (i) {
+            // Name
+            case 0:
+                snprintf(recurring->name, sizeof(recurring->name), "%s", arg);
+                break;
+            // Description
+            case 1:
+                snprintf(recurring->description, sizeof(recurring->description), "%s", arg);
+                break;
+            // Amount
+            case 2:
+                if (!sh_is_float(arg)) {
+                    pretty_fail("Invalid amount \"%s\"", arg);
+                    return 0;
+                }
+                recurring->amount = atof(arg);
+                break;
+            // Wallet
+            case 3:
+                snprintf(wallet.name, sizeof(wallet.name), "%s", arg);
+                wallets = get_wallets(handler, &wallet);
+                if (wallets == NULL) {
+                    pretty_fail("Wallet \"%s\" doesn't exist", arg);
+                    return 0;
+                }
+                recurring->wallet = wallets->record.wallet;
+                clear_queue(wallets);
+                break;
+            // Category
+            case 4:
+                snprintf(category.name, sizeof(category.name), "%s", arg);
+                categories = get_categories(handler, &category);
+                if (categories == NULL) {
+                    pretty_fail("Category \"%s\" doesn't exist", arg);
+                    return 0;
+                }
+                recurring->category = categories->record.category;
+                clear_queue(categories);
+                break;
+            default:
+                break;
+        }
+    }
+
+    if (i < 4) {
+        pretty_fail("Expect a name, a description, an amount and a wallet");
+        return 0;
+    }
+
+    // Schedule
+    arg = sh_option(argc, args, "--every");
+    if (arg != NULL) {
+        if ((rule = parse_rule(arg)) < 0) {
+            pretty_fail("Invalid schedule \"%s\", expected daily, weekly, monthly or yearly", arg);
+            return 0;
+        }
+        recurring->rule = (RECURRING_RULE) rule;
+    }
+
+    arg = sh_option(argc, args, "--interval");
+    if (arg != NULL) {
+        if (!sh_is_int(arg) || atoi(arg) <= 0) {
+            pretty_fail("Invalid interval \"%s\"", arg);
+            return 0;
+        }
+        recurring->every = atoi(arg);
+    }
+
+    arg = sh_option(argc, args, "--start");
+    if (arg != NULL) {
+        if (!sh_is_date(arg)) {
+            pretty_fail("Invalid date \"%s\", expected YYYY-MM-DD", arg);
+            return 0;
+        }
+        snprintf(recurring->start_date, sizeof(recurring->start_date), "%s", arg);
+    }
+
+    return 1;
+}
+
+// show_recurring displays and formats recurring transactions.
+static int show_recurring(Recurring *recurring) {
+    Queue *records, *tmprecord;
+    char schedule[24];
+
+    records = get_recurring(handler, recurring);
+
+    if (sh_jsonl) {
+        for (tmprecord = records; tmprecord != NULL; tmprecord = tmprecord->next) {
+            jsonl_begin(&sh_writer);
+            jsonl_int(&sh_writer, "id", tmprecord->record.recurring.id);
+            jsonl_string(&sh_writer, "name", tmprecord->record.recurring.name);
+            jsonl_double(&sh_writer, "amount", tmprecord->record.recurring.amount);
+            jsonl_string(&sh_writer, "wallet", tmprecord->record.recurring.wallet.name);
+            jsonl_string(&sh_writer, "category", tmprecord->record.recurring.category.name);
+            jsonl_string(&sh_writer, "rule", rule_name(tmprecord->record.recurring.rule));
+            jsonl_int(&sh_writer, "every", tmprecord->record.recurring.every);
+            jsonl_string(&sh_writer, "next", tmprecord->record.recurring.next_date);
+            jsonl_end(&sh_writer);
+        }
+        clear_queue(records);
+        return 1;
+    }
+
+    tmprecord = records;
+    printf("\n+--id--|------name------|----amount----|-----wallet----|----category----|----schedule----|---next---+\n");
+    while (tmprecord != NULL) {
+        if (tmprecord->record.recurring.every > 1) {
+            snprintf(schedule, sizeof(schedule), "%s x%u",
+                rule_name(tmprecord->record.recurring.rule),
+                tmprecord->record.recurring.every
+            );
+        } else {
+            snprintf(schedule, sizeof(schedule), "%s", rule_name(tmprecord->record.recurring.rule));
+        }
+        printf("|%-6u|%-16.16s|%14.2lf|%-15.15s|%-16.16s|%-16.16s|%-10.10s|\n",
+            tmprecord->record.recurring.id,
+            tmprecord->record.recurring.name,
+            tmprecord->record.recurring.amount,
+            tmprecord->record.recurring.wallet.name,
+            tmprecord->record.recurring.category.name,
+            schedule,
+            tmprecord->record.recurring.next_date
+        );
+        tmprecord = tmprecord->next;
+    }
+
+    printf("+---------------------------------------------------------------------------------------------------+\n");
+
+    clear_queue(records);
+
+    return 1;
+}
+
+// materialize_recurring_transactions inserts the recurring
+// transactions due until --until, today by default.
+static int materialize_recurring_transactions(int argc, char **args) {
+    char *until;
+    unsigned int created;
+    double elapsed;
+
+    until = sh_option(argc, args, "--until");
+
+    if (until != NULL && !sh_is_date(until)) {
+        pretty_fail("Invalid date \"%s\", expected YYYY-MM-DD", until);
+        return 1;
+    }
+
+    elapsed = monotonic_time();
+
+    if (materialize_recurring(handler, until, &created) != SQLITE_OK) {
+        pretty_fail("Failed to materialize recurring transactions");
+        return 1;
+    }
+
+    elapsed = monotonic_time() - elapsed;
+
+    pretty_success("%u transactions created in %.3lfs", created, elapsed);
+
+    return 1;
+}
+
+// recurring_command handles recurring transactions.
+static int recurring_command(int argc, char **args) {
+    int sub;
+    int status;
+    Record record;
+    Queue *records;
+
+    if (argc < 1 || args[0] == NULL) {
+        pretty_fail("Expect argument to \"recurring\"");
+        return 1;
+    }
+
+    memset(&record.recurring, 0, sizeof(Recurring));
+    record.recurring.rule = RULE_MONTHLY;
+    record.recurring.every = 1;
+
+    if (strcmp(args[0], "materialize") == 0) {
+        return materialize_recurring_transactions(argc - 1, args + 1);
+    }
+
+    sub = dispatch_lookup(&sub_cmd_dispatch, args[0]);
+
+    if (sub < 0) {
+        pretty_fail("Invalid command \"%s\" for recurring", args[0]);
+        return 1;
+    }
+
+    if (sub_cmd_func[sub] == &create_record) {
+        if (!parse_recurring(argc - 1, args + 1, &record.recurring)) {
+            return 1;
+        }
+        status = add_recurring(handler, &record.recurring);
+        if (status == SQLITE_OK) {
+            pretty_success("Create recurring transaction \"%s\" successfully", record.recurring.name);
+        } else {
+            pretty_fail("Failed to create recurring transaction \"%s\"", record.recurring.name);
+        }
+        return 1;
+    }
+
+    if (argc > 1) {
+        snprintf(record.recurring.name, sizeof(record.recurring.name), "%s", args[1]);
+    }
+
+    if (sub_cmd_func[sub] == &show_record) {
+        return show_recurring(&record.recurring);
+    }
+
+    records = argc > 1 ? get_recurring(handler, &record.recurring) : NULL;
+
+    if (records == NULL) {
+        pretty_fail("Expect the name of a recurring transaction");
+        return 1;
+    }
+
+    status = remove_recurring(handler, &records->record.recurring);
+    clear_queue(records);
+
+    if (status == SQLITE_OK) {
+        pretty_success("Delete recurring transaction \"%s\" successfully", record.recurring.name);
+    } else {
+        pretty_fail("Failed to delete recurring transaction \"%s\"", record.recurring.name);
+    }
+
+    return 1;
+}
+
+// budget_name describes what a budget counts, its category, its
+// wallet or both.
+static void budget_name(const Budget *budget, char *name, size_t size) {
+    if (budget->wallet.id != 0 && budget->category.id != 0) {
+        snprintf(name, size, "\"%s\" in \"%s\"", budget->category.name, budget->wallet.name);
+    } else if (budget->wallet.id != 0) {
+        snprintf(name, size, "\"%s\"", budget->wallet.name);
+    } else {
+        snprintf(name, size, "\"%s\"", budget->category.name);
+    }
+}
+
+// warn_budget warns that a new transaction crossed the threshold or
+// the limit of a budget.
+static void warn_budget(const Budget *budget, int over, void *udata) {
+    char name[80];
+
+    (void) udata;
+
+    budget_name(budget, name, sizeof(name));
+
+    if (over) {
+        pretty_warning("Budget of %s is over its %s limit: %.2lf of %.2lf since %s",
+            name, rule_name(budget->period), budget->spent, budget->limit, budget->start
+        );
+    } else {
+        pretty_warning("Budget of %s reached %.0lf%% of its %s limit: %.2lf of %.2lf since %s",
+            name, budget->warn * 100.0, rule_name(budget->period), budget->spent, budget->limit, budget->start
+        );
+    }
+}
+
+// parse_budget fills a budget from its options. It returns 0 and
+// explains why if the budget is invalid.
+static int parse_budget(int argc, char **args, Budget *budget) {
+    int rule;
+    char *arg;
+    Queue *wallets;
+    Queue *categories;
+    Wallet wallet;
+    Category category;
+
+    // Looked up by name only
+    memset(&wallet, 0, sizeof(Wallet));
+    memset(&category, 0, sizeof(Category));
+
+    arg = sh_option(argc, args, "--wallet");
+    if (arg != NULL) {
+        snprintf(wallet.name, sizeof(wallet.name), "%s", arg);
+        wallets = get_wallets(handler, &wallet);
+        if (wallets == NULL) {
+            pretty_fail("Wallet \"%s\" doesn't exist", arg);
+            return 0;
+        }
+        budget->wallet = wallets->record.wallet;
+        clear_queue(wallets);
+    }
+
+    arg = sh_option(argc, args, "--category");
+    if (arg != NULL) {
+        snprintf(category.name, sizeof(category.name), "%s", arg);
+        categories = get_categories(handler, &category);
+        if (categories == NULL) {
+            pretty_fail("Category \"%s\" doesn't exist", arg);
+            return 0;
+        }
+        budget->category = categories->record.category;
+        clear_queue(categories);
+    }
+
+    if (budget->wallet.id == 0 && budget->category.id == 0) {
+        pretty_fail("Expect --wallet, --category or both");
+        return 0;
+    }
+
+    arg = sh_option(argc, args, "--limit");
+    if (arg == NULL || !sh_is_float(arg) || (budget->limit = atof(arg)) <= 0.0) {
+        pretty_fail("Expect a positive --limit");
+        return 0;
+    }
+
+    arg = sh_option(argc, args, "--every");
+    if (arg != NULL) {
+        if ((rule = parse_rule(arg)) < 0) {
+            pretty_fail("Invalid period \"%s\", expected daily, weekly, monthly or yearly", arg);
+            return 0;
+        }
+        budget->period = (RECURRING_RULE) rule;
+    }
+
+    arg = sh_option(argc, args, "--warn");
+    if (arg != NULL) {
+        if (!sh_is_float(arg) || atof(arg) <= 0.0 || atof(arg) > 100.0) {
+            pretty_fail("Invalid threshold \"%s\", expected a percent up to 100", arg);
+            return 0;
+        }
+        budget->warn = atof(arg) / 100.0;
+    }
+
+    return 1;
+}
+
+// show_budgets displays and formats budgets, with their spending over
+// the period containing --date, today by default.
+static int show_budgets(int argc, char **args) {
+    Queue *records, *tmprecord;
+    Budget *budget;
+    char *date;
+
+    date = sh_option(argc, args, "--date");
+    if (date != NULL && !sh_is_date(date)) {
+        pretty_fail("Invalid date \"%s\", expected YYYY-MM-DD", date);
+        return 1;
+    }
+
+    records = get_budgets(handler, date);
+
+    if (sh_jsonl) {
+        for (tmprecord = records; tmprecord != NULL; tmprecord = tmprecord->next) {
+            budget = &tmprecord->record.budget;
+            jsonl_begin(&sh_writer);
+            jsonl_int(&sh_writer, "id", budget->id);
+            jsonl_string(&sh_writer, "wallet", budget->wallet.name);
+            jsonl_string(&sh_writer, "category", budget->category.name);
+            jsonl_string(&sh_writer, "period", rule_name(budget->period));
+            jsonl_string(&sh_writer, "start", budget->start);
+            jsonl_double(&sh_writer, "spent", budget->spent);
+            jsonl_double(&sh_writer, "limit", budget->limit);
+            jsonl_double(&sh_writer, "warn", budget->warn);
+            jsonl_end(&sh_writer);
+        }
+        clear_queue(records);
+        return 1;
+    }
+
+    printf("\n+--id--|-----wallet----|----category----|--period--|--start---|----spent-----|----limit-----|-used-+\n");
+    for (tmprecord = records; tmprecord != NULL; tmprecord = tmprecord->next) {
+        budget = &tmprecord->record.budget;
+        printf("|%-6u|%-15.15s|%-16.16s|%-10.10s|%-10.10s|%14.2lf|%14.2lf|%5.0lf%%|%s\n",
+            budget->id,
+            budget->wallet.id != 0 ? budget->wallet.name : "any",
+            budget->category.id != 0 ? budget->category.name : "any",
+            rule_name(budget->period),
+            budget->start,
+            budget->spent,
+            budget->limit,
+            budget->spent * 100.0 / budget->limit,
+            budget->spent >= budget->limit ? " over" :
+                budget->spent >= budget->limit * budget->warn ? " warn" : ""
+        );
+    }
+    printf("+-----------------------------------------------------------------------------------------------+\n");
+
+    clear_queue(records);
+
+    return 1;
+}
+
+// budget_command manages the budgets of wallets and categories.
+static int budget_command(int argc, char **args) {
+    int sub;
+    int status;
+    Budget budget;
+    Queue *records, *tmprecord;
+
+    if (argc < 1 || args[0] == NULL) {
+        pretty_fail("Expect argument to \"budget\"");
+        return 1;
+    }
+
+    sub = dispatch_lookup(&sub_cmd_dispatch, args[0]);
+
+    if (sub < 0) {
+        pretty_fail("Invalid command \"%s\" for budget", args[0]);
+        return 1;
+    }
+
+    if (sub_cmd_func[sub] == &show_record) {
+        return show_budgets(argc - 1, args + 1);
+    }
+
+    memset(&budget, 0, sizeof(Budget));
+    budget.period = RULE_MONTHLY;
+    budget.warn = 0.8;
+
+    if (sub_cmd_func[sub] == &create_record) {
+        if (!parse_budget(argc - 1, args + 1, &budget)) {
+            return 1;
+        }
+        status = add_budget(handler, &budget);
+        if (status == SQLITE_OK) {
+            pretty_success("Create budget %u successfully", budget.id);
+        } else {
+            pretty_fail("Failed to create a budget");
+        }
+        return 1;
+    }
+
+    if (argc < 2 || !sh_is_int(args[1])) {
+        pretty_fail("Expect the id of a budget");
+        return 1;
+    }
+
+    budget.id = atoi(args[1]);
+    records = get_budgets(handler, NULL);
+
+    for (tmprecord = records; tmprecord != NULL; tmprecord = tmprecord->next) {
+        if (tmprecord->record.budget.id == budget.id) {
+            break;
+        }
+    }
+
+    clear_queue(records);
+
+    if (tmprecord == NULL) {
+        pretty_fail("Budget %u doesn't exist", budget.id);
+        return 1;
+    }
+
+    if (remove_budget(handler, &budget) == SQLITE_OK) {
+        pretty_success("Delete budget %u successfully", budget.id);
+    } else {
+        pretty_fail("Failed to delete budget %u", budget.id);
+    }
+
+    return 1;
+}
+
+// show_rates displays and formats exchange rates.
+static int show_rates(const char *currency) {
+    Queue *records, *tmprecord;
+
+    records = get_rates(handler, currency);
+
+    if (sh_jsonl) {
+        for (tmprecord = records; tmprecord != NULL; tmprecord = tmprecord->next) {
+            jsonl_begin(&sh_writer);
+            jsonl_string(&sh_writer, "currency", tmprecord->record.rate.currency);
+            jsonl_string(&sh_writer, "date", tmprecord->record.rate.date);
+            jsonl_double(&sh_writer, "rate", tmprecord->record.rate.rate);
+            jsonl_end(&sh_writer);
+        }
+        clear_queue(records);
+        return 1;
+    }
+
+    printf("\n+-currency-|---date---|------rate------+\n");
+    for (tmprecord = records; tmprecord != NULL; tmprecord = tmprecord->next) {
+        printf("|%-10.10s|%-10.10s|%16.6lf|\n",
+            tmprecord->record.rate.currency,
+            tmprecord->record.rate.date,
+            tmprecord->record.rate.rate
+        );
+    }
+    printf("+-------------------------------------+\n");
+
+    clear_queue(records);
+
+    return 1;
+}
+
+// fx_command manages the exchange rates of currencies.
+static int fx_command(int argc, char **args) {
+    int sub;
+    char *arg;
+    FX_Rate rate;
+    Queue *records;
+
+    if (argc < 1 || args[0] == NULL) {
+        pretty_fail("Expect argument to \"fx\"");
+        return 1;
+    }
+
+    memset(&rate, 0, sizeof(FX_Rate));
+
+    arg = sh_positional(argc - 1, args + 1, 0);
+    if (arg != NULL) {
+        if (!sh_is_currency(arg)) {
+            pretty_fail("Invalid currency \"%s\", expected a code such as EUR", arg);
+            return 1;
+        }
+        snprintf(rate.currency, sizeof(rate.currency), "%s", arg);
+    }
+
+    arg = sh_option(argc - 1, args + 1, "--date");
+    if (arg != NULL) {
+        if (!sh_is_date(arg)) {
+            pretty_fail("Invalid date \"%s\", expected YYYY-MM-DD", arg);
+            return 1;
+        }
+        snprintf(rate.date, sizeof(rate.date), "%s", arg);
+    }
+
+    if (strcmp(args[0], "set") == 0) {
+        arg = sh_positional(argc - 1, args + 1, 1);
+        if (rate.currency[0] == '\0' || arg == NULL || !sh_is_float(arg) || (rate.rate = atof(arg)) <= 0.0) {
+            pretty_fail("Expect a currency and a positive rate");
+            return 1;
+        }
+        if (set_rate(handler, &rate) == SQLITE_OK) {
+            pretty_success("Set the rate of %s successfully", rate.currency);
+        } else {
+            pretty_fail("Failed to set the rate of %s", rate.currency);
+        }
+        return 1;
+    }
+
+    sub = dispatch_lookup(&sub_cmd_dispatch, args[0]);
+
+    if (sub < 0 || sub_cmd_func[sub] == &create_record) {
+        pretty_fail("Invalid command \"%s\" for fx", args[0]);
+        return 1;
+    }
+
+    if (sub_cmd_func[sub] == &show_record) {
+        return show_rates(rate.currency);
+    }
+
+    if (rate.currency[0] == '\0') {
+        pretty_fail("Expect a currency");
+        return 1;
+    }
+
+    records = get_rates(handler, rate.currency);
+    clear_queue(records);
+
+    if (records == NULL) {
+        pretty_fail("%s has no exchange rate", rate.currency);
+        return 1;
+    }
+
+    if (remove_rate(handler, &rate) == SQLITE_OK) {
+        pretty_success("Delete the rates of %s successfully", rate.currency);
+    } else {
+        pretty_fail("Failed to delete the rates of %s", rate.currency);
+    }
+
+    return 1;
+}
+
+// find_wallet looks up a wallet by name in a list of wallets.
+static Wallet *find_wallet(Queue *wallets, const char *name) {
+    for (; wallets != NULL; wallets = wallets->next) {
+        if (strcmp(wallets->record.wallet.name, name) == 0) {
+            return &wallets->record.wallet;
+        }
+    }
+
+    return NULL;
+}
+
+// parse_transfer fills a transfer from the names of its wallets,
+// an amount and an optional date. It returns 0 and explains why
+// if the transfer is invalid.
+static int parse_transfer(Queue *wallets, char *from, char *to, char *amount, char *date, Transfer *transfer) {
+    Wallet *wallet;
+
+    memset(transfer, 0, sizeof(Transfer));
+
+    if ((wallet = find_wallet(wallets, from)) == NULL) {
+        pretty_fail("Wallet \"%s\" doesn't exist", from);
+        return 0;
+    }
+    transfer->from = *wallet;
+
+    if ((wallet = find_wallet(wallets, to)) == NULL) {
+        pretty_fail("Wallet \"%s\" doesn't exist", to);
+        return 0;
+    }
+    transfer->to = *wallet;
+
+    if (transfer->from.id == transfer->to.id) {
+        pretty_fail("Can't transfer from \"%s\" to itself", from);
+        return 0;
+    }
+
+    if (!sh_is_float(amount) || (transfer->amount = atof(amount)) <= 0.0) {
+        pretty_fail("Expect a positive amount, got \"%s\"", amount);
+        return 0;
+    }
+
+    if (date != NULL && date[0] != '\0') {
+        if (!sh_is_date(date)) {
+            pretty_fail("Invalid date \"%s\", expected YYYY-MM-DD", date);
+            return 0;
+        }
+        snprintf(transfer->date, sizeof(transfer->date), "%s", date);
+    }
+
+    return 1;
+}
+
+// transfer_batch reads transfers from a file, one per line as
+// from,to,amount[,date[,description]], and writes them all in a
+// single transaction. Nothing is written if any line is invalid.
+static int transfer_batch(char *fileName) {
+    int fd;
+    int valid = 1;
+    size_t len, count = 0, capacity = 256, lineno = 0;
+    char *line, *fields[5];
+    int nfields;
+    double elapsed;
+    Reader reader;
+    Transfer *transfers;
+    Queue *wallets;
+
+    fd = open(fileName, O_RDONLY);
+
+    if (fd < 0) {
+        pretty_fail("Couldn't open file \"%s\"", fileName);
+        return 1;
+    }
+
+    transfers = (Transfer *) malloc(capacity * sizeof(Transfer));
+
+    if (!transfers) {
+        log_fatal("Memory allocation error");
+        exit(1);
+    }
+
+    wallets = get_wallets(handler, NULL);
+    reader_init(&reader, fd);
+
+    while (valid && (line = reader_line(&reader, &len)) != NULL) {
+        lineno++;
+
+        if (len == 0 || line[0] == '#') {
+            continue;
+        }
+
+        // Split the line in place
+        for (nfields = 0; nfields < 5; nfields++) {
+            fields[nfields] = line;
+            line = nfields < 4 ? strchr(line, ',') : NULL;
+            if (line == NULL) {
+                nfields++;
+                break;
+            }
+            *line++ = '\0';
+        }
+
+        if (nfields < 3) {
+            pretty_fail("Line %zu: expected from,to,amount[,date[,description]]", lineno);
+            valid = 0;
+            break;
+        }
+
+        if (count == capacity) {
+            capacity *= 2;
+            transfers = (Transfer *) realloc(transfers, capacity * sizeof(Transfer));
+            if (!transfers) {
+                log_fatal("Memory allocation error");
+                exit(1);
+            }
+        }
+
+        if (!parse_transfer(wallets, fields[0], fields[1], fields[2], nfields > 3 ? fields[3] : NULL, &transfers[count])) {
+            pretty_fail("Line %zu is invalid, no transfer was made", lineno);
+            valid = 0;
+            break;
+        }
+
+        if (nfields > 4) {
+            snprintf(transfers[count].description, sizeof(transfers[count].description), "%s", fields[4]);
+        }
+
+        count++;
+    }
+
+    reader_free(&reader);
+    close(fd);
+    clear_queue(wallets);
+
+    if (valid) {
+        elapsed = monotonic_time();
+
+        if (add_transfers(handler, transfers, count) == SQLITE_OK) {
+            elapsed = monotonic_time() - elapsed;
+            pretty_success("%zu transfers made in %.3lfs", count, elapsed);
+        } else {
+            pretty_fail("Failed to make transfers, none was made");
+        }
+    }
+
+    free(transfers);
+
+    return 1;
+}
+
+// transfer_command moves money between wallets.
+static int transfer_command(int argc, char **args) {
+    char *from, *to, *amount, *description;
+    Transfer transfer;
+    Queue *wallets;
+
+    from = sh_positional(argc, args, 0);
+
+    if (from != NULL && strcmp(from, "batch") == 0) {
+        if ((from = sh_positional(argc, args, 1)) == NULL) {
+            pretty_fail("Expect a file of transfers");
+            return 1;
+        }
+        return transfer_batch(from);
+    }
+
+    to = sh_positional(argc, args, 1);
+    amount = sh_positional(argc, args, 2);
+
+    if (amount == NULL) {
+        pretty_fail("Expect a wallet to transfer from, a wallet to transfer to and an amount");
+        return 1;
+    }
+
+    wallets = get_wallets(handler, NULL);
+
+    if (!parse_transfer(wallets, from, to, amount, sh_option(argc, args, "--date"), &transfer)) {
+        clear_queue(wallets);
+        return 1;
+    }
+
+    clear_queue(wallets);
+
+    description = sh_option(argc, args, "--description");
+    if (description != NULL) {
+        snprintf(transfer.description, sizeof(transfer.description), "%s", description);
+    }
+
+    if (add_transfer(handler, &transfer) == SQLITE_OK) {
+        pretty_success("Transferred %.2lf from \"%s\" to \"%s\"", transfer.amount, from, to);
+    } else {
+        pretty_fail("Failed to transfer from \"%s\" to \"%s\"", from, to);
+    }
+
+    return 1;
+}
+
+// archive_command moves old transactions into yearly archives.
+static int archive_command(int argc, char **args) {
+    char *before;
+    unsigned int moved, years;
+    double elapsed;
+
+    before = sh_option(argc, args, "--before");
+
+    if (before == NULL || !sh_is_date(before)) {
+        pretty_fail("Expect --before YYYY-MM-DD");
+        return 1;
+    }
+
+    elapsed = monotonic_time();
+
+    if (archive_transactions(handler, before, &moved, &years) != SQLITE_OK) {
+        pretty_fail("Failed to archive transactions, %u were archived before the error", moved);
+        return 1;
+    }
+
+    elapsed = monotonic_time() - elapsed;
+
+    pretty_success("%u transactions archived into %u yearly archives in %.3lfs", moved, years, elapsed);
+
+    return 1;
+}
+
+// apply_changes undoes or redoes the changes of the last commands.
+static int apply_changes(int undo, int argc, char **args) {
+    int n = 1;
+    unsigned int batches, rows;
+    char *count;
+
+    count = sh_positional(argc, args, 0);
+
+    if (count != NULL) {
+        if (!sh_is_int(count) || (n = atoi(count)) < 1) {
+            pretty_fail("Expect a number of commands to %s", undo ? "undo" : "redo");
+            return 1;
+        }
+    }
+
+    if (undo) {
+        if (undo_changes(handler, n, &batches, &rows) != SQLITE_OK) {
+            pretty_fail("Failed to undo, nothing was changed");
+            return 1;
+        }
+    } else {
+        if (redo_changes(handler, n, &batches, &rows) != SQLITE_OK) {
+            pretty_fail("Failed to redo, nothing was changed");
+            return 1;
+        }
+    }
+
+    if (batches == 0) {
+        pretty_info("Nothing to %s", undo ? "undo" : "redo");
+        return 1;
+    }
+
+    pretty_success("%s %u commands (%u changes)", undo ? "Undid" : "Redid", batches, rows);
+
+    return 1;
+}
+
+// undo_command undoes the changes of the last commands.
+static int undo_command(int argc, char **args) {
+    return apply_changes(1, argc, args);
+}
+
+// redo_command redoes the changes of the last commands undone.
+static int redo_command(int argc, char **args) {
+    return apply_changes(0, argc, args);
+}
+
+// Set by SIGINT while changes --follow waits
+static volatile sig_atomic_t sh_interrupted = 0;
+
+// sh_interrupt stops following the change log.
+static void sh_interrupt(int signum) {
+    (void) signum;
+    sh_interrupted = 1;
+}
+
+// print_event prints an event of the change log.
+static int print_event(const Change_Event *event, void *udata) {
+    (void) udata;
+
+    if (sh_jsonl) {
+        jsonl_begin(&sh_writer);
+        jsonl_int(&sh_writer, "seq", event->seq);
+        jsonl_string(&sh_writer, "time", event->time);
+        jsonl_string(&sh_writer, "op", event->op);
+        jsonl_string(&sh_writer, "table", event->table);
+        jsonl_int(&sh_writer, "id", event->row_id);
+        if (event->has_transaction) {
+            jsonl_string(&sh_writer, "date", event->transaction.date);
+            jsonl_string(&sh_writer, "name", event->transaction.name);
+            jsonl_string(&sh_writer, "description", event->transaction.description);
+            jsonl_double(&sh_writer, "amount", event->transaction.amount);
+            jsonl_int(&sh_writer, "wallet_id", event->transaction.wallet.id);
+            jsonl_string(&sh_writer, "wallet", event->transaction.wallet.name);
+            jsonl_int(&sh_writer, "category_id", event->transaction.category.id);
+            jsonl_string(&sh_writer, "category", event->transaction.category.name);
+        }
+        jsonl_end(&sh_writer);
+        return 0;
+    }
+
+    printf("|%-8lld|%-24.24s|%-6.6s|%-12.12s|%-8lld|%-16.16s|%14.2lf|\n",
+        (long long) event->seq,
+        event->time,
+        event->op,
+        event->table,
+        (long long) event->row_id,
+        event->has_transaction ? event->transaction.name : "",
+        event->has_transaction ? event->transaction.amount : 0.0
+    );
+
+    return 0;
+}
+
+// changes_command lists the events of the change log after --since,
+// then with --follow waits for new ones until interrupted.
+static int changes_command(int argc, char **args) {
+    int rc, follow, version = 0, current = 0;
+    sqlite3_int64 since = 0, last;
+    unsigned int pruned;
+    char *option;
+    void (*previous)(int);
+
+    option = sh_option(argc, args, "--prune");
+    if (option != NULL) {
+        if (!sh_is_int(option)) {
+            pretty_fail("Expect --prune SEQ");
+            return 1;
+        }
+        if (prune_change_log(handler, strtoll(option, NULL, 10), &pruned) != SQLITE_OK) {
+            pretty_fail("Failed to prune the change log");
+        } else {
+            pretty_success("%u events pruned", pruned);
+        }
+        return 1;
+    }
+
+    option = sh_option(argc, args, "--since");
+    if (option != NULL) {
+        if (!sh_is_int(option)) {
+            pretty_fail("Expect --since SEQ");
+            return 1;
+        }
+        since = strtoll(option, NULL, 10);
+    }
+
+    follow = sh_flag(argc, args, "--follow");
+
+    if (!sh_jsonl) {
+        printf("\n+--seq---|----------time----------|--op--|----table---|---id---|------name------|----amount----+\n");
+    }
+
+    sh_interrupted = 0;
+    previous = signal(SIGINT, &sh_interrupt);
+
+    data_version(handler, &version);
+
+    for (;;) {
+        rc = iterate_change_log(handler, since, &print_event, NULL, &last);
+        since = last;
+
+        // Another connection is writing, read again once it's done
+        if (rc == SQLITE_BUSY && follow && !sh_interrupted) {
+            sqlite3_sleep(CHANGE_LOG_POLL);
+            continue;
+        }
+
+        if (rc != SQLITE_OK) {
+            pretty_fail("Failed to read the change log");
+            break;
+        }
+
+        if (sh_jsonl) {
+            jsonl_flush(&sh_writer);
+        } else {
+            fflush(stdout);
+        }
+
+        if (!follow) {
+            break;
+        }
+
+        // Wait for another connection to commit
+        while (!sh_interrupted) {
+            rc = data_version(handler, &current);
+            if (rc == SQLITE_OK && current != version) {
+                break;
+            }
+            sqlite3_sleep(CHANGE_LOG_POLL);
+        }
+
+        if (sh_interrupted) {
+            break;
+        }
+
+        version = current;
+    }
+
+    signal(SIGINT, previous);
+
+    if (!sh_jsonl) {
+        printf("+------------------------------------------------------------------------------------------------+\n");
+        pretty_info("Up to seq %lld, use --since %lld to continue", (long long) since, (long long) since);
+    }
+
+    return 1;
+}
+
+// mem_command displays the memory used by the session and sets
+// the limits given.
+static int mem_command(int argc, char **args) {
+    int i, results = 0;
+    long long heap_limit = -1, cache_limit = -1;
+    char *option;
+    DB_Memory mem;
+
+    option = sh_option(argc, args, "--heap-limit");
+    if (option != NULL && (heap_limit = parse_size(option)) < 0) {
+        pretty_fail("Expect --heap-limit SIZE, such as 64M");
+        return 1;
+    }
+
+    option = sh_option(argc, args, "--cache-limit");
+    if (option != NULL && (cache_limit = parse_size(option)) < 0) {
+        pretty_fail("Expect --cache-limit SIZE, such as 2M");
+        return 1;
+    }
+
+    if (set_memory_limits(handler, heap_limit, cache_limit) != SQLITE_OK) {
+        pretty_fail("Failed to set the memory limits");
+        return 1;
+    }
+
+    db_memory(handler, &mem);
+
+    for (i = 0; i < RESULT_CACHE_SIZE; i++) {
+        results += handler->results.entries[i].used;
+    }
+
+    if (sh_jsonl) {
+        jsonl_begin(&sh_writer);
+        jsonl_int(&sh_writer, "sqlite_used", mem.used);
+        jsonl_int(&sh_writer, "sqlite_highwater", mem.highwater);
+        jsonl_int(&sh_writer, "sqlite_allocations", mem.allocations);
+        jsonl_int(&sh_writer, "heap_limit", mem.heap_limit);
+        jsonl_int(&sh_writer, "cache_used", mem.cache_used);
+        jsonl_int(&sh_writer, "cache_limit", mem.cache_limit);
+        jsonl_int(&sh_writer, "schema_used", mem.schema_used);
+        jsonl_int(&sh_writer, "stmt_used", mem.stmt_used);
+        jsonl_int(&sh_writer, "mapped", (long long) mem.mapped);
+        jsonl_int(&sh_writer, "records_used", (long long) mem.queue_used);
+        jsonl_int(&sh_writer, "records_highwater", (long long) mem.queue_highwater);
+        jsonl_int(&sh_writer, "results", results);
+        jsonl_int(&sh_writer, "arena_allocated", (long long) sh_arena.allocated);
+        jsonl_int(&sh_writer, "reader", (long long) sh_reader.size);
+        jsonl_int(&sh_writer, "writer", (long long) sizeof(sh_writer.buffer));
+        jsonl_end(&sh_writer);
+        return 1;
+    }
+
+    printf("\n+------------------------|-----used-----|---highwater---|-----limit----+\n");
+    printf("|%-24s|%14.1lf|%14.1lf|", "SQLite heap", mem.used / 1024.0, mem.highwater / 1024.0);
+    if (mem.heap_limit > 0) {
+        printf("%14.1lf|\n", mem.heap_limit / 1024.0);
+    } else {
+        printf("%14s|\n", "none");
+    }
+    printf("|%-24s|%14.1lf|%14s|%14.1lf|\n", "Page cache", mem.cache_used / 1024.0, "", mem.cache_limit / 1024.0);
+    printf("|%-24s|%14.1lf|%14s|%14s|\n", "Schema", mem.schema_used / 1024.0, "", "");
+    printf("|%-24s|%14.1lf|%14s|%14s|\n", "Prepared statements", mem.stmt_used / 1024.0, "", "");
+    printf("|%-24s|%14.1lf|%14s|%14s|\n", "Transactions cache", mem.mapped / 1024.0, "", "");
+    printf("|%-24s|%14.1lf|%14.1lf|%14s|\n", "Lists of records", mem.queue_used / 1024.0, mem.queue_highwater / 1024.0, "");
+    printf("|%-24s|%14.1lf|%14s|%14s|\n", "Arguments arena", sh_arena.allocated / 1024.0, "", "");
+    printf("|%-24s|%14.1lf|%14s|%14s|\n", "Input and output", (sh_reader.size + sizeof(sh_writer.buffer)) / 1024.0, "", "");
+    printf("+----------------------------------------------------------------------+\n");
+    pretty_info("%lld allocations by SQLite, %d query results kept", (long long) mem.allocations, results);
+
+    return 1;
+}
+
+// read_journal reads the entries of a journal, and the path of the
+// snapshot they start from, empty if none was recorded. Commands are
+// allocated and must be freed along with the entries.
+static Journal_Entry *read_journal(const char *path, size_t *count, char *snapshot, size_t size) {
+    int fd;
+    size_t len, capacity = 256;
+    char *line;
+    const char *recorded;
+    Reader reader;
+    Journal_Entry entry;
+    Journal_Entry *entries;
+
+    *count = 0;
+    snapshot[0] = '\0';
+
+    fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        return NULL;
+    }
+
+    entries = (Journal_Entry *) malloc(capacity * sizeof(Journal_Entry));
+
+    if (!entries) {
+        log_fatal("Memory allocation error");
+        exit(1);
+    }
+
+    reader_init(&reader, fd);
+
+    while ((line = reader_line(&reader, &len)) != NULL) {
+        recorded = journal_parse_snapshot(line);
+        if (recorded != NULL && snapshot[0] == '\0') {
+            snprintf(snapshot, size, "%s", recorded);
+        }
+
+        if (!journal_parse(line, &entry)) {
+            continue;
+        }
+
+        if (*count == capacity) {
+            capacity *= 2;
+            entries = (Journal_Entry *) realloc(entries, capacity * sizeof(Journal_Entry));
+            if (!entries) {
+                log_fatal("Memory allocation error");
+                exit(1);
+            }
+        }
+
+        entry.command = strdup(entry.command);
+
+        if (!entry.command) {
+            log_fatal("Memory allocation error");
+            exit(1);
+        }
+
+        entries[(*count)++] = entry;
+    }
+
+    reader_free(&reader);
+    close(fd);
+
+    return entries;
+}
+
+// replay_entries runs journal entries against the current handler
+// with the output of commands discarded, and adds up recorded and
+// replayed latencies per command. With pacing, each command starts
+// at the same offset from the first one as when it was recorded.
+static void replay_entries(Journal_Entry *entries, size_t count, int paced, unsigned int *runs, double *recorded, double *replayed) {
+    int argc, cmd, out, null;
+    size_t i, len;
+    char *line;
+    char **args;
+    double start, wait, elapsed;
+
+    fflush(stdout);
+    out = dup(1);
+    null = open(NULL_DEVICE, O_WRONLY);
+
+    if (null >= 0) {
+        dup2(null, 1);
+        close(null);
+    }
+
+    start = monotonic_time();
+
+    for (i = 0; i < count; i++) {
+        if (paced) {
+            wait = (entries[i].timestamp - entries[0].timestamp) - (monotonic_time() - start);
+            if (wait > 0) {
+                sqlite3_sleep((int) (wait * 1000));
+            }
+        }
+
+        // Tokenizing edits the line
+        len = strlen(entries[i].command);
+        line = (char *) arena_alloc(&sh_arena, len + 1);
+        memcpy(line, entries[i].command, len + 1);
+        args = sh_read_args(line, &argc);
 
-    if (status == SQLITE_OK) {
-        pretty_success("Delete category \"%s\" successfully", category->name);
-    } else {
-        pretty_fail("Failed to delete a category");
-    }
+        cmd = argc > 0 ? dispatch_lookup(&cmd_dispatch, args[0]) : -1;
 
-    return 1;
-}
+        if (cmd < 0 || cmd_func[cmd] == &replay_command || cmd_func[cmd] == &sh_exit) {
+            clear_args();
+            continue;
+        }
 
-// delete_transaction deletes the transaction.
-static int delete_transaction(Transaction *transaction) {
-    int status;
+        elapsed = monotonic_time();
+        sh_exec(argc, args);
+        elapsed = monotonic_time() - elapsed;
 
-    status = remove_transaction(transaction);
+        runs[cmd]++;
+        recorded[cmd] += entries[i].latency;
+        replayed[cmd] += elapsed * 1000;
 
-    if (status == SQLITE_OK) {
-        pretty_success("Delete transaction \"%s\" successfully", transaction->name);
-    } else {
-        pretty_fail("Failed to delete a transaction");
+        clear_args();
     }
 
-    return 1;
+    fflush(stdout);
+
+    if (out >= 0) {
+        dup2(out, 1);
+        close(out);
+    }
 }
 
-// export_transactions exports transactions into a CSV file.
-static int export_transactions(int argc, char **args) {
+// replay_command runs the commands of a journal again against a copy
+// of the snapshot they started from, and compares their latencies with
+// the recorded ones. Journals without a snapshot are replayed against
+// a copy of the database as it is.
+static int replay_command(int argc, char **args) {
     int i;
-    char *fileName;
-    FILE *outFile;
-    Queue *records, *tmprecords;
-
-    if (argc < 1) {
-        printf("File name: ");
-        fileName = sh_read_line();
+    int paced = 0;
+    size_t count;
+    unsigned int total_runs = 0;
+    unsigned int runs[NUM_SH_CMD] = { 0 };
+    double recorded[NUM_SH_CMD] = { 0 };
+    double replayed[NUM_SH_CMD] = { 0 };
+    double total_recorded = 0, total_replayed = 0;
+    char path[DB_NAME_SIZE + 16];
+    char copy[DB_NAME_SIZE + 16];
+    char snapshot[DB_NAME_SIZE + 32];
+    char *arg;
+    Journal_Entry *entries;
+    DB_Handler *session, *source, *replay;
+
+    arg = sh_positional(argc, args, 0);
+
+    if (arg == NULL) {
+        snprintf(path, sizeof(path), "%s%s", handler->db_name, JOURNAL_SUFFIX);
     } else {
-        fileName = args[0];
+        snprintf(path, sizeof(path), "%s", arg);
     }
 
-    outFile = fopen(fileName, "w");
+    arg = sh_option(argc, args, "--pace");
 
-    if (outFile == NULL) {
-        log_fatal("Couldn't open file \"%s\"", fileName);
+    if (arg != NULL && strcmp(arg, "original") == 0) {
+        paced = 1;
+    } else if (arg != NULL && strcmp(arg, "full") != 0) {
+        pretty_fail("Invalid pace \"%s\", expected full or original", arg);
         return 1;
     }
 
-    records = get_transactions(NULL);
-    tmprecords = records;
+    entries = read_journal(path, &count, snapshot, sizeof(snapshot));
+
+    if (entries == NULL) {
+        pretty_fail("Couldn't read history \"%s\"", path);
+        return 1;
+    }
 
-    fprintf(outFile, "id,title,description,amount,wallet,category\n");
+    snprintf(copy, sizeof(copy), "%s-replay", handler->db_name);
+    remove(copy);
 
-    while (tmprecords != NULL) {
-        fprintf(outFile, "%u,%s,%s,%.2lf,%s,%s\n",
-            tmprecords->record.transaction.id,
-            tmprecords->record.transaction.name,
-            tmprecords->record.transaction.description,
-            tmprecords->record.transaction.amount,
-            tmprecords->record.transaction.wallet.name,
-            tmprecords->record.transaction.category.name
-        );
-        tmprecords = tmprecords->next;
+    replay = NULL;
+
+    // The database as it is already holds what the commands wrote
+    if (snapshot[0] != '\0') {
+        source = connect(snapshot, 1);
+    } else {
+        pretty_warning("History \"%s\" has no snapshot, replaying on the database as it is", path);
+        source = handler;
     }
 
-    clear_queue(records);
+    if (source->db != NULL && backup_db(source, copy, -1, 0, NULL, NULL) == SQLITE_OK) {
+        replay = connect(copy, 0);
+    }
 
-    fclose(outFile);
+    if (source != handler) {
+        disconnect(source);
+    }
 
-    pretty_success("Data exported to \"%s\"", fileName);
+    if (replay == NULL || replay->db == NULL || init_db(replay) != SQLITE_OK) {
+        pretty_fail("Couldn't copy \"%s\" to \"%s\"", snapshot[0] != '\0' ? snapshot : handler->db_name, copy);
+    } else {
+        pretty_info("Replaying %zu commands of \"%s\" on \"%s\"", count, path, copy);
 
-    free(fileName);
+        session = handler;
+        handler = replay;
+        sh_replaying = 1;
 
-    return 1;
-}
+        replay_entries(entries, count, paced, runs, recorded, replayed);
 
-// categories_overview displays and format information about categories.
-static int categories_overview(int argc, char **args) {
-    double amount = 0.0L;
-    Queue *records, *tmprecord;
-    
-    records = get_categories_overview(NULL);
-    tmprecord = records;
-    printf("\n+--id--|--------------name--------------|-----amount----+\n");
-    while (tmprecord != NULL) {
-        printf("|%-6u|%-32.32s|%15.2lf|\n",
-            tmprecord->record.category.id,
-            tmprecord->record.category.name,
-            tmprecord->record.category.amount
-        );
-        amount += tmprecord->record.category.amount;
-        tmprecord = tmprecord->next;
-    }
+        sh_replaying = 0;
+        handler = session;
 
-    printf("+------|--------------------------------|-----amount----+\n");
+        printf("\n+-command------|-count-|---recorded ms--|---replayed ms--+\n");
+        for (i = 0; i < NUM_SH_CMD; i++) {
+            if (runs[i] == 0) {
+                continue;
+            }
+            printf("|%-14.14s|%7u|%16.3lf|%16.3lf|\n", lst_cmd[i], runs[i], recorded[i], replayed[i]);
+            total_runs += runs[i];
+            total_recorded += recorded[i];
+            total_replayed += replayed[i];
+        }
+        printf("+--------------|-------|----------------|----------------+\n");
+        printf("|%-14s|%7u|%16.3lf|%16.3lf|\n", "Total", total_runs, total_recorded, total_replayed);
+        printf("+-------------------------------------------------------+\n");
+    }
 
-    printf("|%-6u|%-32.32s|%15.2lf|\n", 0, "Total", amount);
+    if (replay != NULL) {
+        disconnect(replay);
+    }
 
-    printf("+-------------------------------------------------------+\n");
+    remove(copy);
+    snprintf(copy, sizeof(copy), "%s-replay%s", handler->db_name, CACHE_SUFFIX);
+    remove(copy);
 
-    clear_queue(records);
+    for (i = 0; i < (int) count; i++) {
+        free(entries[i].command);
+    }
+    free(entries);
 
     return 1;
 }
@@ -446,15 +2600,12 @@ static int create_record(RECORD_TYPES type, Record *record) {
                     printf("Name: ");
                     line = sh_read_line();
                     if (line[0] == EOF) {
-                        free(line);
                         return 0;
                     }
                     if (line[0] != '\0' && line[0] != 32) {
                         strcpy(record->wallet.name, line);
-                        free(line);
                         break;
                     }
-                    free(line);
                 }
             }
             create_wallet(&record->wallet);
@@ -466,21 +2617,18 @@ static int create_record(RECORD_TYPES type, Record *record) {
                     printf("Name: ");
                     line = sh_read_line();
                     if (line[0] == EOF) {
-                        free(line);
                         return 0;
                     }
                     if (line[0] != '\0' && line[0] != 32) {
                         strcpy(record->category.name, line);
-                        free(line);
                         break;
                     }
-                    free(line);
                 }
             }
             create_category(&record->category);
             break;
         case TRANSACTION_TYPE:
-            if (count_records(WALLET_TYPE) < 1) {
+            if (!has_records(handler, WALLET_TYPE)) {
                 pretty_fail("You cannot create a transaction without any wallet.");
                 break;
             }
@@ -490,15 +2638,12 @@ static int create_record(RECORD_TYPES type, Record *record) {
                     printf("Name: ");
                     line = sh_read_line();
                     if (line[0] == EOF) {
-                        free(line);
                         return 0;
                     }
                     if (line[0] != '\0' && line[0] != 32) {
                         strcpy(record->transaction.name, line);
-                        free(line);
                         break;
                     }
-                    free(line);
                 }
             }
             // Check if transaction's description is not empty
@@ -507,15 +2652,12 @@ static int create_record(RECORD_TYPES type, Record *record) {
                     printf("Description: ");
                     line = sh_read_line();
                     if (line[0] == EOF) {
-                        free(line);
                         return 0;
                     }
                     if (line[0] != '\0' && line[0] != 32) {
                         strcpy(record->transaction.description, line);
-                        free(line);
                         break;
                     }
-                    free(line);
                 }
             }
             if (record->transaction.amount == 0.0) {
@@ -523,15 +2665,12 @@ static int create_record(RECORD_TYPES type, Record *record) {
                     printf("Amount: ");
                     line = sh_read_line();
                     if (line[0] == EOF) {
-                        free(line);
                         return 0;
                     }
                     if (line[0] != '\0' && line[0] != 32 && sh_is_float(line)) {
                         record->transaction.amount = atof(line);
-                        free(line);
                         break;
                     }
-                    free(line);
                 }
             }
             // Check if transaction linked to the wallet is not empty
@@ -540,44 +2679,38 @@ static int create_record(RECORD_TYPES type, Record *record) {
                     printf("Wallet Name: ");
                     line = sh_read_line();
                     if (line[0] == EOF) {
-                        free(line);
                         return 0;
                     }
                     strcpy(record->transaction.wallet.name, line);
-                    wallets = get_wallets(&record->transaction.wallet);
+                    wallets = get_wallets(handler, &record->transaction.wallet);
                     if (wallets != NULL) {
                         if (!(record->transaction.wallet.name[0] == '\0')) {
                             record->transaction.wallet = wallets->record.wallet;
                             clear_queue(wallets);
-                            free(line);
                             break;
                         }
                         clear_queue(wallets);
                     }
                     show_wallets(NULL);
-                    free(line);
                 }
             }
-            if (record->transaction.category.name[0] == '\0' && count_records(CATEGORY_TYPE) > 0) {
+            if (record->transaction.category.name[0] == '\0' && has_records(handler, CATEGORY_TYPE)) {
                 for (;;) {
                     printf("Category Name: ");
                     line = sh_read_line();
                     if (line[0] == EOF) {
-                        free(line);
                         return 0;
                     }
                     strcpy(record->transaction.category.name, line);
-                    categories = get_categories(&record->transaction.category);
+                    categories = get_categories(handler, &record->transaction.category);
                     if (categories != NULL) {
                         if (!(record->transaction.category.name[0] == '\0')) {
                             record->transaction.category = categories->record.category;
                         }
                         clear_queue(categories);
-                        free(line);
                         break;
                     }
                     show_categories(NULL);
-                    free(line);
                 }
             }
             create_transaction(&record->transaction);
@@ -618,7 +2751,7 @@ static int delete_record(RECORD_TYPES type, Record *record) {
     switch (type) {
         case WALLET_TYPE:
             // List of wallets is empty
-            if (count_records(WALLET_TYPE) < 1) {
+            if (!has_records(handler, WALLET_TYPE)) {
                 pretty_fail("No wallet is available.");
                 break;
             }
@@ -627,21 +2760,18 @@ static int delete_record(RECORD_TYPES type, Record *record) {
                     printf("Name: ");
                     line = sh_read_line();
                     if (line[0] == EOF) {
-                        free(line);
                         return 0;
                     }
                     strcpy(record->wallet.name, line);
-                    wallets = get_wallets(&record->wallet);
+                    wallets = get_wallets(handler, &record->wallet);
                     if (wallets != NULL) {
                         if (!(record->wallet.name[0] == '\0')) {
                             record->wallet = wallets->record.wallet;
                         }
                         clear_queue(wallets);
-                        free(line);
                         break;
                     }
                     show_wallets(NULL);
-                    free(line);
                 }
             }
             // Check if record exists
@@ -649,15 +2779,14 @@ static int delete_record(RECORD_TYPES type, Record *record) {
                 break;
             }
             pretty_warning("Deleting a wallet will remove all transactions linked to this wallet.");
-            printf("Would you like to continue (y/n)? ");
-            if (getchar() != 'y' && getchar() != 'Y') {
+            if (!sh_confirm("Would you like to continue")) {
                 break;
             }
             delete_wallet(&record->wallet);
             break;
         case CATEGORY_TYPE:
             // Lists of categories is empty
-            if (count_records(CATEGORY_TYPE) < 1) {
+            if (!has_records(handler, CATEGORY_TYPE)) {
                 pretty_fail("No category is available.");
                 break;
             }
@@ -666,21 +2795,18 @@ static int delete_record(RECORD_TYPES type, Record *record) {
                     printf("Category Name: ");
                     line = sh_read_line();
                     if (line[0] == EOF) {
-                        free(line);
                         return 0;
                     }
                     strcpy(record->category.name, line);
-                    categories = get_categories(&record->category);
+                    categories = get_categories(handler, &record->category);
                     if (categories != NULL) {
                         if (!(record->category.name[0] == '\0')) {
                             record->category = categories->record.category;
                         }
                         clear_queue(categories);
-                        free(line);
                         break;
                     }
                     show_categories(NULL);
-                    free(line);
                 }
             }
             // Check if record exists
@@ -691,7 +2817,7 @@ static int delete_record(RECORD_TYPES type, Record *record) {
             break;
         case TRANSACTION_TYPE:
             // List of transactions is empty
-            if (count_records(TRANSACTION_TYPE) < 1) {
+            if (!has_records(handler, TRANSACTION_TYPE)) {
                 pretty_fail("No transaction is available.");
                 break;
             }
@@ -700,20 +2826,17 @@ static int delete_record(RECORD_TYPES type, Record *record) {
                     printf("ID: ");
                     line = sh_read_line();
                     if (line[0] == EOF) {
-                        free(line);
                         return 0;
                     }
                     if (line[0] != '\0' && line[0] != 32 && sh_is_int(line)) {
                         record->transaction.id = atoi(line);
-                        transactions = get_transactions(&record->transaction);
+                        transactions = get_transactions(handler, &record->transaction);
                         if (transactions != NULL) {
                             record->transaction = transactions->record.transaction;
                             clear_queue(transactions);
-                            free(line);
                             break;
                         }
                     }
-                    free(line);
                     show_transactions(NULL);
                 }   
             }
@@ -734,14 +2857,15 @@ static int delete_record(RECORD_TYPES type, Record *record) {
 // shell arguments.
 static void parse_wallet(int argc, char **args, Wallet *wallet) {
     int i;
+    char *arg;
     Queue *wallets;
 
     for (i = 0; i < argc; i++) {
         switch (i) {
             // Name
             case 0:
-                strcpy(wallet->name, args[i]);
-                wallets = get_wallets(wallet);
+                snprintf(wallet->name, sizeof(wallet->name), "%s", args[i]);
+                wallets = get_wallets(handler, wallet);
                 if (wallets != NULL) {
                     *wallet = wallets->record.wallet;
                     clear_queue(wallets);
@@ -751,6 +2875,16 @@ static void parse_wallet(int argc, char **args, Wallet *wallet) {
                 break;
         }
     }
+
+    // Currency
+    arg = sh_option(argc, args, "--currency");
+    if (arg != NULL) {
+        if (sh_is_currency(arg)) {
+            snprintf(wallet->currency, sizeof(wallet->currency), "%s", arg);
+        } else {
+            pretty_warning("Ignoring invalid currency \"%s\", expected a code such as EUR", arg);
+        }
+    }
 }
 
 // parse_category create a category structure from
@@ -763,8 +2897,8 @@ static void parse_category(int argc, char **args, Category *category) {
         switch (i) {
             // Name
             case 0:
-                strcpy(category->name, args[i]);
-                categories = get_categories(category);
+                snprintf(category->name, sizeof(category->name), "%s", args[i]);
+                categories = get_categories(handler, category);
                 if (categories != NULL) {
                     *category = categories->record.category;
                     clear_queue(categories);
@@ -780,18 +2914,23 @@ static void parse_category(int argc, char **args, Category *category) {
 // shell arguments.
 static void parse_transaction(int argc, char **args, Transaction *transaction) {
     int i;
+    char *arg;
     Queue *wallets;
     Queue *categories;
     Queue *transactions;
     Wallet wallet;
     Category category;
 
-    for (i = 0; i < argc; i++) {
+    // Looked up by name only
+    memset(&wallet, 0, sizeof(Wallet));
+    memset(&category, 0, sizeof(Category));
+
+    for (i = 0; (arg = sh_positional(argc, args, i)) != NULL; i++) {
         switch (i) {
             // Name
             case 0:
-                strcpy(transaction->name, args[i]);
-                transactions = get_transactions(transaction);
+                snprintf(transaction->name, sizeof(transaction->name), "%s", arg);
+                transactions = get_transactions(handler, transaction);
                 if (transactions != NULL) {
                     *transaction = transactions->record.transaction;
                     clear_queue(transactions);
@@ -799,18 +2938,18 @@ static void parse_transaction(int argc, char **args, Transaction *transaction) {
                 break;
             // Description
             case 1:
-                strcpy(transaction->description, args[i]);
+                snprintf(transaction->description, sizeof(transaction->description), "%s", arg);
                 break;
             // Amount
             case 2:
-                if (sh_is_float(args[i])) {
-                    transaction->amount = atoi(args[i]);
+                if (sh_is_float(arg)) {
+                    transaction->amount = atof(arg);
                 }
                 break;
             // Wallet
             case 3:
-                strcpy(wallet.name, args[i]);
-                wallets = get_wallets(&wallet);
+                snprintf(wallet.name, sizeof(wallet.name), "%s", arg);
+                wallets = get_wallets(handler, &wallet);
                 if (wallets != NULL) {
                     transaction->wallet = wallets->record.wallet;
                     clear_queue(wallets);
@@ -818,8 +2957,8 @@ static void parse_transaction(int argc, char **args, Transaction *transaction) {
                 break;
             // Category
             case 4:
-                strcpy(category.name, args[i]);
-                categories = get_categories(&category);
+                snprintf(category.name, sizeof(category.name), "%s", arg);
+                categories = get_categories(handler, &category);
                 if (categories != NULL) {
                     transaction->category = categories->record.category;
                     clear_queue(categories);
@@ -829,13 +2968,32 @@ static void parse_transaction(int argc, char **args, Transaction *transaction) {
                 break;
         }
     }
+
+    // Date
+    arg = sh_option(argc, args, "--date");
+    if (arg != NULL) {
+        if (sh_is_date(arg)) {
+            snprintf(transaction->date, sizeof(transaction->date), "%s", arg);
+        } else {
+            pretty_warning("Ignoring invalid date \"%s\", expected YYYY-MM-DD", arg);
+        }
+    }
+
+    // Currency, the wallet's by default
+    arg = sh_option(argc, args, "--currency");
+    if (arg != NULL) {
+        if (sh_is_currency(arg)) {
+            snprintf(transaction->currency, sizeof(transaction->currency), "%s", arg);
+        } else {
+            pretty_warning("Ignoring invalid currency \"%s\", expected a code such as EUR", arg);
+        }
+    }
 }
 
 // wallet_cmd handles interaction with wallet.
 // It's responsible for creating wallet,
 // displaying wallet and deleting wallet.
 static int wallet_cmd(int argc, char **args) {
-    int i;
     Record record;
 
     if (argc < 1 || args[0] == NULL) {
@@ -845,25 +3003,17 @@ static int wallet_cmd(int argc, char **args) {
 
     record.wallet.id = 0;
     record.wallet.name[0] = '\0';
+    record.wallet.currency[0] = '\0';
 
     parse_wallet(argc-1, args+1, &record.wallet);
 
-    for (i = 0; i < NUM_SH_SUB_CMD; i++) {
-        if (strcmp(args[0], lst_sub_cmd[i]) == 0) {
-            return (*sub_cmd_func[i])(WALLET_TYPE, &record);
-        }
-    }
-
-    pretty_fail("Invalid command \"%s\" for wallet", args[0]);
-
-    return 1;
+    return sh_sub_exec(WALLET_TYPE, args[0], &record);
 }
 
 // category_cmd handles interaction with category.
 // It's responsible for creating category,
 // displaying category and deleting category.
 static int category_cmd(int argc, char **args) {
-    int i;
     Record record;
 
     if (argc < 1 || args[0] == NULL) {
@@ -876,13 +3026,112 @@ static int category_cmd(int argc, char **args) {
 
     parse_category(argc-1, args+1, &record.category);
 
-    for (i = 0; i < NUM_SH_SUB_CMD; i++) {
-        if (strcmp(args[0], lst_sub_cmd[i]) == 0) {
-            return (*sub_cmd_func[i])(CATEGORY_TYPE, &record);
+    return sh_sub_exec(CATEGORY_TYPE, args[0], &record);
+}
+
+// delete_progress displays the progress of a bulk delete.
+static void delete_progress(int remaining, int total, void *udata) {
+    (void) udata;
+
+    printf("\r%d/%d transactions", total - remaining, total);
+    fflush(stdout);
+}
+
+// delete_matching removes every transaction matching
+// --where name=NAME, --before DATE and --wallet NAME,
+// --chunk rows at a time.
+static int delete_matching(int argc, char **args) {
+    int chunk = DELETE_CHUNK;
+    unsigned int matching, deleted;
+    char *where, *wallet, *option;
+    char *before, date[11];
+    double elapsed;
+    sqlite3_int64 last_id;
+    Transaction filter;
+    Queue *wallets;
+    Wallet *found;
+
+    filter.name[0] = '\0';
+    filter.wallet.id = 0;
+
+    where = sh_option(argc, args, "--where");
+    before = sh_option(argc, args, "--before");
+    wallet = sh_option(argc, args, "--wallet");
+
+    if (where != NULL) {
+        if (strncmp(where, "name=", 5) != 0 || where[5] == '\0') {
+            pretty_fail("Expect --where name=NAME");
+            return 1;
+        }
+        snprintf(filter.name, sizeof(filter.name), "%s", where + 5);
+    }
+
+    if (before != NULL && !sh_is_date(before)) {
+        pretty_fail("Expect --before YYYY-MM-DD");
+        return 1;
+    }
+
+    // Arguments live in the line buffer the confirmation reads into
+    if (before != NULL) {
+        snprintf(date, sizeof(date), "%s", before);
+        before = date;
+    }
+
+    if (wallet != NULL) {
+        wallets = get_wallets(handler, NULL);
+        found = find_wallet(wallets, wallet);
+        if (found == NULL) {
+            pretty_fail("Wallet \"%s\" doesn't exist", wallet);
+            clear_queue(wallets);
+            return 1;
+        }
+        filter.wallet = *found;
+        clear_queue(wallets);
+    }
+
+    if (where == NULL && before == NULL && wallet == NULL) {
+        pretty_fail("Expect at least one of --where, --before and --wallet");
+        return 1;
+    }
+
+    option = sh_option(argc, args, "--chunk");
+    if (option != NULL) {
+        if (!sh_is_int(option) || (chunk = atoi(option)) < 1) {
+            pretty_fail("Expect --chunk to be a positive number");
+            return 1;
         }
     }
 
-    pretty_fail("Invalid command \"%s\" for category", args[0]);
+    matching = count_matching(handler, &filter, before, &last_id);
+
+    if (matching == 0) {
+        pretty_info("No transaction matches");
+        return 1;
+    }
+
+    pretty_warning("%u transactions match and will be removed.", matching);
+    if (!sh_confirm("Would you like to continue")) {
+        return 1;
+    }
+
+    elapsed = monotonic_time();
+
+    if (remove_matching(handler, &filter, before, last_id, chunk, &deleted, &delete_progress, NULL) != SQLITE_OK) {
+        printf("\n");
+        pretty_fail("Failed to remove transactions, %u were removed before the error", deleted);
+        return 1;
+    }
+
+    elapsed = monotonic_time() - elapsed;
+
+    printf("\n");
+    pretty_success("%u transactions removed", deleted);
+    pretty_info("%u chunks of %d in %.3lfs (%.0lf rows/s)",
+        (deleted + chunk - 1) / chunk,
+        chunk,
+        elapsed,
+        elapsed > 0 ? deleted / elapsed : 0.0
+    );
 
     return 1;
 }
@@ -891,7 +3140,8 @@ static int category_cmd(int argc, char **args) {
 // It's responsible for creating transaction,
 // displaying transaction and deleting transaction.
 static int transaction_cmd(int argc, char **args) {
-    int i;
+    int sub;
+    char *from, *to;
     Record record;
 
     if (argc < 1 || args[0] == NULL) {
@@ -899,25 +3149,41 @@ static int transaction_cmd(int argc, char **args) {
         return 1;
     }
 
+    record.transaction.id = 0;
     record.transaction.name[0] = '\0';
     record.transaction.description[0] = '\0';
     record.transaction.amount = 0.0L;
+    record.transaction.date[0] = '\0';
+    record.transaction.currency[0] = '\0';
     record.transaction.wallet.id = 0;
     record.transaction.wallet.name[0] = '\0';
     record.transaction.category.id = 0;
     record.transaction.category.name[0] = '\0';
 
-    parse_transaction(argc-1, args+1, &record.transaction);
+    // Date range, which may reach into archives
+    from = sh_option(argc-1, args+1, "--from");
+    to = sh_option(argc-1, args+1, "--to");
+
+    if (from != NULL || to != NULL) {
+        sub = dispatch_lookup(&sub_cmd_dispatch, args[0]);
+        if (sub >= 0 && sub_cmd_func[sub] == &show_record) {
+            return show_transactions_between(from, to);
+        }
+    }
 
-    for (i = 0; i < NUM_SH_SUB_CMD; i++) {
-        if (strcmp(args[0], lst_sub_cmd[i]) == 0) {
-            return (*sub_cmd_func[i])(TRANSACTION_TYPE, &record);
+    // Bulk delete by filter
+    if (sh_option(argc-1, args+1, "--where") != NULL ||
+        sh_option(argc-1, args+1, "--before") != NULL ||
+        sh_option(argc-1, args+1, "--wallet") != NULL) {
+        sub = dispatch_lookup(&sub_cmd_dispatch, args[0]);
+        if (sub >= 0 && sub_cmd_func[sub] == &delete_record) {
+            return delete_matching(argc-1, args+1);
         }
     }
 
-    pretty_fail("Invalid command \"%s\" for transaction", args[0]);
+    parse_transaction(argc-1, args+1, &record.transaction);
 
-    return 1;
+    return sh_sub_exec(TRANSACTION_TYPE, args[0], &record);
 }
 
 // wallet_help displays help for wallet.
@@ -926,7 +3192,9 @@ static int wallet_help() {
     printf("The commands are:\n\n");
     printf("\tadd\t\tadd a wallet\n");
     printf("\tremove\t\tremove a wallet\n");
-    printf("\tshow\t\tshow a wallet\n");
+    printf("\tshow\t\tshow a wallet\n\n");
+    printf("add also takes --currency CODE for a wallet in another currency\n");
+    printf("than the base one, see help fx.\n\n");
     return 1;
 }
 
@@ -942,17 +3210,24 @@ static int category_help() {
 
 // transaction_help displays help for transaction.
 static int transaction_help() {
-    printf("\ntransaction <cmd> [name] [description] [amount] [wallet] [category]\n\n");
+    printf("\ntransaction <cmd> [name] [description] [amount] [wallet] [category] [--date YYYY-MM-DD]\n");
+    printf("            [--currency CODE]\n\n");
     printf("The commands are:\n\n");
     printf("\tadd\t\tadd a transaction\n");
     printf("\tremove\t\tremove a transaction\n");
-    printf("\tshow\t\tshow a transaction\n");
+    printf("\tshow\t\tshow a transaction\n\n");
+    printf("show also takes --from YYYY-MM-DD and --to YYYY-MM-DD to list the\n");
+    printf("transactions of a period, including archived ones.\n\n");
+    printf("remove also takes --where name=NAME, --before YYYY-MM-DD and\n");
+    printf("--wallet NAME to remove every matching transaction, --chunk rows\n");
+    printf("at a time (%d by default). Transfers and opening balances are\n", DELETE_CHUNK);
+    printf("kept.\n\n");
     return 1;
 }
 
 // export_help displays help for export.
 static int export_help() {
-    printf("\nusage: export [filename]\n\n");
+    printf("\nusage: export [filename] [--format csv|columnar]\n\n");
     return 1;
 }
 
@@ -962,16 +3237,192 @@ static int overview_help() {
     return 1;
 }
 
+// consolidate_help displays help for consolidate command.
+static int consolidate_help() {
+    printf("\nusage: consolidate <database> [database ...]\n\n");
+    return 1;
+}
+
+// backup_help displays help for backup command.
+static int backup_help() {
+    printf("\nusage: backup <filename> [--pages N] [--sleep ms]\n\n");
+    printf("Copies N pages (default %d) at a time and waits between steps,\n", BACKUP_PAGES);
+    printf("so the database can still be used during the backup.\n\n");
+    return 1;
+}
+
+// restore_help displays help for restore command.
+static int restore_help() {
+    printf("\nusage: restore <filename> [--pages N] [--sleep ms]\n\n");
+    return 1;
+}
+
+// explain_help displays help for explain command.
+static int explain_help() {
+    printf("\nusage: explain <command> [cmd]\n\n");
+    printf("Displays the query plans of a command, e.g. explain wallet show.\n\n");
+    return 1;
+}
+
+// cache_help displays help for cache command.
+static int cache_help() {
+    printf("\ncache <cmd>\n\n");
+    printf("The commands are:\n\n");
+    printf("\ton\t\tmap the cache, rebuilding it if needed\n");
+    printf("\toff\t\tstop using the cache\n");
+    printf("\trebuild\t\trebuild the cache\n");
+    printf("\tstatus\t\tshow the state of the cache\n\n");
+    printf("Balances and overviews are computed from the cache while it is\n");
+    printf("up to date, and from the database otherwise.\n\n");
+    return 1;
+}
+
+// report_help displays help for report command.
+static int report_help() {
+    printf("\nreport <cmd>\n\n");
+    printf("The commands are:\n\n");
+    printf("\ttop [--by category|wallet|name] [--n N]\n");
+    printf("\t\t\tthe N groups that spent the most (default %d)\n", REPORT_TOP_N);
+    printf("\tpercentiles [--field amount]\n");
+    printf("\t\t\tpercentiles of transaction amounts, within %.0lf%%\n\n", SKETCH_ACCURACY * 100);
+    printf("Amounts are counted in the base currency, see help fx. Transfers\n");
+    printf("between wallets and opening balances aren't counted. Past %d\n", REPORT_MAX_GROUPS - 1);
+    printf("names, top counts the spending of new names as \"(other)\".\n\n");
+    return 1;
+}
+
+// recurring_help displays help for recurring command.
+static int recurring_help() {
+    printf("\nrecurring <cmd>\n\n");
+    printf("The commands are:\n\n");
+    printf("\tadd <name> <description> <amount> <wallet> [category]\n");
+    printf("\t    [--every daily|weekly|monthly|yearly] [--interval N] [--start YYYY-MM-DD]\n");
+    printf("\t\t\tcreate a recurring transaction, monthly from today by default\n");
+    printf("\tshow [name]\tlist recurring transactions and their next date\n");
+    printf("\tremove <name>\tdelete a recurring transaction\n");
+    printf("\tmaterialize [--until YYYY-MM-DD]\n");
+    printf("\t\t\tcreate the transactions due until the date, today by default\n\n");
+    printf("Materializing twice never creates a transaction twice.\n\n");
+    return 1;
+}
+
+// transfer_help displays help for transfer command.
+static int transfer_help() {
+    printf("\nusage: transfer <from> <to> <amount> [--date YYYY-MM-DD] [--description text]\n");
+    printf("       transfer batch <filename>\n\n");
+    printf("A batch file holds one transfer per line, as\n");
+    printf("from,to,amount[,date[,description]]. Lines starting with # are\n");
+    printf("skipped. All transfers of a batch are made at once, or none is.\n\n");
+    return 1;
+}
+
+// archive_help displays help for archive command.
+static int archive_help() {
+    printf("\nusage: archive --before YYYY-MM-DD\n\n");
+    printf("Moves transactions dated before the date into one database per\n");
+    printf("year, named after the database with \"%s<year>\", and keeps an\n", ARCHIVE_SUFFIX);
+    printf("opening balance per wallet and category. Balances don't change.\n");
+    printf("Use transaction show --from/--to to list archived transactions.\n\n");
+    return 1;
+}
+
+// replay_help displays help for replay command.
+static int replay_help() {
+    printf("\nusage: replay [journal] [--pace full|original]\n\n");
+    printf("Runs the commands of a history journal, by default the one of\n");
+    printf("this database (\"%s\"), against a copy of the snapshot taken\n", JOURNAL_SUFFIX);
+    printf("when the journal was created (\"%s%s\"),\n", JOURNAL_SUFFIX, JOURNAL_SNAPSHOT_SUFFIX);
+    printf("and compares their latencies with the recorded ones. Commands\n");
+    printf("run back to back by default, or as spaced out as they were with\n");
+    printf("--pace original. Their output is discarded.\n\n");
+    return 1;
+}
+
+// undo_help displays help for undo command.
+static int undo_help() {
+    printf("\nusage: undo [n]\n\n");
+    printf("Undoes the changes of the last n commands, 1 by default, at\n");
+    printf("once. The last %d commands which made changes can be undone,\n", UNDO_DEPTH);
+    printf("except archiving, which can't be undone.\n\n");
+    return 1;
+}
+
+// redo_help displays help for redo command.
+static int redo_help() {
+    printf("\nusage: redo [n]\n\n");
+    printf("Redoes the changes of the last n commands undone, 1 by default.\n");
+    printf("Commands can't be redone once another command made changes.\n\n");
+    return 1;
+}
+
+// mem_help displays help for mem command.
+static int mem_help() {
+    printf("\nusage: mem [--heap-limit SIZE] [--cache-limit SIZE]\n\n");
+    printf("Displays the memory used by SQLite, the page cache of the\n");
+    printf("connection, the lists of records and the shell, in KiB.\n");
+    printf("--heap-limit asks SQLite to free memory, such as its page\n");
+    printf("caches, once its heap grows over SIZE. --cache-limit bounds\n");
+    printf("the page cache of the connection. Sizes take a K, M or G\n");
+    printf("suffix, 0 removes the heap limit.\n\n");
+    return 1;
+}
+
+// budget_help displays help for budget command.
+static int budget_help() {
+    printf("\nbudget <cmd>\n\n");
+    printf("The commands are:\n\n");
+    printf("\tadd [--wallet name] [--category name] --limit amount\n");
+    printf("\t    [--every daily|weekly|monthly|yearly] [--warn percent]\n");
+    printf("\t\t\tlimit the spending of a wallet, a category or both,\n");
+    printf("\t\t\tmonthly and warning at 80%% by default\n");
+    printf("\tshow [--date YYYY-MM-DD]\n");
+    printf("\t\t\tlist budgets and their spending over the period of the date\n");
+    printf("\tremove <id>\tdelete a budget\n\n");
+    printf("A warning is displayed as soon as a new transaction crosses the\n");
+    printf("warning threshold or the limit of a budget. Weeks start on Monday.\n");
+    printf("Spending is counted in the base currency, see help fx.\n\n");
+    return 1;
+}
+
+// fx_help displays help for fx command.
+static int fx_help() {
+    printf("\nfx <cmd>\n\n");
+    printf("The commands are:\n\n");
+    printf("\tset <currency> <rate> [--date YYYY-MM-DD]\n");
+    printf("\t\t\tvalue one unit of currency at rate in the base currency\n");
+    printf("\t\t\tfrom the date on, today by default\n");
+    printf("\tshow [currency]\tlist exchange rates\n");
+    printf("\tremove <currency> [--date YYYY-MM-DD]\n");
+    printf("\t\t\tdelete the rate of a date, or every rate of the currency\n\n");
+    printf("Wallets created with --currency hold amounts in that currency, and\n");
+    printf("their transactions too unless added with another --currency. Wallet\n");
+    printf("balances are in the currency of the wallet and overviews in the base\n");
+    printf("currency, converted at the rate of the date of each transaction, or\n");
+    printf("the first rate known for older ones.\n\n");
+    return 1;
+}
+
+// changes_help displays help for changes command.
+static int changes_help() {
+    printf("\nusage: changes [--since SEQ] [--follow]\n");
+    printf("       changes --prune SEQ\n\n");
+    printf("Lists every insert, update and delete made to the ledger after\n");
+    printf("the event SEQ, 0 by default, with the transaction as it is now.\n");
+    printf("--follow then waits for new events, made by other processes,\n");
+    printf("until interrupted. --prune removes the events up to SEQ once\n");
+    printf("every consumer has read them.\n\n");
+    return 1;
+}
+
 // sh_help displays the use manual for the application.
 static int sh_help(int argc, char **args) {
     int i;
 
     // Display help for commands
     if (argc > 0) {
-        for (i = 0; i < NUM_SH_CMD-2; i++) {
-            if (strcmp(args[0], lst_cmd[i]) == 0) {
-                return (*sh_cmd_help[i])();
-            }
+        i = dispatch_lookup(&cmd_dispatch, args[0]);
+        if (i >= 0 && i < NUM_SH_CMD-2) {
+            return (*sh_cmd_help[i])();
         }
     }
 
@@ -981,10 +3432,30 @@ static int sh_help(int argc, char **args) {
     printf("\ttransaction\tcommands for transaction\n");
     printf("\texport\t\tcommands for export\n");
     printf("\toverview\tcommands for overview\n");
+    printf("\tconsolidate\tadd up several databases\n");
+    printf("\tbackup\t\tback up the database\n");
+    printf("\trestore\t\trestore the database from a backup\n");
+    printf("\texplain\t\tdisplay the query plans of a command\n");
+    printf("\tcache\t\tmanage the transactions cache\n");
+    printf("\treport\t\tdisplay spending reports\n");
+    printf("\trecurring\tcommands for recurring transactions\n");
+    printf("\ttransfer\tmove money between wallets\n");
+    printf("\tarchive\t\tmove old transactions into yearly archives\n");
+    printf("\treplay\t\treplay the history of the shell\n");
+    printf("\tundo\t\tundo the last commands\n");
+    printf("\tredo\t\tredo the last commands undone\n");
+    printf("\tchanges\t\tstream the changes made to the ledger\n");
+    printf("\tmem\t\tdisplay the memory used and set its limits\n");
+    printf("\tbudget\t\tcommands for budgets\n");
+    printf("\tfx\t\tcommands for exchange rates\n");
     printf("\thelp\t\tdisplay this message\n");
     printf("\texit\t\texit the program\n\n");
 
-    printf("Use help <command> for more information about a command.\n\n");
+    printf("Use help <command> for more information about a command.\n");
+    printf("Add --yes to a command to skip its confirmations, and\n");
+    printf("--output jsonl to a show, overview or report command to get one\n");
+    printf("JSON object per line instead of a table.\n");
+    printf("Quote arguments containing spaces, e.g. \"coffee beans\".\n\n");
 
     return 1;
 }
@@ -994,9 +3465,39 @@ static int sh_exit(int argc, char **args) {
     return 0;
 }
 
+// sh_output reads and removes --output from the arguments of a
+// command. It returns 0 and explains why if the format is unknown.
+static int sh_output(int *argc, char **args) {
+    int i;
+
+    sh_jsonl = 0;
+
+    for (i = 0; i < *argc; i++) {
+        if (strcmp(args[i], "--output") == 0) {
+            break;
+        }
+    }
+
+    if (i == *argc) {
+        return 1;
+    }
+
+    if (i + 1 == *argc || (strcmp(args[i + 1], "jsonl") != 0 && strcmp(args[i + 1], "table") != 0)) {
+        pretty_fail("Expect --output table|jsonl");
+        return 0;
+    }
+
+    sh_jsonl = strcmp(args[i + 1], "jsonl") == 0;
+
+    memmove(&args[i], &args[i + 2], (*argc - i - 2) * sizeof(char *));
+    *argc -= 2;
+
+    return 1;
+}
+
 // sh_exec executes shell command.
 static int sh_exec(int argc, char **args) {
-    int i;
+    int i, code;
 
     if (argc < 1) {
         return 1;
@@ -1007,26 +3508,96 @@ static int sh_exec(int argc, char **args) {
         return 0;
     }
 
-    for (i = 0; i < NUM_SH_CMD; i++) {
-        if (strcmp(args[0], lst_cmd[i]) == 0) {
+    i = dispatch_lookup(&cmd_dispatch, args[0]);
 
-            // Execute command
-            return (*cmd_func[i])(argc-1, args+1);
+    if (i >= 0) {
+        if (!sh_output(&argc, args)) {
+            return 1;
         }
+        sh_yes = sh_flag(argc-1, args+1, "--yes");
+        // Changes of a command are undone together
+        next_change_batch(handler);
+        // Execute command
+        code = (*cmd_func[i])(argc-1, args+1);
+        if (sh_jsonl) {
+            jsonl_flush(&sh_writer);
+        }
+        return code;
+    }
+
+    if (i == DISPATCH_AMBIGUOUS) {
+        pretty_fail("Ambiguous command \"%s\"", args[0]);
+    } else {
+        pretty_fail("Invalid command \"%s\"", args[0]);
+    }
+
+    return 1;
+}
+
+// sh_sub_exec executes the sub-command of a record command.
+static int sh_sub_exec(RECORD_TYPES type, char *sub_cmd, Record *record) {
+    int i;
+
+    i = dispatch_lookup(&sub_cmd_dispatch, sub_cmd);
+
+    if (i >= 0) {
+        return (*sub_cmd_func[i])(type, record);
     }
 
-    pretty_fail("Invalid command \"%s\"", args[0]);
+    if (i == DISPATCH_AMBIGUOUS) {
+        pretty_fail("Ambiguous command \"%s\" for %s", sub_cmd, lst_cmd[type]);
+    } else {
+        pretty_fail("Invalid command \"%s\" for %s", sub_cmd, lst_cmd[type]);
+    }
 
     return 1;
 }
 
-// sh_spawn initialize shell loop.
-void sh_spawn() {
+// sh_init builds the dispatch tables of the shell.
+static void sh_init(DB_Handler *db_handler) {
+    static int initialized = 0;
+
+    handler = db_handler;
+    set_budget_hook(handler, &warn_budget, NULL);
+
+    if (initialized) {
+        return;
+    }
+
+    reader_init(&sh_reader, 0);
+    arena_init(&sh_arena, ARENA_BLOCK_SIZE);
+    jsonl_init(&sh_writer, stdout);
+
+    if (dispatch_init(&cmd_dispatch, lst_cmd, NUM_SH_CMD) != 0 ||
+        dispatch_init(&sub_cmd_dispatch, lst_sub_cmd, NUM_SH_SUB_CMD) != 0) {
+        log_fatal("Couldn't build the command table");
+        exit(1);
+    }
+
+    initialized = 1;
+}
+
+// sh_run executes a single command on the given database
+// without spawning the interactive shell.
+int sh_run(DB_Handler *db_handler, int argc, char **args) {
+    sh_init(db_handler);
+
+    return sh_exec(argc, args);
+}
+
+// sh_spawn initialize shell loop on the given database.
+// Commands are appended to the history journal, if given.
+void sh_spawn(DB_Handler *db_handler, const char *history) {
     char *line;
     char **args;
     char *motd;
+    char *command = NULL;
+    size_t len, size = 0;
     int argc;
     int code;
+    sqlite3_int64 rows;
+    double timestamp, latency;
+    char snapshot[DB_NAME_SIZE + 32];
 
     motd = "" \
 " _    _      _                            _                           ______           _            _   _ \n" \
@@ -1038,6 +3609,22 @@ void sh_spawn() {
 "                                                                __/ |                     __/ |           \n" \
 "                                                               |___/                     |___/            \n";
 
+    sh_init(db_handler);
+
+    if (history != NULL) {
+        sh_journal = journal_open(history);
+    }
+
+    // Replays of a new journal start from the database as it is now
+    if (sh_journal != NULL && sh_journal->created) {
+        snprintf(snapshot, sizeof(snapshot), "%s%s", history, JOURNAL_SNAPSHOT_SUFFIX);
+        if (backup_db(handler, snapshot, -1, 0, NULL, NULL) == SQLITE_OK) {
+            journal_snapshot(sh_journal, snapshot);
+        } else {
+            pretty_warning("Couldn't take the snapshot \"%s\" of the history", snapshot);
+        }
+    }
+
     pretty_info("Shell initialized.\nUse help for more information.");
     printf("%s\n", motd);
 
@@ -1045,13 +3632,41 @@ void sh_spawn() {
         printf("> ");
         // Read line
         line = sh_read_line();
+
+        // Keep the command for the journal, tokenizing edits the line
+        if (sh_journal != NULL) {
+            len = strlen(line);
+            if (len + 1 > size) {
+                size = len + 1;
+                command = (char *) realloc(command, size);
+                if (!command) {
+                    log_fatal("Memory allocation error");
+                    exit(1);
+                }
+            }
+            memcpy(command, line, len + 1);
+        }
+
         // Split line into arguments
         args = sh_read_args(line, &argc);
 
+        timestamp = wall_time();
+        rows = count_rows(handler);
+        latency = monotonic_time();
+
         // CMD execution
         code = sh_exec(argc, args);
 
-        free(line);
-        clear_args(argc, args);
+        latency = monotonic_time() - latency;
+
+        if (sh_journal != NULL && argc > 0 && code != 0) {
+            journal_append(sh_journal, timestamp, latency * 1000, (int) (count_rows(handler) - rows), command);
+        }
+
+        clear_args();
     } while (code != 0);
+
+    journal_close(sh_journal);
+    sh_journal = NULL;
+    free(command);
 }
\ No newline at end of file